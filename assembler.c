@@ -1,315 +1,773 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "src/utils.h"
 #include "src/tables.h"
-#include "src/translate_utils.h"
-#include "src/translate.h"
+#include "src/reader.h"
+#include "src/ir.h"
+#include "src/object.h"
+#include "src/symindex.h"
+#include "src/hash.h"
+#include "src/pool.h"
+#include "src/bulkio.h"
+#include "src/cache.h"
+#include "src/arena.h"
 #include "assembler.h"
+#include "daemon.h"
 
-const int MAX_ARGS = 3;
-const int BUF_SIZE = 1024;
-const char* IGNORE_CHARS = " \f\n\r\t\v,()";
+/* Initial size of a mapped one-pass output file; it grows as needed. */
+#define ONE_PASS_SIZE_HINT (1 << 20)
 
-/*******************************
- * Helper Functions
- *******************************/
+/* Where to write the symbol map after pass one, if anywhere. */
+static const char* map_name = NULL;
 
-/* You should not be calling this function yourself. */
-static void raise_label_error(uint32_t input_line, const char* label) {
-    write_to_log("Error - invalid label at line %d: %s\n", input_line, label);
-}
-
-/* Call this function if more than MAX_ARGS arguments are found while parsing
-   arguments.
+/* Whether to report on the memory of each assembly session. */
+static int mem_stats = 0;
 
-   INPUT_LINE is which line of the input file that the error occurred in. Note
-   that the first line is line 1 and that empty lines are included in the count.
-
-   EXTRA_ARG should contain the first extra argument encountered.
+/* Writes PROG to the intermediate file TMP_NAME. Returns 0 on success and -1
+   if the file could not be written.
  */
-static void raise_extra_arg_error(uint32_t input_line, const char* extra_arg) {
-    write_to_log("Error - extra argument at line %d: %s\n", input_line, extra_arg);
+static int write_intermediate(const char* tmp_name, const Program* prog) {
+    Writer dst;
+    // every instruction is its text plus a newline, or just a newline
+    if (open_writer(&dst, tmp_name, prog->text_len + prog->len) != 0) {
+        write_to_log("Error: unable to open output file: %s\n", tmp_name);
+        return -1;
+    }
+    write_program_text(prog, &dst);
+    if (close_writer(&dst) != 0) {
+        write_to_log("Error: unable to write output file: %s\n", tmp_name);
+        return -1;
+    }
+    return 0;
 }
 
-/* You should call this function if write_pass_one() or translate_inst() 
-   returns -1. 
- 
-   INPUT_LINE is which line of the input file that the error occurred in. Note
-   that the first line is line 1 and that empty lines are included in the count.
+/* Writes SYMTBL to the symbol index next to the intermediate file TMP_NAME,
+   so that pass two can later be run on TMP_NAME without pass one. Returns 0
+   on success and -1 on error.
  */
-static void raise_inst_error(uint32_t input_line, const char* name, char** args,
-    int num_args) {
-    
-    write_to_log("Error - invalid instruction at line %d: ", input_line);
-    log_inst(name, args, num_args);
-}
-
-/* Truncates the string at the first occurrence of the '#' character. */
-static void skip_comment(char* str) {
-    char* comment_start = strchr(str, '#');
-    if (comment_start) {
-        *comment_start = '\0';
+static int write_intermediate_index(const char* tmp_name, SymbolTable* symtbl) {
+    Reader written;
+    if (open_reader(&written, tmp_name) != 0) {
+        write_to_log("Error: unable to open input file: %s\n", tmp_name);
+        return -1;
+    }
+    char* index_name = symbol_index_name(tmp_name);
+    int err = write_symbol_index(index_name, symtbl, written.size,
+        hash_name(written.data, written.size));
+    if (err != 0) {
+        write_to_log("Error: unable to write output file: %s\n", index_name);
     }
+    free(index_name);
+    close_reader(&written);
+    return err;
 }
 
-/* Reads STR and determines whether it is a label (ends in ':'), and if so,
-   whether it is a valid label, and then tries to add it to the symbol table.
-
-   INPUT_LINE is which line of the input file we are currently processing. Note
-   that the first line is line 1 and that empty lines are included in this count.
-
-   BYTE_OFFSET is the offset of the NEXT instruction (should it exist). 
-
-   Four scenarios can happen:
-    1. STR is not a label (does not end in ':'). Returns 0.
-    2. STR ends in ':', but is not a valid label. Returns -1.
-    3a. STR ends in ':' and is a valid label. Addition to symbol table fails.
-        Returns -1.
-    3b. STR ends in ':' and is a valid label. Addition to symbol table succeeds.
-        Returns 1.
+/* Loads the symbol index next to the intermediate file TMP_NAME into SYMTBL,
+   if there is one and it was written for the SIZE bytes at DATA.
  */
-static int add_if_label(uint32_t input_line, char* str, uint32_t byte_offset,
+static void read_intermediate_index(const char* tmp_name, const char* data, size_t size,
     SymbolTable* symtbl) {
-    
-    size_t len = strlen(str);
-    if (str[len - 1] == ':') {
-        str[len - 1] = '\0';
-        if (is_valid_label(str)) {
-            if (add_to_table(symtbl, str, byte_offset) == 0) {
-                return 1;
-            } else {
-                return -1;
-            }
+    SymbolIndex index;
+    char* index_name = symbol_index_name(tmp_name);
+    if (open_symbol_index(&index, index_name) == 0) {
+        if (symbol_index_matches(&index, data, size)) {
+            load_symbol_index(&index, symtbl);
         } else {
-            raise_label_error(input_line, str);
-            return -1;
+            write_to_log("Warning: ignoring out-of-date symbol index: %s\n", index_name);
         }
-    } else {
-        return 0;
+        close_symbol_index(&index);
     }
+    free(index_name);
 }
 
-/*******************************
- * Implement the Following
- *******************************/
-
-/*  A helpful helper function that parses instruction arguments. It raises an error
-    if too many arguments have been passed into the instruction.
-*/
-static int parse_args(uint32_t input_line, char** args, int* num_args) {
-    char* token;
-    while ((token = strtok(NULL, IGNORE_CHARS))) {
-        if (*num_args < MAX_ARGS) {
-            args[*num_args] = token;
-            (*num_args)++;
-        } else {
-            raise_extra_arg_error(input_line, token);
-            return -1;
-        }
+/* Writes how each stage of pass_pipeline() did to OUTPUT. */
+static void print_stage_stats(FILE* output, const StageStats* stats) {
+    fprintf(output, "%-8s %10s %10s %12s %14s\n", "Stage", "Busy (s)", "Wait (s)", "Items",
+        "Items/s busy");
+    for (int k = 0; k < PIPELINE_STAGES; k++) {
+        const StageStats* stage = &stats[k];
+        fprintf(output, "%-8s %10.3f %10.3f %12llu %14.0f\n", stage->name, stage->busy,
+            stage->wait, (unsigned long long) stage->items,
+            stage->busy > 0 ? stage->items / stage->busy : 0);
     }
-    return 0;
 }
 
-/* First pass of the assembler. You should implement pass_two() first.
-
-   This function should read each line, strip all comments, scan for labels,
-   and pass instructions to write_pass_one(). The input file may or may not
-   be valid. Here are some guidelines:
-
-    1. Only one label may be present per line. It must be the first token present.
-        Once you see a label, regardless of whether it is a valid label or invalid
-        label, treat the NEXT token as the beginning of an instruction.
-    2. If the first token is not a label, treat it as the name of an instruction.
-    3. Everything after the instruction name should be treated as arguments to
-        that instruction. If there are more than MAX_ARGS arguments, call
-        raise_extra_arg_error() and pass in the first extra argument. Do not 
-        write that instruction to memory.
-    4. Only one instruction should be present per line. You do not need to do 
-        anything extra to detect this - it should be handled by guideline 3. 
-    5. A line containing only a label is valid. The address of the label should
-        be the byte offset of the next instruction, regardless of whether there
-        is a next instruction or not.
-
-   Just like in pass_two(), if the function encounters an error it should NOT
-   exit, but process the entire file and return -1. If no errors were encountered, 
-   it should return 0.
+/* Starts an assembly session on the calling thread: until end_session(),
+   the tables, names and programs of the assembly come from ARENA. Returns
+   the arena that was in use before.
  */
-int pass_one(FILE* input, FILE* output, SymbolTable* symtbl) {
-    /* YOUR CODE HERE */
-    char buf[BUF_SIZE];
-    uint32_t input_line = 0, byte_offset = 0;
-    int ret_code = 0;
-
-
-
-     // Read lines and add to instructions
-    while(fgets(buf, BUF_SIZE, input)) {
-        input_line++;
-        fgets(buf, BUF_SIZE, input);
+static Arena* begin_session(Arena* arena) {
+    init_arena(arena, 0);
+    return use_arena(arena);
+}
 
-        // Ignore comments
-        skip_comment(buf);
+/* Ends the session on ARENA, going back to OUTER, and releases everything it
+   allocated in one go.
+ */
+static void end_session(Arena* arena, Arena* outer) {
+    use_arena(outer);
+    if (mem_stats) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        print_arena_stats(arena, stdout);
+        printf("Peak RSS: %ld KB\n", usage.ru_maxrss);
+    }
+    free_arena(arena);
+}
 
-        // Scan for the instruction name
-        char* token = strtok(buf, IGNORE_CHARS);
-        int i = 0;
+/* Runs the one-pass assembler from IN_NAME to OUT_NAME. Either may be "-"
+   for standard input or output. With ASM_PIPELINE in OPTIONS, the stages run
+   on separate threads and a report on them is printed afterwards.
+ */
+static int assemble_one_pass(const char* in_name, const char* out_name, int options) {
+    Reader src;
+    Writer dst;
+    int err = 0;
 
-        if (token) {
-            if (add_if_label(input_line, token, byte_offset, symtbl)) {
-                token = strtok(NULL, IGNORE_CHARS);
-                if (token != 0) {
-                    i = 1;
-                }
-            }
+    // standard output carries the object file, so progress goes nowhere
+    if (strcmp(out_name, "-") != 0) {
+        printf("Running one pass: %s -> %s\n", in_name, out_name);
+    }
+    if (open_reader_stream(&src, in_name) != 0) {
+        write_to_log("Error: unable to open input file: %s\n", in_name);
+        exit(1);
+    }
+    // a regular file is mapped, so that branches can be patched in place
+    if (open_writer(&dst, out_name, ONE_PASS_SIZE_HINT) != 0) {
+        write_to_log("Error: unable to open output file: %s\n", out_name);
+        close_reader(&src);
+        exit(1);
+    }
 
-            // Scan for arguments
-            char* args[MAX_ARGS];
-            int num_args = 0;
-
-            if (!(parse_args(input_line, args, &num_args))) {
-                if (num_args) {
-                    if (i) {
-                        unsigned int lines_written = write_pass_one(output, token, args, num_args);
-                        if (!lines_written) {
-                            raise_inst_error(input_line, token, args, num_args);
-                            ret_code = -1;
-                        }
-                        byte_offset = byte_offset + (lines_written * 4);
-                    }
-                }
-            }
-            else {
-                ret_code = -1;
-            }
-        }
+    SymbolTable* symtbl = create_table(SYMTBL_UNIQUE_NAME);
+    SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
+    StageStats stats[PIPELINE_STAGES];
+    if (options & ASM_PIPELINE) {
+        err = pass_pipeline(&src, &dst, symtbl, reltbl, stats) != 0;
+    } else {
+        err = pass_stream(&src, &dst, symtbl, reltbl) != 0;
+    }
+    if (close_writer(&dst) != 0) {
+        write_to_log("Error: unable to write output file: %s\n", out_name);
+        err = 1;
+    }
+    if (options & ASM_PIPELINE) {
+        print_stage_stats(strcmp(out_name, "-") != 0 ? stdout : stderr, stats);
     }
-    return -ret_code;
+    close_reader(&src);
+    free_table(symtbl);
+    free_table(reltbl);
+    return err;
 }
 
-/* Reads an intermediate file and translates it into machine code. You may assume:
-    1. The input file contains no comments
-    2. The input file contains no labels
-    3. The input file contains at maximum one instruction per line
-    4. All instructions have at maximum MAX_ARGS arguments
-    5. The symbol table has been filled out already
-
-   If an error is reached, DO NOT EXIT the function. Keep translating the rest of
-   the document, and at the end, return -1. Return 0 if no errors were encountered. */
-int pass_two(FILE *input, FILE* output, SymbolTable* symtbl, SymbolTable* reltbl) {
-    /* YOUR CODE HERE */
-    char buf[BUF_SIZE];
-    int count = 0;
-    char *currLine;
-    uint32_t line = 0; 
-    uint32_t byte = 0;
-    while (fgets(buf, BUF_SIZE, input)) {
-        currLine = strtok(buf, IGNORE_CHARS);
-        line++;
-
-        int num_args = 0;
-        char *args[MAX_ARGS];
-        parse_args(line, args, &num_args);
-
-        int retval = translate_inst(output, currLine, args, num_args, byte, symtbl, reltbl);
-        if (retval == 0) {
-            byte +=4;
-        } else {
-            raise_inst_error(line, currLine, args, num_args);
-            count -= 1;
+/* Writes the symbol map of SYMTBL to map_name, if it is set. The last
+   symbols run to the end of PROG. Returns 0 on success and -1 on error.
+ */
+static int write_map(const Program* prog, SymbolTable* symtbl) {
+    if (!map_name) {
+        return 0;
+    }
+    uint32_t end = 0;
+    for (uint32_t i = 0; i < prog->len; i++) {
+        if (prog->insts[i].op != OP_NONE) {
+            end += 4;
         }
     }
-    return count;
-}
 
-/*******************************
- * Do Not Modify Code Below
- *******************************/
-
-static int open_files(FILE** input, FILE** output, const char* input_name, 
-    const char* output_name) {
-    
-    *input = fopen(input_name, "r");
-    if (!*input) {
-        write_to_log("Error: unable to open input file: %s\n", input_name);
+    Writer dst;
+    if (open_writer(&dst, map_name, 0) != 0) {
+        write_to_log("Error: unable to open output file: %s\n", map_name);
         return -1;
     }
-    *output = fopen(output_name, "w");
-    if (!*output) {
-        write_to_log("Error: unable to open output file: %s\n", output_name);
-        fclose(*input);
+    AddrIndex index;
+    build_addr_index(&index, symtbl);
+    write_symbol_map(&index, symtbl, end, &dst);
+    free_addr_index(&index);
+    if (close_writer(&dst) != 0) {
+        write_to_log("Error: unable to write output file: %s\n", map_name);
         return -1;
     }
     return 0;
 }
 
-static void close_files(FILE* input, FILE* output) {
-    fclose(input);
-    fclose(output);
+/* Runs pass one over SRC into PROG and SYMTBL, and writes the intermediate
+   file TMP_NAME and its symbol index if TMP_NAME is not NULL. Returns 0 on
+   success, 1 if the program has errors, and -1 if TMP_NAME could not be
+   written.
+ */
+static int run_pass_one(Reader* src, const char* tmp_name, Program* prog, SymbolTable* symtbl) {
+    int err = pass_one(src, prog, symtbl) != 0;
+    if (tmp_name && (write_intermediate(tmp_name, prog) != 0
+        || write_intermediate_index(tmp_name, symtbl) != 0)) {
+        return -1;
+    }
+    return err;
 }
 
-/* Runs the two-pass assembler. Most of the actual work is done in pass_one()
-   and pass_two().
+/* Same as assemble() below for a full run, but the input is the SIZE bytes
+   at DATA and the object file is written to DST. IN_NAME and OUT_NAME are
+   only used in messages. Returns -1 if TMP_NAME could not be written.
+ */
+static int assemble_buffer(const char* in_name, const char* data, size_t size,
+    const char* tmp_name, const char* out_name, Writer* dst, int options) {
+    Reader src;
+    Program prog;
+    SymbolTable* symtbl = create_table(SYMTBL_UNIQUE_NAME);
+    SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
+    init_program(&prog, tmp_name != NULL);
+
+    printf("Running pass one: %s -> %s\n", in_name, tmp_name ? tmp_name : "(memory)");
+    open_reader_mem(&src, data, size);
+    int err = run_pass_one(&src, tmp_name, &prog, symtbl);
+    close_reader(&src);
+    if (err >= 0) {
+        printf("Running pass two: %s -> %s\n", tmp_name ? tmp_name : "(memory)", out_name);
+        if (write_object(&prog, dst, symtbl, reltbl, options) != 0) {
+            err = 1;
+        }
+    }
+
+    free_program(&prog);
+    free_table(symtbl);
+    free_table(reltbl);
+    return err;
+}
+
+/* Does the work of assemble() below for the two-pass assembler. Returns -1,
+   rather than exiting, if a file cannot be opened or written, so that other
+   files can still be assembled in batch mode.
  */
-int assemble(const char* in_name, const char* tmp_name, const char* out_name) {
-    FILE *src, *dst;
+static int assemble_two_pass(const char* in_name, const char* tmp_name, const char* out_name,
+    int options) {
+    Reader src;
+    Writer dst;
+    Program prog;
     int err = 0;
     SymbolTable* symtbl = create_table(SYMTBL_UNIQUE_NAME);
     SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
 
     if (in_name) {
-        printf("Running pass one: %s -> %s\n", in_name, tmp_name);
-        if (open_files(&src, &dst, in_name, tmp_name) != 0) {
+        // the text form is only needed if it is going to be written out
+        init_program(&prog, tmp_name != NULL);
+
+        printf("Running pass one: %s -> %s\n", in_name, tmp_name ? tmp_name : "(memory)");
+        if (open_reader(&src, in_name) != 0) {
+            write_to_log("Error: unable to open input file: %s\n", in_name);
+            free_program(&prog);
             free_table(symtbl);
             free_table(reltbl);
-            exit(1);
+            return -1;
         }
 
-        if (pass_one(src, dst, symtbl) != 0) {
-            err = 1;
+        err = run_pass_one(&src, tmp_name, &prog, symtbl);
+        close_reader(&src);
+        if (err < 0 || write_map(&prog, symtbl) != 0) {
+            free_program(&prog);
+            free_table(symtbl);
+            free_table(reltbl);
+            return -1;
         }
-        close_files(src, dst);
+    } else {
+        init_program(&prog, 0);
+        if (open_reader(&src, tmp_name) != 0) {
+            write_to_log("Error: unable to open input file: %s\n", tmp_name);
+            free_program(&prog);
+            free_table(symtbl);
+            free_table(reltbl);
+            return -1;
+        }
+        read_intermediate(&src, &prog);
+        read_intermediate_index(tmp_name, src.data, src.size, symtbl);
+        close_reader(&src);
     }
 
     if (out_name) {
-        printf("Running pass two: %s -> %s\n", tmp_name, out_name);
-        if (open_files(&src, &dst, tmp_name, out_name) != 0) {
+        printf("Running pass two: %s -> %s\n", tmp_name ? tmp_name : "(memory)", out_name);
+        if (open_writer(&dst, out_name, estimate_object_size(&prog, symtbl)) != 0) {
+            write_to_log("Error: unable to open output file: %s\n", out_name);
+            free_program(&prog);
             free_table(symtbl);
             free_table(reltbl);
-            exit(1);
+            return -1;
         }
 
-        fprintf(dst, ".text\n");
-        if (pass_two(src, dst, symtbl, reltbl) != 0) {
+        if (write_object(&prog, &dst, symtbl, reltbl, options) != 0) {
+            err = 1;
+        }
+        if (close_writer(&dst) != 0) {
+            write_to_log("Error: unable to write output file: %s\n", out_name);
             err = 1;
         }
-        
-        fprintf(dst, "\n.symbol\n");
-        write_table(symtbl, dst);
-
-        fprintf(dst, "\n.relocation\n");
-        write_table(reltbl, dst);
-
-        close_files(src, dst);
     }
-    
+
+    free_program(&prog);
     free_table(symtbl);
     free_table(reltbl);
     return err;
 }
 
+/* Same as assemble() below for a full run, but first looks the input up in
+   CACHE, and on a miss assembles it in memory and stores the result there.
+   Returns -1 if a file cannot be opened or written.
+ */
+static int assemble_cached(AsmCache* cache, const char* in_name, const char* tmp_name,
+    const char* out_name, int options) {
+    Reader src;
+    if (open_reader(&src, in_name) != 0) {
+        write_to_log("Error: unable to open input file: %s\n", in_name);
+        return -1;
+    }
+    CacheKey key = cache_key(src.data, src.size, options);
+    int err = cache_fetch(cache, &key, out_name, tmp_name);
+    if (err >= 0) {
+        printf("Reusing cached output: %s -> %s\n", in_name, out_name);
+        close_reader(&src);
+        return err;
+    }
+
+    // the messages are kept for the cache as well as passed on
+    Writer log, obj;
+    open_writer_mem(&log);
+    open_writer_mem(&obj);
+    Writer* outer = capture_log(&log);
+    Arena arena;
+    Arena* outer_arena = begin_session(&arena);
+    err = assemble_buffer(in_name, src.data, src.size, tmp_name, out_name, &obj, options);
+    end_session(&arena, outer_arena);
+    capture_log(outer);
+    close_reader(&src);
+    if (log.len > 0) {
+        write_to_log("%.*s", (int) log.len, log.buf);
+    }
+
+    if (err >= 0) {
+        Writer dst;
+        if (open_writer(&dst, out_name, obj.len) != 0) {
+            write_to_log("Error: unable to open output file: %s\n", out_name);
+            err = -1;
+        } else {
+            put_bytes(&dst, obj.buf, obj.len);
+            if (close_writer(&dst) != 0) {
+                write_to_log("Error: unable to write output file: %s\n", out_name);
+                err = -1;
+            }
+        }
+    }
+    if (err >= 0) {
+        cache_store(cache, &key, obj.buf, obj.len, tmp_name, log.buf, log.len, err);
+    }
+    close_writer(&obj);
+    close_writer(&log);
+    return err;
+}
+
+/* Runs the two-pass assembler. Most of the actual work is done in pass_one()
+   and pass_two().
+
+   Pass one produces a Program that pass two reads directly. If IN_NAME is
+   NULL, the program is read from the intermediate file TMP_NAME instead,
+   along with its symbol index if it has one. If IN_NAME is given, the program
+   and its symbol index are written to TMP_NAME only if TMP_NAME is not NULL.
+   Pass two is run if OUT_NAME is not NULL. OPTIONS is a set of AsmOption
+   flags; with ASM_ONE_PASS, TMP_NAME is ignored and the program is assembled
+   by pass_stream() instead.
+ */
+int assemble(const char* in_name, const char* tmp_name, const char* out_name, int options) {
+    Arena arena;
+    Arena* outer = begin_session(&arena);
+    int err;
+    if (options & ASM_ONE_PASS) {
+        err = assemble_one_pass(in_name, out_name, options);
+    } else {
+        err = assemble_two_pass(in_name, tmp_name, out_name, options);
+    }
+    end_session(&arena, outer);
+    if (err < 0) {
+        exit(1);
+    }
+    return err;
+}
+
 static void print_usage_and_exit() {
     printf("Usage:\n");
     printf("  Runs both passes: assembler <input file> <intermediate file> <output file>\n");
     printf("  Run pass #1:      assembler -p1 <input file> <intermediate file>\n");
     printf("  Run pass #2:      assembler -p2 <intermediate file> <output file>\n");
+    printf("  Run in one pass:  assembler -one-pass <input file> <output file>\n");
+    printf("  Run as a batch:   assembler -batch <threads> <input file>... [-manifest <file>]\n");
+    printf("  Run as a daemon:  assembler -serve [<socket>]\n");
+    printf("  Convert to binary: assembler -to-bin <object file> <binary object file>\n");
+    printf("  Convert to text:   assembler -to-text <binary object file> <object file>\n");
+    printf("Pass #1 writes a symbol index next to the intermediate file, which pass #2 loads.\n");
+    printf("A batch writes each output next to its input, with .s replaced by .out. Each line\n");
+    printf("of a manifest names an input file, optionally an intermediate file, and an output\n");
+    printf("file.\n");
+    printf("The daemon assembles for assembler-client over a Unix domain socket, by default\n");
+    printf("$ASSEMBLER_SOCKET or /tmp/assembler-<uid>.sock, and stops on SIGINT or SIGTERM.\n");
+    printf("Use - as the input file name to read from standard input, and with -one-pass\n");
+    printf("as the output file name to write to standard output.\n");
     printf("Append -log <file name> after any option to save log files to a text file.\n");
+    printf("Append -keep-int when running both passes to also write the intermediate file.\n");
+    printf("Append -map <file> when running pass #1 or both passes to write a symbol map:\n");
+    printf("each label's address, its size up to the next label, and its name, by address.\n");
+    printf("Append -bin when running pass #2, both passes or a batch to write a binary\n");
+    printf("object file.\n");
+    printf("Append -sizes when writing a text object file to add a size header to each section.\n");
+    printf("Append -j <jobs> to run pass #1 and pass #2 on that many threads.\n");
+    printf("Append -pipeline when running in one pass to run its stages on separate threads\n");
+    printf("and report on each of them.\n");
+    printf("Append -io uring|pread when running a batch to pick how it reads and writes files\n");
+    printf("(io_uring where available by default).\n");
+    printf("Append -cache <dir> when running both passes or a batch to reuse the output of\n");
+    printf("an earlier run on the same source and options, kept in that directory; the cache\n");
+    printf("is held to -cache-size <MB> (256 by default) by dropping the entries used least\n");
+    printf("recently, and -cache-stats prints its hits and misses at the end.\n");
+    printf("Append -mem-stats when assembling to print how many blocks the assembly\n");
+    printf("allocated, how many calls to malloc that took, and its peak memory.\n");
     exit(0);
 }
 
+/* One file of a batch, named the way main() takes them for a full run. */
+typedef struct {
+    char* in_name;
+    char* tmp_name;         // NULL unless the intermediate file is wanted
+    char* out_name;
+    uint64_t size;          // of the input, for ordering
+    int err;
+} BatchFile;
+
+typedef struct {
+    BatchFile* files;
+    uint32_t len;
+    uint32_t cap;
+    int options;
+    pthread_mutex_t log_lock;   // keeps the messages of each file together
+    BulkIO io;
+    BulkBackend backend;
+    AsmCache* cache;        // NULL unless -cache is given
+} BatchList;
+
+static char* copy_name(const char* name, size_t len) {
+    char* copy = malloc(len + 1);
+    if (!copy) {
+        allocation_failed();
+    }
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* Adds IN_NAME to LIST. If OUT_NAME is NULL, the output file is IN_NAME with
+   ".s" replaced by ".out".
+ */
+static void add_batch_file(BatchList* list, char* in_name, char* tmp_name, char* out_name) {
+    if (list->len == list->cap) {
+        list->cap = list->cap ? 2 * list->cap : 16;
+        list->files = realloc(list->files, list->cap * sizeof(BatchFile));
+        if (!list->files) {
+            allocation_failed();
+        }
+    }
+    if (!out_name) {
+        size_t len = strlen(in_name);
+        if (len > 2 && strcmp(in_name + len - 2, ".s") == 0) {
+            len -= 2;
+        }
+        out_name = malloc(len + 5);
+        if (!out_name) {
+            allocation_failed();
+        }
+        memcpy(out_name, in_name, len);
+        strcpy(out_name + len, ".out");
+    }
+
+    BatchFile* file = &list->files[list->len++];
+    struct stat st;
+    file->in_name = in_name;
+    file->tmp_name = tmp_name;
+    file->out_name = out_name;
+    file->size = stat(in_name, &st) == 0 ? st.st_size : 0;
+    file->err = 0;
+}
+
+/* Adds the files listed in the manifest MANIFEST_NAME to LIST. Each line
+   names an input and an output file, or an input, an intermediate and an
+   output file, separated by whitespace. Blank lines and lines starting with
+   '#' are skipped. Returns 0 on success and -1 on error.
+ */
+static int read_manifest(BatchList* list, const char* manifest_name) {
+    Reader manifest;
+    if (open_reader(&manifest, manifest_name) != 0) {
+        write_to_log("Error: unable to open input file: %s\n", manifest_name);
+        return -1;
+    }
+
+    const char* line;
+    size_t line_len;
+    uint32_t input_line = 0;
+    int ret_code = 0;
+    while (next_line(&manifest, &line, &line_len)) {
+        input_line++;
+        char* fields[4];
+        int num_fields = 0;
+        size_t i = 0;
+        while (i < line_len && num_fields < 4) {
+            while (i < line_len && isspace((unsigned char) line[i])) {
+                i++;
+            }
+            size_t start = i;
+            while (i < line_len && !isspace((unsigned char) line[i])) {
+                i++;
+            }
+            if (i > start) {
+                fields[num_fields++] = copy_name(line + start, i - start);
+            }
+        }
+
+        if (num_fields == 2 && fields[0][0] != '#') {
+            add_batch_file(list, fields[0], NULL, fields[1]);
+        } else if (num_fields == 3 && fields[0][0] != '#') {
+            add_batch_file(list, fields[0], fields[1], fields[2]);
+        } else {
+            if (num_fields != 0 && fields[0][0] != '#') {
+                write_to_log("Error: invalid manifest line %u: %.*s\n", input_line,
+                    (int) line_len, line);
+                ret_code = -1;
+            }
+            for (int f = 0; f < num_fields; f++) {
+                free(fields[f]);
+            }
+        }
+    }
+    close_reader(&manifest);
+    return ret_code;
+}
+
+/* Assembles file number I of the BatchList CTX. Its messages are held back
+   and written out together once it is done.
+ */
+static void assemble_batch_file(void* ctx, uint32_t i) {
+    BatchList* list = ctx;
+    BatchFile* file = &list->files[i];
+
+    Writer log;
+    open_writer_mem(&log);
+    Writer* outer = capture_log(&log);
+    const char* data;
+    size_t size;
+    if (bulk_read(&list->io, i, &data, &size) != 0) {
+        write_to_log("Error: unable to open input file: %s\n", file->in_name);
+        file->err = 1;
+    } else {
+        CacheKey key;
+        int err = -1;
+        if (list->cache) {
+            key = cache_key(data, size, list->options);
+            err = cache_fetch(list->cache, &key, file->out_name, file->tmp_name);
+        }
+        if (err >= 0) {
+            file->err = err != 0;
+            bulk_release(&list->io, i);
+        } else {
+            // the object file is built in memory and written in the background,
+            // while the thread moves on to its next file
+            Writer dst;
+            open_writer_mem(&dst);
+            Arena arena;
+            Arena* outer_arena = begin_session(&arena);
+            // running out of memory fails this file, not the whole batch
+            jmp_buf on_oom;
+            jmp_buf* outer_handler = on_allocation_failure(&on_oom);
+            if (setjmp(on_oom) == 0) {
+                err = assemble_buffer(file->in_name, data, size, file->tmp_name,
+                    file->out_name, &dst, list->options);
+                on_allocation_failure(outer_handler);
+            } else {
+                on_allocation_failure(outer_handler);
+                write_to_log("Error: allocation failed\n");
+                close_writer(&dst);
+                open_writer_mem(&dst);
+                err = -1;
+            }
+            end_session(&arena, outer_arena);
+            file->err = err != 0;
+            bulk_release(&list->io, i);
+            size_t len;
+            char* obj = detach_writer(&dst, &len);
+            if (list->cache && err >= 0) {
+                cache_store(list->cache, &key, obj, len, file->tmp_name, log.buf, log.len, err);
+            }
+            bulk_write(&list->io, i, file->out_name, obj, len);
+        }
+    }
+    capture_log(outer);
+
+    if (log.len > 0) {
+        pthread_mutex_lock(&list->log_lock);
+        write_to_log("%s:\n%.*s", file->in_name, (int) log.len, log.buf);
+        pthread_mutex_unlock(&list->log_lock);
+    }
+    close_writer(&log);
+}
+
+/* Sorts BatchFiles largest first. */
+static int compare_batch_files(const void* a, const void* b) {
+    const BatchFile* x = *(const BatchFile* const*) a;
+    const BatchFile* y = *(const BatchFile* const*) b;
+    return (x->size < y->size) - (x->size > y->size);
+}
+
+/* Assembles every file in LIST on NUM_THREADS threads, largest first.
+   Returns 0 if all of them assembled without errors and 1 otherwise.
+ */
+static int assemble_batch(BatchList* list, uint32_t num_threads) {
+    BatchFile** sorted = malloc((list->len + 1) * sizeof(BatchFile*));
+    uint32_t* order = malloc((list->len + 1) * sizeof(uint32_t));
+    if (!sorted || !order) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < list->len; i++) {
+        sorted[i] = &list->files[i];
+    }
+    qsort(sorted, list->len, sizeof(BatchFile*), compare_batch_files);
+    for (uint32_t i = 0; i < list->len; i++) {
+        order[i] = sorted[i] - list->files;
+    }
+
+    char** in_names = malloc((list->len + 1) * sizeof(char*));
+    if (!in_names) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < list->len; i++) {
+        in_names[i] = list->files[i].in_name;
+    }
+    open_bulk_io(&list->io, in_names, order, list->len, list->backend);
+
+    pthread_mutex_init(&list->log_lock, NULL);
+    run_pool(num_threads, order, list->len, assemble_batch_file, list);
+    pthread_mutex_destroy(&list->log_lock);
+
+    int err = 0;
+    for (uint32_t i = 0; i < list->len; i++) {
+        BatchFile* file = &list->files[i];
+        if (list->io.outputs[i].name && bulk_written(&list->io, i) != 0) {
+            write_to_log("%s:\nError: unable to write output file: %s\n", file->in_name,
+                file->out_name);
+            file->err = 1;
+        }
+        err |= file->err;
+    }
+    close_bulk_io(&list->io);
+    free(in_names);
+    free(sorted);
+    free(order);
+    return err;
+}
+
+/* Runs main() for "-batch <threads> <files...>". */
+static int batch_main(int argc, char** argv) {
+    int num_threads = atoi(argv[2]);
+    if (num_threads < 1) {
+        print_usage_and_exit();
+    }
+
+    BatchList list;
+    memset(&list, 0, sizeof(BatchList));
+    const char* log_name = NULL;
+    const char* manifest_name = NULL;
+    const char* cache_dir = NULL;
+    uint64_t cache_size = CACHE_DEFAULT_SIZE;
+    int cache_stats = 0;
+    AsmCache cache;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+            log_name = argv[++i];
+        } else if (strcmp(argv[i], "-manifest") == 0 && i + 1 < argc && !manifest_name) {
+            manifest_name = argv[++i];
+        } else if (strcmp(argv[i], "-bin") == 0) {
+            list.options |= ASM_BINARY_OBJECT;
+        } else if (strcmp(argv[i], "-sizes") == 0) {
+            list.options |= ASM_SIZE_HEADERS;
+        } else if (strcmp(argv[i], "-io") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "uring") == 0) {
+                list.backend = BULK_URING;
+            } else if (strcmp(argv[i], "pread") == 0) {
+                list.backend = BULK_PREAD;
+            } else {
+                print_usage_and_exit();
+            }
+        } else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "-cache-size") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            cache_size = (uint64_t) atoi(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "-cache-stats") == 0) {
+            cache_stats = 1;
+        } else if (argv[i][0] == '-') {
+            print_usage_and_exit();
+        } else {
+            add_batch_file(&list, copy_name(argv[i], strlen(argv[i])), NULL, NULL);
+        }
+    }
+
+    if (log_name) {
+        set_log_file(log_name);
+    }
+    int err = 0;
+    if (manifest_name && read_manifest(&list, manifest_name) != 0) {
+        err = 1;
+    } else if (list.len == 0) {
+        print_usage_and_exit();
+    } else if (cache_dir && open_cache(&cache, cache_dir, cache_size) != 0) {
+        write_to_log("Error: unable to open cache directory: %s\n", cache_dir);
+        err = 1;
+    } else {
+        list.cache = cache_dir ? &cache : NULL;
+        err = assemble_batch(&list, num_threads);
+        if (list.cache) {
+            close_cache(&cache);
+            if (cache_stats) {
+                print_cache_stats(&cache, stdout);
+            }
+        }
+    }
+
+    if (err) {
+        write_to_log("One or more errors encountered during assembly operation.\n");
+    } else {
+        write_to_log("Assembly operation completed successfully.\n");
+    }
+    if (is_log_file_set()) {
+        printf("Results saved to %s\n", log_name);
+    }
+
+    for (uint32_t i = 0; i < list.len; i++) {
+        free(list.files[i].in_name);
+        free(list.files[i].tmp_name);
+        free(list.files[i].out_name);
+    }
+    free(list.files);
+    return err;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 4 && argc != 6) {
+    if (argc >= 3 && strcmp(argv[1], "-batch") == 0) {
+        return batch_main(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "-serve") == 0) {
+        const char* socket_path = argc >= 3 ? argv[2] : daemon_socket_path();
+        printf("Serving on %s\n", socket_path);
+        fflush(stdout);
+        return serve_daemon(socket_path) != 0;
+    }
+    if (argc < 4) {
         print_usage_and_exit();
     }
 
@@ -318,6 +776,60 @@ int main(int argc, char **argv) {
         mode = 1;
     } else if (strcmp(argv[1], "-p2") == 0) {
         mode = 2;
+    } else if (strcmp(argv[1], "-to-bin") == 0) {
+        mode = 3;
+    } else if (strcmp(argv[1], "-to-text") == 0) {
+        mode = 4;
+    } else if (strcmp(argv[1], "-one-pass") == 0) {
+        mode = 5;
+    }
+
+    const char* log_name = NULL;
+    const char* cache_dir = NULL;
+    uint64_t cache_size = CACHE_DEFAULT_SIZE;
+    int cache_stats = 0;
+    int keep_int = 0;
+    int options = 0;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+            log_name = argv[++i];
+        } else if (strcmp(argv[i], "-keep-int") == 0 && mode == 0) {
+            keep_int = 1;
+        } else if (strcmp(argv[i], "-bin") == 0 && (mode == 0 || mode == 2)) {
+            options |= ASM_BINARY_OBJECT;
+        } else if (strcmp(argv[i], "-sizes") == 0 && (mode == 0 || mode == 2 || mode == 4)) {
+            options |= ASM_SIZE_HEADERS;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && mode <= 2
+            && atoi(argv[i + 1]) > 0) {
+            set_num_jobs(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-pipeline") == 0 && mode == 5) {
+            options |= ASM_PIPELINE;
+        } else if (strcmp(argv[i], "-map") == 0 && i + 1 < argc && mode <= 1) {
+            map_name = argv[++i];
+        } else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc && mode == 0) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "-cache-size") == 0 && i + 1 < argc && mode == 0
+            && atoi(argv[i + 1]) > 0) {
+            cache_size = (uint64_t) atoi(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "-cache-stats") == 0 && mode == 0) {
+            cache_stats = 1;
+        } else if (strcmp(argv[i], "-mem-stats") == 0 && mode != 3 && mode != 4) {
+            mem_stats = 1;
+        } else {
+            print_usage_and_exit();
+        }
+    }
+
+    // a cached run skips pass one, which the map comes from
+    if (map_name && cache_dir) {
+        print_usage_and_exit();
+    }
+
+    if (mode == 3 || mode == 4) {
+        if (log_name) {
+            set_log_file(log_name);
+        }
+        return convert_object(argv[2], argv[3], mode == 3, options & ASM_SIZE_HEADERS) != 0;
     }
 
     char *input, *inter, *output;
@@ -325,25 +837,43 @@ int main(int argc, char **argv) {
         input = argv[2];
         inter = argv[3];
         output = NULL;
+    } else if (mode == 5) {
+        input = argv[2];
+        inter = NULL;
+        output = argv[3];
+        options |= ASM_ONE_PASS;
     } else if (mode == 2) {
         input = NULL;
         inter = argv[2];
         output = argv[3];
     } else {
         input = argv[1];
-        inter = argv[2];
+        inter = keep_int ? argv[2] : NULL;
         output = argv[3];
     }
 
-    if (argc == 6) {
-        if (strcmp(argv[4], "-log") == 0) {
-            set_log_file(argv[5]);
-        } else {
-            print_usage_and_exit();
-        }
+    if (log_name) {
+        set_log_file(log_name);
     }
 
-    int err = assemble(input, inter, output);
+    int err;
+    if (cache_dir) {
+        AsmCache cache;
+        if (open_cache(&cache, cache_dir, cache_size) != 0) {
+            write_to_log("Error: unable to open cache directory: %s\n", cache_dir);
+            exit(1);
+        }
+        err = assemble_cached(&cache, input, inter, output, options);
+        close_cache(&cache);
+        if (cache_stats) {
+            print_cache_stats(&cache, stdout);
+        }
+        if (err < 0) {
+            exit(1);
+        }
+    } else {
+        err = assemble(input, inter, output, options);
+    }
 
     if (err) {
         write_to_log("One or more errors encountered during assembly operation.\n");
@@ -352,7 +882,7 @@ int main(int argc, char **argv) {
     }
 
     if (is_log_file_set()) {
-        printf("Results saved to %s\n", argv[5]);
+        printf("Results saved to %s\n", log_name);
     }
 
     return err;
@@ -1,10 +1,59 @@
 #ifndef ASSEMBLER_H
 #define ASSEMBLER_H
 
-int assemble(const char* in_name, const char* tmp_name, const char* out_name);
+#include <stdint.h>
 
-int pass_one(FILE *input, FILE* output, SymbolTable* symtbl);
+#include "src/tables.h"
+#include "src/reader.h"
+#include "src/writer.h"
+#include "src/ir.h"
 
-int pass_two(FILE *input, FILE* output, SymbolTable* symtbl, SymbolTable* reltbl);
+typedef enum {
+    ASM_BINARY_OBJECT = 1,  // write the object file in the binary format
+    ASM_ONE_PASS = 2,       // assemble in a single pass, see pass_stream()
+    ASM_SIZE_HEADERS = 4,   // add size headers to the sections of a text object file
+    ASM_PIPELINE = 8        // with ASM_ONE_PASS, use pass_pipeline() and report on it
+} AsmOption;
+
+#define PIPELINE_STAGES 4
+
+/* How one stage of pass_pipeline() did. */
+typedef struct {
+    const char* name;
+    uint64_t items;         // lines read or parsed, or instructions encoded or formatted
+    double busy;            // seconds spent working
+    double wait;            // seconds spent waiting on the stage before or after
+} StageStats;
+
+/* Sets the number of threads pass one and pass two may use when called from
+   the calling thread. The default is 1.
+ */
+void set_num_jobs(int jobs);
+
+int assemble(const char* in_name, const char* tmp_name, const char* out_name, int options);
+
+int pass_one(Reader* input, Program* output, SymbolTable* symtbl);
+
+int pass_two(const Program* input, Writer* output, SymbolTable* symtbl, SymbolTable* reltbl);
+
+int pass_stream(Reader* input, Writer* output, SymbolTable* symtbl, SymbolTable* reltbl);
+
+int pass_pipeline(Reader* input, Writer* output, SymbolTable* symtbl, SymbolTable* reltbl,
+    StageStats* stats);
+
+int encode_program(const Program* input, uint32_t* words, uint32_t* num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl);
+
+/* Reads a text intermediate file, as written by write_program_text(), back
+   into OUTPUT.
+ */
+void read_intermediate(Reader* input, Program* output);
+
+/* Returns an upper bound on the size of the object file for PROG. */
+size_t estimate_object_size(const Program* prog, const SymbolTable* symtbl);
+
+/* Runs pass two over PROG and writes the complete object file to DST. */
+int write_object(const Program* prog, Writer* dst, SymbolTable* symtbl, SymbolTable* reltbl,
+    int options);
 
 #endif
@@ -0,0 +1,136 @@
+/* A drop-in for the assembler command line. Full runs and one-pass runs are
+   handed to the assembler daemon (see daemon.h), which is already warm;
+   anything else, or anything at all when no daemon is running, is handed to
+   the assembler binary instead. Either way, the files, messages and exit
+   status are the same.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "src/utils.h"
+#include "src/reader.h"
+#include "src/writer.h"
+#include "assembler.h"
+#include "daemon.h"
+
+/* Runs the assembler binary with ARGV in place of this process. It is
+   $ASSEMBLER if set, or the assembler next to this binary.
+ */
+static void run_locally(char** argv) {
+    char path[4096];
+    const char* env = getenv("ASSEMBLER");
+    if (env && *env) {
+        snprintf(path, sizeof(path), "%s", env);
+    } else {
+        char self[4096];
+        snprintf(self, sizeof(self), "%s", argv[0]);
+        snprintf(path, sizeof(path), "%s/assembler", dirname(self));
+    }
+    argv[0] = path;
+    execv(path, argv);
+    write_to_log("Error: unable to run %s\n", path);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4 || (argv[1][0] == '-' && strcmp(argv[1], "-one-pass") != 0)) {
+        run_locally(argv);
+    }
+    int one_pass = argv[1][0] == '-';
+    const char* in_name = one_pass ? argv[2] : argv[1];
+    const char* out_name = argv[3];
+
+    const char* log_name = NULL;
+    int options = one_pass ? ASM_ONE_PASS : 0;
+    int jobs = 1;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+            log_name = argv[++i];
+        } else if (strcmp(argv[i], "-bin") == 0 && !one_pass) {
+            options |= ASM_BINARY_OBJECT;
+        } else if (strcmp(argv[i], "-sizes") == 0 && !one_pass) {
+            options |= ASM_SIZE_HEADERS;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && !one_pass
+            && atoi(argv[i + 1]) > 0) {
+            jobs = atoi(argv[++i]);
+        } else {
+            // -keep-int and -pipeline need the files or the stages themselves
+            run_locally(argv);
+        }
+    }
+    // standard input may be a stream that one pass is meant to follow
+    if (strcmp(in_name, "-") == 0) {
+        run_locally(argv);
+    }
+
+    int fd = connect_daemon(daemon_socket_path());
+    if (fd < 0) {
+        run_locally(argv);
+    }
+    if (log_name) {
+        set_log_file(log_name);
+    }
+
+    Reader src;
+    if (open_reader(&src, in_name) != 0) {
+        if (!one_pass) {
+            printf("Running pass one: %s -> (memory)\n", in_name);
+        }
+        write_to_log("Error: unable to open input file: %s\n", in_name);
+        return 1;
+    }
+    char *out, *log;
+    size_t out_len, log_len;
+    int err = request_assembly(fd, src.data, src.size, options, jobs, &out, &out_len, &log,
+        &log_len);
+    close_reader(&src);
+    close(fd);
+    if (err == -2) {
+        // the daemon went away; nothing has been written yet
+        run_locally(argv);
+    }
+
+    if (one_pass) {
+        if (strcmp(out_name, "-") != 0) {
+            printf("Running one pass: %s -> %s\n", in_name, out_name);
+        }
+    } else {
+        printf("Running pass one: %s -> (memory)\n", in_name);
+        printf("Running pass two: (memory) -> %s\n", out_name);
+    }
+    fflush(stdout);
+
+    Writer dst;
+    if (open_writer(&dst, out_name, out_len) != 0) {
+        write_to_log("%s", log);
+        write_to_log("Error: unable to open output file: %s\n", out_name);
+        return 1;
+    }
+    put_bytes(&dst, out, out_len);
+    if (log_len > 0) {
+        write_to_log("%s", log);
+    }
+    if (close_writer(&dst) != 0) {
+        write_to_log("Error: unable to write output file: %s\n", out_name);
+        err = err < 0 ? err : 1;
+    }
+    free(out);
+    free(log);
+    if (err < 0) {
+        // memory ran out in the daemon, which the assembler dies of
+        return 1;
+    }
+
+    if (err) {
+        write_to_log("One or more errors encountered during assembly operation.\n");
+    } else {
+        write_to_log("Assembly operation completed successfully.\n");
+    }
+    if (is_log_file_set()) {
+        printf("Results saved to %s\n", log_name);
+    }
+    return err;
+}
@@ -0,0 +1,102 @@
+/* Measures symbolizing addresses with an AddrIndex: a table of functions of
+   uneven sizes, and random PCs inside them, looked up by interpolation and
+   by binary search. Every lookup is checked against the function the PC
+   was drawn from.
+
+   Usage: bench-addr [symbols] [lookups]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/utils.h"
+#include "../src/tables.h"
+
+#define DEFAULT_SYMBOLS 1000000
+#define DEFAULT_LOOKUPS 10000000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Prints the time and rate of N operations, and how the rate compares to
+   BASELINE, in operations per second. Returns the rate.
+ */
+static double report(const char* name, double seconds, size_t n, double baseline) {
+    double rate = n / seconds;
+    printf("%-22s %8.3f s  %8.2f Mops/s  %8.1fx\n", name, seconds, rate / 1e6,
+        baseline > 0 ? rate / baseline : 1);
+    return rate;
+}
+
+/* A small random number generator, so that runs are repeatable. */
+static uint32_t next_random(uint64_t* state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t) (*state >> 33);
+}
+
+int main(int argc, char** argv) {
+    uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_SYMBOLS;
+    uint32_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_LOOKUPS;
+    if (n == 0 || n > 100000000) {
+        fprintf(stderr, "need between 1 and 100000000 symbols\n");
+        return 1;
+    }
+    printf("%u symbols, %u lookups\n", n, lookups);
+
+    // mostly small functions with the odd large one, as in real programs
+    uint64_t state = 1;
+    SymbolTable* table = create_table_sized(SYMTBL_UNIQUE_NAME, n);
+    char name[32];
+    uint32_t addr = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sprintf(name, "func_%u", i);
+        add_to_table(table, name, addr);
+        uint32_t words = next_random(&state) % 100 == 0 ? 1000 : next_random(&state) % 40 + 1;
+        addr += 4 * words;
+    }
+    uint32_t end = addr;
+
+    double start = now();
+    AddrIndex index;
+    build_addr_index(&index, table);
+    report("build", now() - start, n, 0);
+
+    uint32_t* pcs = malloc((lookups + 1) * sizeof(uint32_t));
+    uint32_t* expected = malloc((lookups + 1) * sizeof(uint32_t));
+    if (!pcs || !expected) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < lookups; i++) {
+        uint32_t symbol = next_random(&state) % n;
+        uint32_t from = table->tbl[symbol].addr;
+        uint32_t to = symbol + 1 < n ? table->tbl[symbol + 1].addr : end;
+        pcs[i] = from + next_random(&state) % (to - from);
+        expected[i] = symbol;
+    }
+
+    uint32_t wrong = 0;
+    start = now();
+    for (uint32_t i = 0; i < lookups; i++) {
+        wrong += find_symbol_at_binary(&index, pcs[i]) != expected[i];
+    }
+    double binary_rate = report("lookup, binary", now() - start, lookups, 0);
+    start = now();
+    for (uint32_t i = 0; i < lookups; i++) {
+        wrong += find_symbol_at(&index, pcs[i]) != expected[i];
+    }
+    report("lookup, interpolation", now() - start, lookups, binary_rate);
+
+    if (wrong != 0) {
+        printf("%u lookups wrong\n", wrong);
+        return 1;
+    }
+    free(pcs);
+    free(expected);
+    free_addr_index(&index);
+    free_table(table);
+    return 0;
+}
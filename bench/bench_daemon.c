@@ -0,0 +1,149 @@
+/* Compares the latency of assembling a small file by starting the assembler
+   cold against asking a warm daemon: through assembler-client, as an editor
+   or test runner would, and straight over the socket, which is the daemon's
+   own share.
+
+   Run from the directory holding assembler and assembler-client.
+
+   Usage: bench-daemon [runs] [input file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/reader.h"
+#include "../daemon.h"
+
+#define DEFAULT_RUNS 200
+#define DEFAULT_INPUT "input/combined.s"
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char* name, double* times, int n, double baseline) {
+    qsort(times, n, sizeof(double), compare_doubles);
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += times[i];
+    }
+    double mean = total / n;
+    printf("%-22s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  %6.1fx\n", name, mean * 1e6,
+        times[n / 2] * 1e6, times[n * 99 / 100] * 1e6, baseline > 0 ? baseline / mean : 1);
+}
+
+/* Starts ARGV with its output thrown away. Returns its pid. */
+static pid_t spawn(char* const* argv) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+/* Runs ARGV to the end and returns the seconds it took, or -1 if it failed
+   to run.
+ */
+static double time_run(char* const* argv) {
+    double start = now();
+    int status;
+    if (waitpid(spawn(argv), &status, 0) < 0 || !WIFEXITED(status)
+        || WEXITSTATUS(status) == 127) {
+        return -1;
+    }
+    return now() - start;
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+    char* in_name = argc > 2 ? argv[2] : DEFAULT_INPUT;
+    if (runs < 1) {
+        fprintf(stderr, "need at least one run\n");
+        return 1;
+    }
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/bench-daemon-%d.sock", (int) getpid());
+    setenv("ASSEMBLER_SOCKET", socket_path, 1);
+    char out_name[] = "/tmp/bench-daemon.out";
+    double* times = malloc(runs * sizeof(double));
+    printf("%d runs of %s\n", runs, in_name);
+
+    char* cold[] = { "./assembler", in_name, "unused.int", out_name, NULL };
+    for (int i = 0; i < runs; i++) {
+        if ((times[i] = time_run(cold)) < 0) {
+            fprintf(stderr, "could not run ./assembler\n");
+            return 1;
+        }
+    }
+    report("cold process", times, runs, 0);
+    double baseline = 0;
+    for (int i = 0; i < runs; i++) {
+        baseline += times[i] / runs;
+    }
+
+    char* serve[] = { "./assembler", "-serve", socket_path, NULL };
+    pid_t daemon = spawn(serve);
+    int fd = -1;
+    for (int tries = 0; tries < 500 && fd < 0; tries++) {
+        usleep(10000);
+        fd = connect_daemon(socket_path);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "the daemon did not start\n");
+        kill(daemon, SIGTERM);
+        return 1;
+    }
+    close(fd);
+
+    char* client[] = { "./assembler-client", in_name, "unused.int", out_name, NULL };
+    for (int i = 0; i < runs; i++) {
+        times[i] = time_run(client);
+    }
+    report("warm, client process", times, runs, baseline);
+
+    Reader src;
+    if (open_reader(&src, in_name) != 0) {
+        fprintf(stderr, "could not read %s\n", in_name);
+        return 1;
+    }
+    for (int i = 0; i < runs; i++) {
+        double start = now();
+        char *out, *log;
+        size_t out_len, log_len;
+        fd = connect_daemon(socket_path);
+        if (fd < 0 || request_assembly(fd, src.data, src.size, 0, 1, &out, &out_len, &log,
+            &log_len) < -1) {
+            fprintf(stderr, "the daemon went away\n");
+            return 1;
+        }
+        close(fd);
+        free(out);
+        free(log);
+        times[i] = now() - start;
+    }
+    report("warm, socket only", times, runs, baseline);
+
+    close_reader(&src);
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+    unlink(out_name);
+    free(times);
+    return 0;
+}
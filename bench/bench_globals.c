@@ -0,0 +1,154 @@
+/* Compares gathering global labels from many threads into a GlobalTable
+   against a SymbolTable behind a mutex, which is what add_to_table() would
+   need. Each thread adds its share of the symbols and then looks all of
+   them up.
+
+   Usage: bench-globals [threads] [symbols]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../src/utils.h"
+#include "../src/tables.h"
+#include "../src/globals.h"
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_SYMBOLS 4000000
+
+typedef struct {
+    int thread;
+    int num_threads;
+    uint32_t num_symbols;
+    GlobalTable* global;
+    SymbolTable* locked;
+    pthread_mutex_t* lock;
+    uint32_t found;
+} Job;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Prints the time and rate of N operations, and how the rate compares to
+   BASELINE, in operations per second. Returns the rate.
+ */
+static double report(const char* name, double seconds, size_t n, double baseline) {
+    double rate = n / seconds;
+    printf("%-22s %8.3f s  %8.2f Mops/s  %8.1fx\n", name, seconds, rate / 1e6,
+        baseline > 0 ? rate / baseline : 1);
+    return rate;
+}
+
+static void* add_global_symbols(void* arg) {
+    Job* job = arg;
+    char name[32];
+    for (uint32_t i = job->thread; i < job->num_symbols; i += job->num_threads) {
+        add_global(job->global, name, sprintf(name, "label_%u", i), i * 4);
+    }
+    return NULL;
+}
+
+static void* get_global_symbols(void* arg) {
+    Job* job = arg;
+    char name[32];
+    for (uint32_t i = 0; i < job->num_symbols; i++) {
+        job->found += get_global(job->global, name, sprintf(name, "label_%u", i)) >= 0;
+    }
+    return NULL;
+}
+
+static void* add_locked_symbols(void* arg) {
+    Job* job = arg;
+    char name[32];
+    for (uint32_t i = job->thread; i < job->num_symbols; i += job->num_threads) {
+        sprintf(name, "label_%u", i);
+        pthread_mutex_lock(job->lock);
+        add_to_table(job->locked, name, i * 4);
+        pthread_mutex_unlock(job->lock);
+    }
+    return NULL;
+}
+
+static void* get_locked_symbols(void* arg) {
+    Job* job = arg;
+    char name[32];
+    for (uint32_t i = 0; i < job->num_symbols; i++) {
+        sprintf(name, "label_%u", i);
+        pthread_mutex_lock(job->lock);
+        job->found += get_addr_for_symbol(job->locked, name) >= 0;
+        pthread_mutex_unlock(job->lock);
+    }
+    return NULL;
+}
+
+/* Runs FN on NUM_THREADS threads and returns the seconds it took. */
+static double run(void* (*fn)(void*), Job* jobs, int num_threads) {
+    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+    double start = now();
+    for (int t = 0; t < num_threads; t++) {
+        pthread_create(&threads[t], NULL, fn, &jobs[t]);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    return now() - start;
+}
+
+int main(int argc, char** argv) {
+    int num_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    uint32_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_SYMBOLS;
+    if (num_threads < 1) {
+        fprintf(stderr, "need at least one thread\n");
+        return 1;
+    }
+    printf("%d threads, %u symbols\n", num_threads, n);
+
+    GlobalTable global;
+    init_global_table(&global, n);
+    SymbolTable* locked = create_table(SYMTBL_UNIQUE_NAME);
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, NULL);
+    Job* jobs = calloc(num_threads, sizeof(Job));
+    for (int t = 0; t < num_threads; t++) {
+        jobs[t].thread = t;
+        jobs[t].num_threads = num_threads;
+        jobs[t].global = &global;
+        jobs[t].locked = locked;
+        jobs[t].lock = &lock;
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        jobs[t].num_symbols = n;
+    }
+    double add_rate = report("add, mutex", run(add_locked_symbols, jobs, num_threads), n, 0);
+    double get_rate = report("lookup, mutex", run(get_locked_symbols, jobs, num_threads),
+        (size_t) n * num_threads, 0);
+
+    for (int t = 0; t < num_threads; t++) {
+        jobs[t].found = 0;
+    }
+    report("add, lock-free", run(add_global_symbols, jobs, num_threads), n, add_rate);
+    report("lookup, wait-free", run(get_global_symbols, jobs, num_threads),
+        (size_t) n * num_threads, get_rate);
+
+    uint64_t found = 0;
+    for (int t = 0; t < num_threads; t++) {
+        found += jobs[t].found;
+    }
+    if (global.len != n || found != (uint64_t) n * num_threads) {
+        printf("lost symbols: %u added, %llu found\n", global.len, (unsigned long long) found);
+        return 1;
+    }
+
+    free(jobs);
+    pthread_mutex_destroy(&lock);
+    free_table(locked);
+    free_global_table(&global);
+    return 0;
+}
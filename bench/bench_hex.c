@@ -0,0 +1,85 @@
+/* Compares the ways of writing the .text section: fprintf("%08x\n") per
+   word, write_inst_hex() per word, and write_inst_hex_batch() at every
+   vector level the CPU supports.
+
+   Usage: bench-hex [number of words]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/translate_utils.h"
+#include "../src/writer.h"
+
+#define DEFAULT_WORDS 10000000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, double seconds, size_t n, double baseline) {
+    printf("%-22s %8.3f s  %7.1f Mwords/s  %6.2fx\n", name, seconds, n / seconds / 1e6,
+        baseline / seconds);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_WORDS;
+    uint32_t* words = malloc(n * sizeof(uint32_t));
+    char* buf = malloc(n * HEX_LINE_SIZE);
+    char* expected = malloc(n * HEX_LINE_SIZE);
+    if (!words || !buf || !expected) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    uint32_t x = 1;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        words[i] = x;
+    }
+    FILE* null = fopen("/dev/null", "w");
+    if (!null) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    double start = now();
+    for (size_t i = 0; i < n; i++) {
+        fprintf(null, "%08x\n", words[i]);
+    }
+    fflush(null);
+    double baseline = now() - start;
+    report("fprintf", baseline, n, baseline);
+
+    Writer writer;
+    open_writer_mem(&writer);
+    start = now();
+    for (size_t i = 0; i < n; i++) {
+        write_inst_hex(&writer, words[i]);
+    }
+    report("write_inst_hex", now() - start, n, baseline);
+    memcpy(expected, writer.buf, n * HEX_LINE_SIZE);
+    close_writer(&writer);
+
+    static const char* LEVELS[] = { "batch scalar", "batch ssse3", "batch avx2" };
+    for (int level = HEX_SCALAR; level <= HEX_AVX2; level++) {
+        if (set_hex_level(level) != 0) {
+            continue;
+        }
+        start = now();
+        write_inst_hex_batch(buf, words, n);
+        report(LEVELS[level], now() - start, n, baseline);
+        if (memcmp(buf, expected, n * HEX_LINE_SIZE) != 0) {
+            printf("%s: output differs from write_inst_hex\n", LEVELS[level]);
+            return 1;
+        }
+    }
+
+    fclose(null);
+    free(words);
+    free(buf);
+    free(expected);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/* Compares the hash-indexed SymbolTable against the linear scan it replaced,
+   which is kept here as LinearTable. Labels are added with the uniqueness
+   check of SYMTBL_UNIQUE_NAME, then looked up in a random order the way
+   write_branch() looks up branch targets.
+
+   The linear scan is quadratic, so it only gets the first few thousand
+   labels and lookups; rates are per operation, so they compare even so.
+
+   Usage: bench-symtbl [labels] [lookups] [labels for the linear scan]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/utils.h"
+#include "../src/tables.h"
+
+#define DEFAULT_LABELS 1000000
+#define DEFAULT_LOOKUPS 10000000
+#define DEFAULT_LINEAR_LABELS 20000
+
+/* The SymbolTable as it was before it had an index. */
+typedef struct {
+    char* name;
+    uint32_t addr;
+} LinearSymbol;
+
+typedef struct {
+    LinearSymbol* tbl;
+    uint32_t len;
+    uint32_t cap;
+} LinearTable;
+
+static int linear_add(LinearTable* table, const char* name, uint32_t addr) {
+    for (uint32_t i = 0; i < table->len; i++) {
+        if (strcmp(table->tbl[i].name, name) == 0) {
+            return -1;
+        }
+    }
+    if (table->len == table->cap) {
+        table->cap = table->cap ? 2 * table->cap : 5;
+        table->tbl = realloc(table->tbl, table->cap * sizeof(LinearSymbol));
+        if (!table->tbl) {
+            allocation_failed();
+        }
+    }
+    table->tbl[table->len].name = strdup(name);
+    table->tbl[table->len].addr = addr;
+    table->len++;
+    return 0;
+}
+
+static int64_t linear_get(const LinearTable* table, const char* name) {
+    for (uint32_t i = 0; i < table->len; i++) {
+        if (strcmp(table->tbl[i].name, name) == 0) {
+            return table->tbl[i].addr;
+        }
+    }
+    return -1;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Prints the time and rate of N operations, and how the rate compares to
+   BASELINE, in operations per second. Returns the rate.
+ */
+static double report(const char* name, double seconds, size_t n, double baseline) {
+    double rate = n / seconds;
+    printf("%-22s %8.3f s  %8.2f Mops/s  %10.1fx\n", name, seconds, rate / 1e6,
+        baseline > 0 ? rate / baseline : 1);
+    return rate;
+}
+
+/* Returns a label number below N for lookup number I, in no useful order. */
+static uint32_t target(uint64_t i, uint32_t n) {
+    return (uint32_t) ((i * 2654435761u + 12345) % n);
+}
+
+int main(int argc, char** argv) {
+    uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_LABELS;
+    uint64_t lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_LOOKUPS;
+    uint32_t linear_n = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_LINEAR_LABELS;
+    if (n == 0 || linear_n == 0) {
+        fprintf(stderr, "need at least one label\n");
+        return 1;
+    }
+    printf("%u labels, %llu lookups (%u of each for the linear scan)\n", n,
+        (unsigned long long) lookups, linear_n);
+    char name[32];
+
+    LinearTable linear = { NULL, 0, 0 };
+    double start = now();
+    for (uint32_t i = 0; i < linear_n; i++) {
+        sprintf(name, "label_%u", i);
+        linear_add(&linear, name, i * 4);
+    }
+    double add_rate = report("add, linear", now() - start, linear_n, 0);
+    uint64_t wrong = 0;
+    start = now();
+    for (uint32_t i = 0; i < linear_n; i++) {
+        uint32_t t = target(i, linear_n);
+        sprintf(name, "label_%u", t);
+        wrong += linear_get(&linear, name) != (int64_t) t * 4;
+    }
+    double get_rate = report("lookup, linear", now() - start, linear_n, 0);
+
+    SymbolTable* table = create_table(SYMTBL_UNIQUE_NAME);
+    start = now();
+    for (uint32_t i = 0; i < n; i++) {
+        sprintf(name, "label_%u", i);
+        add_to_table(table, name, i * 4);
+    }
+    report("add, hashed", now() - start, n, add_rate);
+    start = now();
+    for (uint64_t i = 0; i < lookups; i++) {
+        uint32_t t = target(i, n);
+        sprintf(name, "label_%u", t);
+        wrong += get_addr_for_symbol(table, name) != (int64_t) t * 4;
+    }
+    report("lookup, hashed", now() - start, lookups, get_rate);
+
+    if (table->len != n || wrong != 0) {
+        printf("lost labels: %u added, %llu lookups wrong\n", table->len,
+            (unsigned long long) wrong);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < linear.len; i++) {
+        free(linear.tbl[i].name);
+    }
+    free(linear.tbl);
+    free_table(table);
+    return 0;
+}
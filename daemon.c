@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "src/utils.h"
+#include "libassembler.h"
+#include "daemon.h"
+
+/* Most threads a request may ask for. */
+#define MAX_REQUEST_JOBS 64
+
+/* A warm context, and the buffer requests are read into, kept between
+   connections.
+ */
+typedef struct Worker {
+    AsmContext* ctx;
+    char* buf;
+    size_t cap;
+    struct Worker* next;
+} Worker;
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static Worker* idle_workers = NULL;
+
+static volatile sig_atomic_t stopping = 0;
+
+const char* daemon_socket_path() {
+    static char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    const char* env = getenv("ASSEMBLER_SOCKET");
+    if (env && *env) {
+        return env;
+    }
+    snprintf(path, sizeof(path), "/tmp/assembler-%u.sock", (unsigned) getuid());
+    return path;
+}
+
+/* Reads exactly LEN bytes from FD into BUF. Returns -1 on error or at the
+   end of the input.
+ */
+static int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Writes all of the NUM buffers in IOV to FD. Returns -1 on error. */
+static int write_full(int fd, struct iovec* iov, int num) {
+    while (num > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = num;
+        // a client that went away must not kill the daemon with SIGPIPE
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        while (num > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            num--;
+        }
+        if (num > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static Worker* take_worker() {
+    pthread_mutex_lock(&idle_lock);
+    Worker* worker = idle_workers;
+    if (worker) {
+        idle_workers = worker->next;
+    }
+    pthread_mutex_unlock(&idle_lock);
+    if (worker) {
+        return worker;
+    }
+
+    worker = calloc(1, sizeof(Worker));
+    if (!worker || !(worker->ctx = create_context(0))) {
+        free(worker);
+        return NULL;
+    }
+    return worker;
+}
+
+static void put_back_worker(Worker* worker) {
+    pthread_mutex_lock(&idle_lock);
+    worker->next = idle_workers;
+    idle_workers = worker;
+    pthread_mutex_unlock(&idle_lock);
+}
+
+/* Answers the requests on one connection until the client closes it. */
+static void* serve_connection(void* arg) {
+    int fd = (int) (intptr_t) arg;
+    Worker* worker = take_worker();
+    DaemonRequest req;
+    while (worker && read_full(fd, &req, sizeof(req)) == 0) {
+        if (req.magic != DAEMON_MAGIC || req.size > DAEMON_MAX_SOURCE) {
+            break;
+        }
+        if (req.size > worker->cap) {
+            char* buf = realloc(worker->buf, req.size);
+            if (!buf) {
+                break;
+            }
+            worker->buf = buf;
+            worker->cap = req.size;
+        }
+        if (read_full(fd, worker->buf, req.size) != 0) {
+            break;
+        }
+
+        AsmContext* ctx = worker->ctx;
+        ctx->options = req.options & ~ASM_PIPELINE;
+        ctx->jobs = req.jobs < 1 ? 1 : req.jobs > MAX_REQUEST_JOBS ? MAX_REQUEST_JOBS : req.jobs;
+        char* out;
+        size_t out_len, log_len;
+        DaemonResponse resp;
+        resp.magic = DAEMON_MAGIC;
+        resp.status = assemble_mem(ctx, worker->buf, req.size, &out, &out_len);
+        const char* log = context_messages(ctx, &log_len);
+        resp.out_size = out_len;
+        resp.log_size = log_len;
+
+        struct iovec iov[3] = {
+            { &resp, sizeof(resp) },
+            { out, out_len },
+            { (char*) log, log_len }
+        };
+        int err = write_full(fd, iov, 3);
+        free(out);
+        if (err != 0) {
+            break;
+        }
+    }
+    if (worker) {
+        put_back_worker(worker);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void stop_serving(int sig) {
+    stopping = 1;
+}
+
+int serve_daemon(const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        write_to_log("Error: socket path is too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // a socket file left behind by a daemon that died is reused, but not one
+    // that is still being served
+    int fd = connect_daemon(socket_path);
+    if (fd >= 0) {
+        close(fd);
+        write_to_log("Error: a daemon is already listening on %s\n", socket_path);
+        return -1;
+    }
+    unlink(socket_path);
+
+    // the socket is created private rather than made private after bind(), so
+    // that no other user can connect in between
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    mode_t outer_umask = umask(077);
+    int err = fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0;
+    umask(outer_umask);
+    if (err || listen(fd, SOMAXCONN) != 0) {
+        write_to_log("Error: unable to listen on %s\n", socket_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // SIGINT and SIGTERM stay blocked except while waiting in ppoll(), so they
+    // cannot slip in between checking STOPPING and waiting, and the connection
+    // threads, which inherit the mask, never take them
+    sigset_t stop_signals, outer_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &outer_mask);
+    sigset_t wait_mask = outer_mask;
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_serving;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    struct pollfd listener = { fd, POLLIN, 0 };
+    while (!stopping) {
+        if (ppoll(&listener, 1, NULL, &wait_mask) <= 0) {
+            continue;
+        }
+        // the listening socket does not block, in case the client is gone
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, serve_connection, (void*) (intptr_t) client) != 0) {
+            close(client);
+        }
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &outer_mask, NULL);
+    close(fd);
+    unlink(socket_path);
+    return 0;
+}
+
+int connect_daemon(const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int request_assembly(int fd, const char* data, size_t size, int options, int jobs,
+    char** out, size_t* out_len, char** log, size_t* log_len) {
+    if (size > DAEMON_MAX_SOURCE) {
+        return -2;
+    }
+    DaemonRequest req = { DAEMON_MAGIC, options, jobs, size };
+    struct iovec iov[2] = {
+        { &req, sizeof(req) },
+        { (char*) data, size }
+    };
+    DaemonResponse resp;
+    if (write_full(fd, iov, 2) != 0 || read_full(fd, &resp, sizeof(resp)) != 0
+        || resp.magic != DAEMON_MAGIC) {
+        return -2;
+    }
+
+    *out = malloc((size_t) resp.out_size + 1);
+    *log = malloc((size_t) resp.log_size + 1);
+    if (!*out || !*log) {
+        allocation_failed();
+    }
+    if (read_full(fd, *out, resp.out_size) != 0 || read_full(fd, *log, resp.log_size) != 0) {
+        free(*out);
+        free(*log);
+        return -2;
+    }
+    (*log)[resp.log_size] = '\0';
+    *out_len = resp.out_size;
+    *log_len = resp.log_size;
+    return resp.status;
+}
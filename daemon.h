@@ -0,0 +1,61 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The assembler daemon keeps warm AsmContexts around and assembles source
+   buffers sent to it over a Unix domain socket, so that callers that start
+   many small assemblies skip process start-up and cold allocations.
+
+   A connection carries any number of requests, one after the other. Each is
+   a DaemonRequest followed by SIZE bytes of source, and is answered by a
+   DaemonResponse followed by OUT_SIZE bytes of object file and LOG_SIZE bytes
+   of messages. All fields are in host byte order, as both ends are on the
+   same machine.
+ */
+#define DAEMON_MAGIC 0x4d53414d   // "MASM"
+
+/* Largest source the daemon accepts. */
+#define DAEMON_MAX_SOURCE (1U << 30)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t options;       // AsmOption flags
+    uint32_t jobs;
+    uint32_t size;
+} DaemonRequest;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;         // what assemble_mem() returned
+    uint32_t out_size;
+    uint32_t log_size;
+} DaemonResponse;
+
+/* Returns the socket path from $ASSEMBLER_SOCKET, or a default one for the
+   current user. The result is in static storage.
+ */
+const char* daemon_socket_path();
+
+/* Listens on SOCKET_PATH and serves requests, each connection on a thread of
+   its own, until SIGINT or SIGTERM. Returns 0 then, or -1 if the socket could
+   not be set up.
+ */
+int serve_daemon(const char* socket_path);
+
+/* Connects to the daemon at SOCKET_PATH. Returns the socket, or -1 if there
+   is no daemon.
+ */
+int connect_daemon(const char* socket_path);
+
+/* Sends the SIZE bytes at DATA over the connection FD to be assembled with
+   OPTIONS on JOBS threads. Stores the object file in *OUT and the messages,
+   NUL-terminated, in *LOG, both of which the caller must free, and their
+   lengths in *OUT_LEN and *LOG_LEN. Returns what assemble_mem() returned in
+   the daemon, or -2 if the connection failed.
+ */
+int request_assembly(int fd, const char* data, size_t size, int options, int jobs,
+    char** out, size_t* out_len, char** log, size_t* log_len);
+
+#endif
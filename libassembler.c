@@ -0,0 +1,1326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <setjmp.h>
+
+#include "src/utils.h"
+#include "src/tables.h"
+#include "src/translate_utils.h"
+#include "src/translate.h"
+#include "src/reader.h"
+#include "src/lexer.h"
+#include "src/scanner.h"
+#include "src/ir.h"
+#include "src/object.h"
+#include "src/backpatch.h"
+#include "src/ring.h"
+#include "src/arena.h"
+#include "assembler.h"
+#include "libassembler.h"
+
+const int MAX_ARGS = 3;
+
+/* Pass two only splits the program between threads if each of them gets at
+   least this many instructions. Below that, starting them costs more than it
+   saves.
+ */
+#define MIN_JOB_INSTS 4096
+
+/* The same for pass one, in bytes of input. */
+#define MIN_JOB_BYTES (64 * 1024)
+
+/* Input lines per batch in pass_pipeline(). A line expands into at most two
+   instructions.
+ */
+#define PIPELINE_BATCH_LINES 4096
+#define PIPELINE_BATCH_INSTS (2 * PIPELINE_BATCH_LINES)
+
+/* Number of batches in pass_pipeline(). Once all of them are in use, reading
+   waits for the other stages.
+ */
+#define PIPELINE_BATCHES 8
+
+/* Set per thread, so that contexts with different settings can run at once. */
+static __thread int num_jobs = 1;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Reports the label at LABEL, LEN bytes long, that is not valid. */
+static void raise_label_error(uint32_t input_line, const char* label, size_t len) {
+    write_to_log("Error - invalid label at line %d: %.*s\n", input_line, (int) len, label);
+}
+
+/* Call this function if more than MAX_ARGS arguments are found while parsing
+   arguments.
+
+   INPUT_LINE is which line of the input file that the error occurred in. Note
+   that the first line is line 1 and that empty lines are included in the count.
+
+   EXTRA_ARG should contain the first extra argument encountered.
+ */
+static void raise_extra_arg_error(uint32_t input_line, const Token* extra_arg) {
+    write_to_log("Error - extra argument at line %d: %.*s\n", input_line,
+        (int) extra_arg->len, extra_arg->start);
+}
+
+/* Reports an instruction that write_pass_one() could not translate.
+
+   INPUT_LINE is which line of the input file that the error occurred in. Note
+   that the first line is line 1 and that empty lines are included in the count.
+ */
+static void raise_inst_error(uint32_t input_line, const Token* name, const Token* args,
+    int num_args) {
+    
+    write_to_log("Error - invalid instruction at line %d: %.*s", input_line,
+        (int) name->len, name->start);
+    for (int i = 0; i < num_args; i++) {
+        write_to_log(" %.*s", (int) args[i].len, args[i].start);
+    }
+    write_to_log("\n");
+}
+
+/* Reads TOK and determines whether it is a label (ends in ':'), and if so,
+   whether it is a valid label, and then tries to add it to the symbol table.
+
+   INPUT_LINE is which line of the input file we are currently processing. Note
+   that the first line is line 1 and that empty lines are included in this count.
+
+   BYTE_OFFSET is the offset of the NEXT instruction (should it exist). 
+
+   Four scenarios can happen:
+    1. TOK is not a label (does not end in ':'). Returns 0.
+    2. TOK ends in ':', but is not a valid label. Returns -1.
+    3a. TOK ends in ':' and is a valid label. Addition to symbol table fails.
+        Returns -1.
+    3b. TOK ends in ':' and is a valid label. Addition to symbol table succeeds.
+        Returns 1.
+ */
+static int add_if_label(uint32_t input_line, const Token* tok, uint32_t byte_offset,
+    SymbolTable* symtbl) {
+    
+    if (tok->type != TOK_LABEL) {
+        return 0;
+    }
+
+    size_t len = tok->len - 1;      // drop the ':'
+    if (!is_valid_label_span(tok->start, len)) {
+        raise_label_error(input_line, tok->start, len);
+        return -1;
+    }
+    if (add_to_table_span(symtbl, tok->start, len, byte_offset) != 0) {
+        return -1;
+    }
+    return 1;
+}
+
+/*  A helpful helper function that parses instruction arguments. It raises an error
+    if too many arguments have been passed into the instruction.
+*/
+static int parse_args(Lexer* lexer, uint32_t input_line, Token* args, int* num_args) {
+    Token token;
+    while (next_token(lexer, &token)) {
+        if (*num_args < MAX_ARGS) {
+            args[*num_args] = token;
+            (*num_args)++;
+        } else {
+            raise_extra_arg_error(input_line, &token);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Parses the line LINE of length LINE_LEN, which is line INPUT_LINE of the
+   input, following the rules of pass_one() below. A label is added to SYMTBL
+   at BYTE_OFFSET, and is also stored in LABEL without its ':' (LABEL->len is
+   0 if no label was added). The instruction is stored in NAME, ARGS and
+   NUM_ARGS.
+
+   Returns 1 if the line holds an instruction and 0 if not. *RET_CODE is set
+   to -1 if an error was found.
+ */
+static int parse_line(uint32_t input_line, const char* line, size_t line_len,
+    uint32_t byte_offset, SymbolTable* symtbl, Token* label, Token* name, Token* args,
+    int* num_args, int* ret_code) {
+
+    label->len = 0;
+
+    // Comments are skipped by the lexer
+    Lexer lexer;
+    init_lexer(&lexer, line, line_len);
+
+    // Scan for the instruction name
+    if (!next_token(&lexer, name)) {
+        return 0;
+    }
+
+    // A label is followed by (optionally) the instruction name
+    int added = add_if_label(input_line, name, byte_offset, symtbl);
+    if (added != 0) {
+        if (added == -1) {
+            *ret_code = -1;
+        } else {
+            *label = *name;
+            label->len--;
+        }
+        if (!next_token(&lexer, name)) {
+            return 0;
+        }
+    }
+
+    // Scan for arguments
+    *num_args = 0;
+    if (parse_args(&lexer, input_line, args, num_args) == -1) {
+        *ret_code = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/* A range of whole lines of the input, parsed by one thread of pass_one().
+   Labels go into a table of their own with addresses counted from the start
+   of the range, and messages are captured instead of logged, so that both
+   can be merged in line order once the ranges before it are done. What the
+   job allocates comes from its own arena, a sub-arena of the session's.
+ */
+typedef struct {
+    Reader input;
+    uint32_t first_line;    // number of input lines before the range
+    Program prog;
+    SymbolTable* labels;
+    size_t* label_log;      // how much of LOG had been written before each label
+    uint32_t label_log_cap;
+    Writer log;
+    uint32_t num_bytes;     // bytes taken by the instructions of the range
+    int ret_code;
+    Arena arena;
+    int out_of_memory;
+    int started;            // whether it runs on a thread of its own
+} ParseJob;
+
+/* Runs pass one over the lines of INPUT, the first of which is line
+   INPUT_LINE + 1 of the input. Labels get addresses from *BYTE_OFFSET on,
+   and *BYTE_OFFSET is left past the last instruction. If JOB is given, the
+   position in its log of every label added to SYMTBL is recorded.
+ */
+static int parse_lines(Reader* input, uint32_t input_line, Program* output,
+    SymbolTable* symtbl, uint32_t* byte_offset, ParseJob* job) {
+    const char* line;
+    size_t line_len;
+    int ret_code = 0;
+
+    // Read lines and add to instructions
+    while (next_line(input, &line, &line_len)) {
+        input_line++;
+
+        size_t log_len = job ? job->log.len : 0;
+        Token label, name, args[MAX_ARGS];
+        int num_args;
+        int has_inst = parse_line(input_line, line, line_len, *byte_offset, symtbl, &label,
+            &name, args, &num_args, &ret_code);
+        if (job && label.len > 0) {
+            if (symtbl->len > job->label_log_cap) {
+                job->label_log_cap = 2 * symtbl->len;
+                job->label_log = mem_realloc(job->label_log, job->label_log_cap * sizeof(size_t));
+            }
+            job->label_log[symtbl->len - 1] = log_len;
+        }
+        if (!has_inst) {
+            continue;
+        }
+
+        unsigned int lines_written = write_pass_one_tokens(output, &name, args, num_args);
+        if (!lines_written) {
+            raise_inst_error(input_line, &name, args, num_args);
+            ret_code = -1;
+        }
+        *byte_offset += lines_written * 4;
+    }
+    return ret_code;
+}
+
+/* Runs RUN(ARG) on the calling thread with ARENA for what it allocates.
+   Returns 0 once it is done, or -1 if memory ran out, in which case the
+   caller has to pass that on, since a job thread must not exit the process.
+ */
+static int run_job(Arena* arena, void (*run)(void*), void* arg) {
+    jmp_buf on_oom;
+    jmp_buf* outer_handler = on_allocation_failure(&on_oom);
+    Arena* outer_arena = use_arena(arena);
+    int err = 0;
+    if (setjmp(on_oom) == 0) {
+        run(arg);
+        on_allocation_failure(outer_handler);
+    } else {
+        on_allocation_failure(outer_handler);
+        err = -1;
+    }
+    use_arena(outer_arena);
+    return err;
+}
+
+static void parse_job(void* arg) {
+    ParseJob* job = arg;
+    init_program(&job->prog, job->prog.keep_text);
+    job->labels = create_table(SYMTBL_NON_UNIQUE);
+    job->ret_code = parse_lines(&job->input, job->first_line, &job->prog, job->labels,
+        &job->num_bytes, job);
+}
+
+static void* run_parse_job(void* arg) {
+    ParseJob* job = arg;
+    Writer* outer = capture_log(&job->log);
+    job->out_of_memory = run_job(&job->arena, parse_job, job) != 0;
+    capture_log(outer);
+    return NULL;
+}
+
+/* Returns the number of newlines in the LEN bytes at P. */
+static uint32_t count_lines(const char* p, size_t len) {
+    uint32_t count = 0;
+    ScanMasks masks;
+    for (size_t i = 0; i < len; i += SCAN_BLOCK_SIZE) {
+        size_t n = len - i < SCAN_BLOCK_SIZE ? len - i : SCAN_BLOCK_SIZE;
+        scan_block(p + i, n, &masks);
+        count += __builtin_popcountll(masks.newline);
+    }
+    return count;
+}
+
+/* Writes the LEN bytes of captured messages at P to the log. */
+static void write_captured_log(const char* p, size_t len) {
+    if (len > 0) {
+        write_to_log("%.*s", (int) len, p);
+    }
+}
+
+/* Same as pass_one(), but splits the input into ranges of whole lines that
+   are parsed on separate threads. Only the addresses of labels depend on
+   earlier lines, so once every range knows how many bytes its instructions
+   take, the labels are added to SYMTBL in order at their real addresses.
+   This also checks for duplicates the same way, and messages are written in
+   line order, so the result is the same as that of a single thread.
+ */
+static int pass_one_parallel(Reader* input, Program* output, SymbolTable* symtbl) {
+    const char* data = input->data + input->pos;
+    size_t size = input->size - input->pos;
+    uint32_t jobs = num_jobs;
+    if (jobs > size / MIN_JOB_BYTES) {
+        jobs = size / MIN_JOB_BYTES;
+    }
+
+    ParseJob* job = mem_calloc(jobs, sizeof(ParseJob));
+    pthread_t* threads = mem_alloc(jobs * sizeof(pthread_t));
+
+    // each range ends right after a newline, or at the end of the input
+    size_t start = 0;
+    uint32_t first_line = 0;
+    for (uint32_t k = 0; k < jobs; k++) {
+        size_t end = size;
+        if (k + 1 < jobs && start < size) {
+            end = size * (k + 1) / jobs;
+            end = end < start ? start : end;
+            const char* newline = memchr(data + end, '\n', size - end);
+            end = newline ? (size_t) (newline - data) + 1 : size;
+        }
+        open_reader_mem(&job[k].input, data + start, end - start);
+        job[k].first_line = first_line;
+        job[k].prog.keep_text = output->keep_text;
+        init_sub_arena(&job[k].arena);
+        open_writer_mem(&job[k].log);
+
+        first_line += count_lines(data + start, end - start);
+        start = end;
+    }
+    input->pos = input->size;
+
+    for (uint32_t k = 1; k < jobs; k++) {
+        job[k].started = pthread_create(&threads[k], NULL, run_parse_job, &job[k]) == 0;
+        if (!job[k].started) {
+            // parse it on this thread instead
+            run_parse_job(&job[k]);
+        }
+    }
+    run_parse_job(&job[0]);
+
+    // every job is done before memory running out on one is passed on
+    int out_of_memory = 0;
+    for (uint32_t k = 0; k < jobs; k++) {
+        if (job[k].started) {
+            pthread_join(threads[k], NULL);
+        }
+        out_of_memory |= job[k].out_of_memory;
+    }
+    if (out_of_memory) {
+        for (uint32_t k = 0; k < jobs; k++) {
+            close_writer(&job[k].log);
+            free_arena(&job[k].arena);
+        }
+        mem_free(job);
+        mem_free(threads);
+        allocation_failed();
+    }
+
+    int ret_code = 0;
+    uint32_t byte_offset = 0;
+    for (uint32_t k = 0; k < jobs; k++) {
+        if (job[k].ret_code != 0) {
+            ret_code = -1;
+        }
+
+        const char* log = job[k].log.buf;
+        size_t written = 0;
+        reserve_table(symtbl, job[k].labels->len);
+        for (uint32_t i = 0; i < job[k].labels->len; i++) {
+            const Symbol* label = &job[k].labels->tbl[i];
+            const StringPool* names = &job[k].labels->names;
+            write_captured_log(log + written, job[k].label_log[i] - written);
+            written = job[k].label_log[i];
+            if (add_to_table_span(symtbl, pool_str(names, label->name), pool_len(names, label->name),
+                label->addr + byte_offset) != 0) {
+                ret_code = -1;
+            }
+        }
+        write_captured_log(log + written, job[k].log.len - written);
+
+        append_program(output, &job[k].prog);
+        byte_offset += job[k].num_bytes;
+
+        close_writer(&job[k].log);
+        free_arena(&job[k].arena);
+        close_reader(&job[k].input);
+    }
+    mem_free(job);
+    mem_free(threads);
+    return ret_code;
+}
+
+/* First pass of the assembler. Reads INPUT line by line, adds each label to
+   SYMTBL at the byte offset of the next instruction, and appends the
+   instructions, with pseudoinstructions expanded, to OUTPUT.
+
+   Only the first token of a line can be a label, and the token after it is
+   the name of the instruction. An instruction with more than MAX_ARGS
+   arguments is reported and left out. Errors do not stop the pass: it reads
+   the whole input and returns -1 if there were any, and 0 otherwise.
+ */
+int pass_one(Reader* input, Program* output, SymbolTable* symtbl) {
+    size_t size = input->size - input->pos;
+    if (num_jobs > 1 && !input->streaming && size / MIN_JOB_BYTES > 1) {
+        return pass_one_parallel(input, output, symtbl);
+    }
+    uint32_t byte_offset = 0;
+    return parse_lines(input, 0, output, symtbl, &byte_offset, NULL);
+}
+
+/* Second pass of the assembler. Encodes the instructions of INPUT, whose
+   labels must all be in SYMTBL already, writes them to OUTPUT and adds every
+   jump to RELTBL. An instruction that cannot be encoded is reported and
+   skipped, and the rest are still translated. Returns 0, or minus the number
+   of errors.
+ */
+int pass_two(const Program* input, Writer* output, SymbolTable* symtbl, SymbolTable* reltbl) {
+    uint32_t* words = mem_alloc((input->len + 1) * sizeof(uint32_t));
+    uint32_t num_words;
+    int count = encode_program(input, words, &num_words, symtbl, reltbl);
+    write_insts_hex(output, words, num_words);
+    mem_free(words);
+    return count;
+}
+
+void set_num_jobs(int jobs) {
+    num_jobs = jobs > 0 ? jobs : 1;
+}
+
+/* The instructions FIRST to LAST (exclusive) of a program, encoded by one
+   thread of encode_program() as if they started at address 0. The words,
+   relocations and errors of each job are kept apart so that they can be
+   merged in address order afterwards. Every job but the first allocates from
+   an arena of its own.
+ */
+typedef struct {
+    const Program* input;
+    const int64_t* targets; // branch targets of INPUT, from resolve_targets()
+    uint32_t first;
+    uint32_t last;
+    uint32_t* words;
+    uint32_t num_words;
+    SymbolTable* reltbl;
+    uint32_t* errors;       // instructions that could not be encoded
+    uint32_t num_errors;
+    uint32_t errors_cap;
+    Arena arena;
+    int out_of_memory;
+    int started;            // whether it runs on a thread of its own
+} EncodeJob;
+
+static void encode_job(void* arg) {
+    EncodeJob* job = arg;
+    const Program* input = job->input;
+    if (!job->words) {
+        job->words = mem_alloc((job->last - job->first + 1) * sizeof(uint32_t));
+        job->reltbl = create_table(SYMTBL_NON_UNIQUE);
+    }
+    uint32_t byte = 0;
+    uint32_t n = 0;
+    for (uint32_t i = job->first; i < job->last; i++) {
+        const Inst* inst = &input->insts[i];
+        if (inst->op == OP_NONE) {
+            continue;
+        }
+
+        int retval = encode_inst(input, inst, byte, job->targets, job->reltbl, &job->words[n]);
+        if (retval == 0) {
+            byte +=4;
+            n++;
+        } else {
+            if (job->num_errors == job->errors_cap) {
+                job->errors_cap = job->errors_cap ? 2 * job->errors_cap : 16;
+                job->errors = mem_realloc(job->errors, job->errors_cap * sizeof(uint32_t));
+            }
+            job->errors[job->num_errors++] = i;
+        }
+    }
+    job->num_words = n;
+}
+
+static void* run_encode_job(void* arg) {
+    EncodeJob* job = arg;
+    job->out_of_memory = run_job(&job->arena, encode_job, job) != 0;
+    return NULL;
+}
+
+/* Same as pass_two(), but stores the encoded words in WORDS, which must have
+   room for one word per instruction of INPUT, and their number in NUM_WORDS.
+
+   Branch targets are looked up in the symbol table once per name beforehand.
+   With more than one job (see set_num_jobs()), the instructions are split
+   into consecutive ranges that are encoded on separate threads. Each range
+   starts at address 0, and its words and relocations are moved to their real
+   addresses once the sizes of the ranges before it are known, so the result
+   is the same as encoding everything in order.
+ */
+int encode_program(const Program* input, uint32_t* words, uint32_t* num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
+    uint32_t jobs = num_jobs;
+    if (jobs > input->len / MIN_JOB_INSTS) {
+        jobs = input->len / MIN_JOB_INSTS;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+
+    int64_t* targets = resolve_targets(input, symtbl);
+    EncodeJob* job = mem_calloc(jobs, sizeof(EncodeJob));
+    pthread_t* threads = mem_alloc(jobs * sizeof(pthread_t));
+    for (uint32_t k = 0; k < jobs; k++) {
+        job[k].input = input;
+        job[k].targets = targets;
+        job[k].first = (uint64_t) input->len * k / jobs;
+        job[k].last = (uint64_t) input->len * (k + 1) / jobs;
+        if (k == 0) {
+            // the first range is already at its real addresses
+            job[k].words = words;
+            job[k].reltbl = reltbl;
+        } else {
+            init_sub_arena(&job[k].arena);
+        }
+    }
+
+    for (uint32_t k = 1; k < jobs; k++) {
+        job[k].started = pthread_create(&threads[k], NULL, run_encode_job, &job[k]) == 0;
+        if (!job[k].started) {
+            // encode it on this thread instead
+            run_encode_job(&job[k]);
+        }
+    }
+    // the first range fills in WORDS and RELTBL themselves, so it stays in
+    // the session's arena, and memory running out there is not caught here
+    encode_job(&job[0]);
+
+    int out_of_memory = 0;
+    for (uint32_t k = 1; k < jobs; k++) {
+        if (job[k].started) {
+            pthread_join(threads[k], NULL);
+        }
+        out_of_memory |= job[k].out_of_memory;
+    }
+    if (out_of_memory) {
+        mem_free(job[0].errors);
+        for (uint32_t k = 1; k < jobs; k++) {
+            free_arena(&job[k].arena);
+        }
+        mem_free(job);
+        mem_free(threads);
+        mem_free(targets);
+        allocation_failed();
+    }
+
+    int count = 0;
+    uint32_t n = 0;
+    for (uint32_t k = 0; k < jobs; k++) {
+        if (k > 0) {
+            uint32_t offset = n * 4;
+            for (uint32_t i = 0; i < job[k].num_words; i++) {
+                words[n + i] = rebase_word(job[k].words[i], offset);
+            }
+            append_table(reltbl, job[k].reltbl, offset);
+        }
+        n += job[k].num_words;
+
+        for (uint32_t i = 0; i < job[k].num_errors; i++) {
+            // the line number is the line of the instruction in the .int file
+            uint32_t line = job[k].errors[i];
+            write_to_log("Error - invalid instruction at line %d: %s\n", line + 1,
+                get_text(input, &input->insts[line]));
+            count -= 1;
+        }
+        if (k == 0) {
+            mem_free(job[k].errors);
+        } else {
+            free_arena(&job[k].arena);
+        }
+    }
+    mem_free(job);
+    mem_free(threads);
+    mem_free(targets);
+    *num_words = n;
+    return count;
+}
+
+/* Assembles INPUT in a single pass, writing the complete object file to
+   OUTPUT. Each line is encoded as soon as it has been read. Branches to
+   labels that are not defined yet are patched by a Backpatcher once the label
+   shows up. Labels get addresses the way pass_one() assigns them and
+   instructions the way pass_two() does, so for a valid program the output is
+   the same as with two passes.
+
+   Output that is buffered is flushed whenever the next line has not arrived
+   yet, so that a reader on the other end of a pipe sees it right away.
+
+   Returns 0 if no errors were encountered and -1 otherwise.
+ */
+int pass_stream(Reader* input, Writer* output, SymbolTable* symtbl, SymbolTable* reltbl) {
+    const char* line;
+    size_t line_len;
+    uint32_t input_line = 0, byte_offset = 0, addr = 0;
+    int ret_code = 0;
+
+    Backpatcher patcher;
+    Program prog;       // the instructions of the current line
+    init_program(&prog, 1);
+    put_str(output, ".text\n");
+    init_backpatcher(&patcher, output);
+
+    while (1) {
+        if (reader_would_block(input)) {
+            flush_writer(output);
+        }
+        if (!next_line(input, &line, &line_len)) {
+            break;
+        }
+        input_line++;
+
+        Token label, name, args[MAX_ARGS];
+        int num_args;
+        int has_inst = parse_line(input_line, line, line_len, byte_offset, symtbl, &label,
+            &name, args, &num_args, &ret_code);
+        if (label.len > 0) {
+            resolve_label(&patcher, label.start, label.len, byte_offset);
+        }
+        if (!has_inst) {
+            continue;
+        }
+
+        reset_program(&prog);
+        unsigned int lines_written = write_pass_one_tokens(&prog, &name, args, num_args);
+        if (!lines_written) {
+            raise_inst_error(input_line, &name, args, num_args);
+            ret_code = -1;
+        }
+        byte_offset += lines_written * 4;
+
+        for (uint32_t i = 0; i < prog.len; i++) {
+            const Inst* inst = &prog.insts[i];
+            int is_branch = inst->op == OP_BEQ || inst->op == OP_BNE;
+            const char* target = is_branch ? get_name(&prog, inst->sym) : NULL;
+            int64_t target_addr = is_branch ? get_addr_for_symbol(symtbl, target) : -1;
+            uint32_t word;
+            if (is_branch && target_addr == -1) {
+                emit_forward_branch(&patcher, inst, addr, target, strlen(target), input_line);
+                addr += 4;
+            } else if (is_branch) {
+                emit_word(&patcher, encode_branch(inst, addr, target_addr));
+                addr += 4;
+            } else if (encode_inst(&prog, inst, addr, NULL, reltbl, &word) == 0) {
+                emit_word(&patcher, word);
+                addr += 4;
+            } else {
+                write_to_log("Error - invalid instruction at line %d: %s\n", input_line,
+                    get_text(&prog, inst));
+                ret_code = -1;
+            }
+        }
+    }
+
+    if (finish_backpatcher(&patcher) != 0) {
+        ret_code = -1;
+    }
+    free_program(&prog);
+
+    put_str(output, "\n.symbol\n");
+    write_table_to(symtbl, output);
+
+    put_str(output, "\n.relocation\n");
+    write_table_to(reltbl, output);
+    return ret_code;
+}
+
+/* A label defined in a Batch, just before its instruction POS. */
+typedef struct {
+    const char* name;
+    uint32_t len;
+    uint32_t pos;
+    uint32_t addr;
+} BatchLabel;
+
+/* What the encode stage of pass_pipeline() made of an instruction. */
+typedef enum {
+    WORD_DONE,              // the word is final
+    WORD_FORWARD,           // a branch to a label that is not defined yet
+    WORD_SKIP               // not part of .text
+} WordKind;
+
+/* Lines on their way through pass_pipeline(). Each stage fills in its part
+   and hands the batch on, and the last stage hands it back to the first.
+ */
+typedef struct {
+    // read stage
+    char* text;             // whole lines, each ending in '\n'
+    size_t text_len;
+    size_t text_cap;
+    uint32_t first_line;    // number of input lines before the batch
+    uint32_t num_lines;
+    int flush;              // no more input was available after the batch
+    int last;               // the input ends with the batch
+
+    // parse stage
+    Program prog;
+    uint32_t lines[PIPELINE_BATCH_INSTS];       // input line of each instruction
+    int64_t targets[PIPELINE_BATCH_INSTS];      // label address of a branch, or -1
+    BatchLabel labels[PIPELINE_BATCH_LINES];
+    uint32_t num_labels;
+
+    // encode stage
+    uint32_t words[PIPELINE_BATCH_INSTS];
+    uint8_t kinds[PIPELINE_BATCH_INSTS];        // WordKinds
+} Batch;
+
+/* The state shared by the stages of pass_pipeline(). Stage K takes batches
+   from RINGS[K] and passes them to RINGS[K + 1], and the last stage returns
+   them to RINGS[0]. Apart from the rings, each field is only used by one
+   stage: the symbol table by parsing, the relocation table by encoding, and
+   OUTPUT by formatting.
+ */
+typedef struct {
+    Reader* input;
+    Writer* output;
+    SymbolTable* symtbl;
+    SymbolTable* reltbl;
+    Ring rings[PIPELINE_STAGES];
+    StageStats* stats;
+    Backpatcher* patcher;   // of the format stage
+    int ret_code;           // of the parse stage
+    Batch* held[PIPELINE_STAGES];   // the batch each stage is working on, if any
+    int failed;             // set once a stage has run out of memory or not started
+} Pipeline;
+
+/* Passes BATCH from stage K to the next one. */
+static void hand_on(Pipeline* pipe, int k, Batch* batch) {
+    pipe->held[k] = NULL;
+    pipe->stats[k].wait += ring_push_wait(&pipe->rings[(k + 1) % PIPELINE_STAGES], batch);
+}
+
+/* Takes the next batch for stage K. */
+static Batch* take_batch(Pipeline* pipe, int k) {
+    void* batch;
+    pipe->stats[k].wait += ring_pop_wait(&pipe->rings[k], &batch);
+    pipe->held[k] = batch;
+    return batch;
+}
+
+/* Returns 1 if the pipeline is shutting down because a stage failed. */
+static int pipeline_failed(Pipeline* pipe) {
+    return __atomic_load_n(&pipe->failed, __ATOMIC_ACQUIRE);
+}
+
+/* Passes batches on from stage K without working on them, starting with the
+   one it holds, until the last one has gone by. The read stage makes the
+   first batch it passes on the last, so that every stage gets to the end
+   and the pipeline stops once one stage has failed.
+ */
+static void drain_stage(Pipeline* pipe, int k) {
+    Batch* batch = pipe->held[k];
+    while (1) {
+        if (!batch) {
+            batch = take_batch(pipe, k);
+        }
+        if (k == 0) {
+            batch->last = 1;
+        }
+        int last = batch->last;
+        if (k < PIPELINE_STAGES - 1 || !last) {
+            hand_on(pipe, k, batch);
+        }
+        if (last) {
+            return;
+        }
+        batch = NULL;
+    }
+}
+
+/* Stage 0: copies whole lines of the input into batches. A batch is sent off
+   early if the next line has not arrived yet, so that the output can be
+   flushed as in pass_stream().
+ */
+static void read_stage(void* arg) {
+    Pipeline* pipe = arg;
+    StageStats* stats = &pipe->stats[0];
+    uint32_t input_line = 0;
+    int flushed = 0, last = 0;
+
+    while (!last) {
+        Batch* batch = take_batch(pipe, 0);
+        if (pipeline_failed(pipe)) {
+            drain_stage(pipe, 0);
+            return;
+        }
+        double start = ring_clock();
+        batch->text_len = 0;
+        batch->first_line = input_line;
+        batch->num_lines = 0;
+        batch->flush = 0;
+
+        const char* line;
+        size_t line_len;
+        while (batch->num_lines < PIPELINE_BATCH_LINES) {
+            if (!flushed && reader_would_block(pipe->input)) {
+                batch->flush = 1;
+                flushed = 1;
+                break;
+            }
+            if (!next_line(pipe->input, &line, &line_len)) {
+                last = 1;
+                break;
+            }
+            flushed = 0;
+
+            if (batch->text_cap < batch->text_len + line_len + 1) {
+                while (batch->text_cap < batch->text_len + line_len + 1) {
+                    batch->text_cap *= 2;
+                }
+                batch->text = mem_realloc(batch->text, batch->text_cap);
+            }
+            memcpy(batch->text + batch->text_len, line, line_len);
+            batch->text[batch->text_len + line_len] = '\n';
+            batch->text_len += line_len + 1;
+            batch->num_lines++;
+        }
+        batch->last = last;
+        input_line += batch->num_lines;
+
+        stats->items += batch->num_lines;
+        stats->busy += ring_clock() - start;
+        hand_on(pipe, 0, batch);
+    }
+}
+
+/* Stage 1: lexes the lines, adds labels to the symbol table and expands
+   pseudo-instructions, as pass_stream() does. Branches are resolved against
+   the labels defined so far. This is the only stage that logs errors while
+   the pipeline runs, so they come out in line order.
+ */
+static void parse_stage(void* arg) {
+    Pipeline* pipe = arg;
+    StageStats* stats = &pipe->stats[1];
+    uint32_t byte_offset = 0;
+
+    Batch* batch;
+    do {
+        batch = take_batch(pipe, 1);
+        if (pipeline_failed(pipe)) {
+            drain_stage(pipe, 1);
+            return;
+        }
+        double start = ring_clock();
+        Program* prog = &batch->prog;
+        reset_program(prog);
+        batch->num_labels = 0;
+
+        Reader lines;
+        open_reader_mem(&lines, batch->text, batch->text_len);
+        uint32_t input_line = batch->first_line;
+        const char* line;
+        size_t line_len;
+        while (next_line(&lines, &line, &line_len)) {
+            input_line++;
+
+            Token label, name, args[MAX_ARGS];
+            int num_args;
+            int has_inst = parse_line(input_line, line, line_len, byte_offset, pipe->symtbl,
+                &label, &name, args, &num_args, &pipe->ret_code);
+            if (label.len > 0) {
+                BatchLabel* l = &batch->labels[batch->num_labels++];
+                l->name = label.start;
+                l->len = label.len;
+                l->pos = prog->len;
+                l->addr = byte_offset;
+            }
+            if (!has_inst) {
+                continue;
+            }
+
+            uint32_t first = prog->len;
+            unsigned int lines_written = write_pass_one_tokens(prog, &name, args, num_args);
+            if (!lines_written) {
+                raise_inst_error(input_line, &name, args, num_args);
+                pipe->ret_code = -1;
+            }
+            byte_offset += lines_written * 4;
+
+            for (uint32_t i = first; i < prog->len; i++) {
+                Inst* inst = &prog->insts[i];
+                batch->lines[i] = input_line;
+                if (inst->op == OP_INVALID) {
+                    write_to_log("Error - invalid instruction at line %d: %s\n", input_line,
+                        get_text(prog, inst));
+                    pipe->ret_code = -1;
+                    inst->op = OP_NONE;
+                } else if (inst->op == OP_BEQ || inst->op == OP_BNE) {
+                    batch->targets[i] = get_addr_for_symbol(pipe->symtbl,
+                        get_name(prog, inst->sym));
+                }
+            }
+        }
+        close_reader(&lines);
+
+        stats->items += batch->num_lines;
+        stats->busy += ring_clock() - start;
+        hand_on(pipe, 1, batch);
+    } while (!batch->last);
+}
+
+/* Stage 2: encodes the instructions and adds jumps to the relocation table.
+   Branches to labels that are not defined yet are left to the Backpatcher.
+ */
+static void encode_stage(void* arg) {
+    Pipeline* pipe = arg;
+    StageStats* stats = &pipe->stats[2];
+    uint32_t addr = 0;
+
+    Batch* batch;
+    do {
+        batch = take_batch(pipe, 2);
+        if (pipeline_failed(pipe)) {
+            drain_stage(pipe, 2);
+            return;
+        }
+        double start = ring_clock();
+        const Program* prog = &batch->prog;
+        for (uint32_t i = 0; i < prog->len; i++) {
+            const Inst* inst = &prog->insts[i];
+            if (inst->op == OP_NONE) {
+                batch->kinds[i] = WORD_SKIP;
+                continue;
+            }
+            if ((inst->op == OP_BEQ || inst->op == OP_BNE) && batch->targets[i] == -1) {
+                batch->kinds[i] = WORD_FORWARD;
+            } else if (inst->op == OP_BEQ || inst->op == OP_BNE) {
+                batch->words[i] = encode_branch(inst, addr, batch->targets[i]);
+                batch->kinds[i] = WORD_DONE;
+            } else if (encode_inst(prog, inst, addr, NULL, pipe->reltbl, &batch->words[i]) == 0) {
+                batch->kinds[i] = WORD_DONE;
+            } else {
+                batch->kinds[i] = WORD_SKIP;
+                continue;
+            }
+            addr += 4;
+        }
+
+        stats->items += prog->len;
+        stats->busy += ring_clock() - start;
+        hand_on(pipe, 2, batch);
+    } while (!batch->last);
+}
+
+/* Stage 3: formats the words of each batch and patches forward branches as
+   their labels come by. Runs on the calling thread.
+ */
+static void format_stage(void* arg) {
+    Pipeline* pipe = arg;
+    Backpatcher* patcher = pipe->patcher;
+    StageStats* stats = &pipe->stats[3];
+    uint32_t addr = 0;
+
+    Batch* batch;
+    do {
+        batch = take_batch(pipe, 3);
+        if (pipeline_failed(pipe)) {
+            drain_stage(pipe, 3);
+            return;
+        }
+        double start = ring_clock();
+        const Program* prog = &batch->prog;
+        uint32_t l = 0;
+        for (uint32_t i = 0; i <= prog->len; i++) {
+            for (; l < batch->num_labels && batch->labels[l].pos == i; l++) {
+                resolve_label(patcher, batch->labels[l].name, batch->labels[l].len,
+                    batch->labels[l].addr);
+            }
+            if (i == prog->len || batch->kinds[i] == WORD_SKIP) {
+                continue;
+            }
+            if (batch->kinds[i] == WORD_FORWARD) {
+                const char* target = get_name(prog, prog->insts[i].sym);
+                emit_forward_branch(patcher, &prog->insts[i], addr, target, strlen(target),
+                    batch->lines[i]);
+            } else {
+                emit_word(patcher, batch->words[i]);
+            }
+            addr += 4;
+        }
+        if (batch->flush) {
+            flush_writer(pipe->output);
+        }
+
+        stats->items += prog->len;
+        stats->busy += ring_clock() - start;
+        if (!batch->last) {
+            hand_on(pipe, 3, batch);
+        }
+    } while (!batch->last);
+}
+
+typedef struct {
+    Pipeline* pipe;
+    int stage;
+} StageRun;
+
+static void (*const STAGES[PIPELINE_STAGES])(void*) = {
+    read_stage, parse_stage, encode_stage, format_stage
+};
+
+/* Runs stage K of PIPE on the calling thread. The stages allocate outside
+   any arena, since what they add to the tables has to outlive them. If the
+   stage runs out of memory, the pipeline is stopped instead.
+ */
+static void run_stage(Pipeline* pipe, int k) {
+    if (run_job(NULL, STAGES[k], pipe) != 0) {
+        __atomic_store_n(&pipe->failed, 1, __ATOMIC_RELEASE);
+        drain_stage(pipe, k);
+    }
+}
+
+static void* stage_thread(void* arg) {
+    StageRun* run = arg;
+    run_stage(run->pipe, run->stage);
+    return NULL;
+}
+
+/* Same as pass_stream(), but reads, parses, encodes and formats on separate
+   threads at the same time. The stages pass batches of lines to each other
+   through lock-free rings; a fixed number of batches is in use, so a stage
+   that gets ahead waits for the slowest one. The output is the same as that
+   of pass_stream(). If STATS is not NULL, the time each stage spent working
+   and waiting is stored in it.
+
+   Returns -1 if a stage thread could not be started, after stopping the
+   ones that were. If a stage runs out of memory, the others are stopped
+   before allocation_failed() is called on the calling thread.
+ */
+int pass_pipeline(Reader* input, Writer* output, SymbolTable* symtbl, SymbolTable* reltbl,
+    StageStats* stats) {
+    static const char* const names[PIPELINE_STAGES] = { "read", "parse", "encode", "format" };
+    StageStats own_stats[PIPELINE_STAGES];
+    Pipeline pipe;
+    memset(&pipe, 0, sizeof(Pipeline));
+    pipe.input = input;
+    pipe.output = output;
+    pipe.symtbl = symtbl;
+    pipe.reltbl = reltbl;
+    pipe.stats = stats ? stats : own_stats;
+    memset(pipe.stats, 0, PIPELINE_STAGES * sizeof(StageStats));
+    for (int k = 0; k < PIPELINE_STAGES; k++) {
+        pipe.stats[k].name = names[k];
+        init_ring(&pipe.rings[k], PIPELINE_BATCHES);
+    }
+
+    Batch* batches = mem_calloc(PIPELINE_BATCHES, sizeof(Batch));
+    for (int i = 0; i < PIPELINE_BATCHES; i++) {
+        batches[i].text_cap = 65536;
+        batches[i].text = mem_alloc(batches[i].text_cap);
+        init_program(&batches[i].prog, 0);
+        ring_push(&pipe.rings[0], &batches[i]);
+    }
+
+    pthread_t threads[PIPELINE_STAGES - 1];
+    StageRun runs[PIPELINE_STAGES - 1];
+    int started = 0;
+    while (started < PIPELINE_STAGES - 1) {
+        runs[started].pipe = &pipe;
+        runs[started].stage = started;
+        if (pthread_create(&threads[started], NULL, stage_thread, &runs[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    int ret_code = -1;
+    Backpatcher patcher;
+    if (started == PIPELINE_STAGES - 1) {
+        put_str(output, ".text\n");
+        init_backpatcher(&patcher, output);
+        pipe.patcher = &patcher;
+        run_stage(&pipe, PIPELINE_STAGES - 1);
+    } else {
+        // Stand in for the stages that did not start, passing batches straight
+        // back to the first, so that the ones that did run up to the last batch.
+        __atomic_store_n(&pipe.failed, 1, __ATOMIC_RELEASE);
+        Batch* batch = NULL;
+        while (started > 0 && !(batch && batch->last)) {
+            batch = take_batch(&pipe, started);
+            ring_push_wait(&pipe.rings[0], batch);
+        }
+    }
+    for (int k = 0; k < started; k++) {
+        pthread_join(threads[k], NULL);
+    }
+
+    int out_of_memory = started == PIPELINE_STAGES - 1 && pipe.failed;
+    if (started < PIPELINE_STAGES - 1) {
+        write_to_log("Error: unable to start pipeline thread\n");
+    } else if (out_of_memory) {
+        free_backpatcher(&patcher);
+    } else {
+        ret_code = pipe.ret_code;
+        if (finish_backpatcher(&patcher) != 0) {
+            ret_code = -1;
+        }
+    }
+    for (int i = 0; i < PIPELINE_BATCHES; i++) {
+        mem_free(batches[i].text);
+        free_program(&batches[i].prog);
+    }
+    mem_free(batches);
+    for (int k = 0; k < PIPELINE_STAGES; k++) {
+        free_ring(&pipe.rings[k]);
+    }
+    if (out_of_memory) {
+        allocation_failed();
+    }
+    if (started < PIPELINE_STAGES - 1) {
+        return -1;
+    }
+
+    put_str(output, "\n.symbol\n");
+    write_table_to(symtbl, output);
+
+    put_str(output, "\n.relocation\n");
+    write_table_to(reltbl, output);
+    return ret_code;
+}
+
+/* Reads a text intermediate file, as written by write_program_text(), back
+   into OUTPUT. Blank lines are kept as OP_NONE so that line numbers in pass two
+   errors still match the file.
+ */
+void read_intermediate(Reader* input, Program* output) {
+    const char* text;
+    size_t text_len;
+    uint32_t line = 0;
+    while (next_line(input, &text, &text_len)) {
+        line++;
+
+        Lexer lexer;
+        init_lexer(&lexer, text, text_len);
+        Token name;
+        if (!next_token(&lexer, &name)) {
+            add_inst(output)->op = OP_NONE;
+            continue;
+        }
+
+        int num_args = 0;
+        Token args[MAX_ARGS];
+        parse_args(&lexer, line, args, &num_args);
+        emit_inst(output, &name, args, num_args);
+    }
+}
+
+/* Returns an upper bound on the size of the object file for PROG, so that
+   the output can be preallocated. Every instruction takes at most one line
+   of 9 bytes, every symbol at most 11 bytes plus its name, and only jumps add
+   relocation entries.
+ */
+size_t estimate_object_size(const Program* prog, const SymbolTable* symtbl) {
+    size_t size = strlen(".text\n\n.symbol\n\n.relocation\n");
+    for (uint32_t i = 0; i < prog->len; i++) {
+        const Inst* inst = &prog->insts[i];
+        size += 9;
+        if (inst->op == OP_J || inst->op == OP_JAL) {
+            size += 11 + strlen(get_name(prog, inst->sym));
+        }
+    }
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        size += 11 + symbol_name_len(symtbl, i);
+    }
+    return size;
+}
+
+/* Runs pass two over the instructions in PROG and writes the complete object
+   file (.text, .symbol and .relocation sections) to DST, in the binary format
+   if OPTIONS has ASM_BINARY_OBJECT set.
+ */
+int write_object(const Program* prog, Writer* dst, SymbolTable* symtbl,
+    SymbolTable* reltbl, int options) {
+
+    int err = 0;
+    uint32_t* words = mem_alloc((prog->len + 1) * sizeof(uint32_t));
+    uint32_t num_words;
+    if (encode_program(prog, words, &num_words, symtbl, reltbl) != 0) {
+        err = 1;
+    }
+
+    if (options & ASM_BINARY_OBJECT) {
+        write_object_binary(dst, words, num_words, symtbl, reltbl);
+    } else {
+        write_object_text(dst, words, num_words, symtbl, reltbl, options & ASM_SIZE_HEADERS);
+    }
+    mem_free(words);
+    return err;
+}
+
+/*******************************
+ * Library Interface
+ *******************************/
+
+AsmContext* create_context(int options) {
+    AsmContext* ctx = calloc(1, sizeof(AsmContext));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->options = options;
+    ctx->jobs = 1;
+    init_arena(&ctx->arena, 0);
+    Arena* outer = use_arena(&ctx->arena);
+    init_program(&ctx->prog, 0);
+    use_arena(outer);
+    open_writer_mem(&ctx->log);
+    open_writer_mem(&ctx->output);
+    return ctx;
+}
+
+/* Empties what the last assembly in CTX left behind, keeping the memory of
+   the program and tables so that a context that is reused warms up.
+ */
+static void reset_context(AsmContext* ctx) {
+    reset_program(&ctx->prog);
+    if (ctx->symtbl) {
+        clear_table(ctx->symtbl);
+    }
+    if (ctx->reltbl) {
+        clear_table(ctx->reltbl);
+    }
+    close_writer(&ctx->output);
+    open_writer_mem(&ctx->output);
+}
+
+void free_context(AsmContext* ctx) {
+    if (!ctx) {
+        return;
+    }
+    // the program and tables are all in the arena
+    free_arena(&ctx->arena);
+    close_writer(&ctx->log);
+    close_writer(&ctx->output);
+    free(ctx);
+}
+
+int assemble_mem(AsmContext* ctx, const char* data, size_t size, char** out, size_t* out_len) {
+    reset_context(ctx);
+    ctx->log.len = 0;
+
+    // route everything that would be global through CTX for the duration
+    Writer* outer_log = capture_log(&ctx->log);
+    jmp_buf* outer_handler = on_allocation_failure(&ctx->on_oom);
+    Arena* outer_arena = use_arena(&ctx->arena);
+    int outer_jobs = num_jobs;
+    set_num_jobs(ctx->jobs);
+
+    int err;
+    if (setjmp(ctx->on_oom) == 0) {
+        if (!ctx->symtbl) {
+            ctx->symtbl = create_table(SYMTBL_UNIQUE_NAME);
+        }
+        if (!ctx->reltbl) {
+            ctx->reltbl = create_table(SYMTBL_NON_UNIQUE);
+        }
+        Reader src;
+        open_reader_mem(&src, data, size);
+        if (ctx->options & ASM_ONE_PASS) {
+            err = pass_stream(&src, &ctx->output, ctx->symtbl, ctx->reltbl) != 0;
+        } else {
+            err = pass_one(&src, &ctx->prog, ctx->symtbl) != 0;
+            if (write_object(&ctx->prog, &ctx->output, ctx->symtbl, ctx->reltbl,
+                ctx->options) != 0) {
+                err = 1;
+            }
+        }
+        close_reader(&src);
+
+        // leave room for the terminator of context_messages()
+        reserve_output(&ctx->log, 1);
+        *out = detach_writer(&ctx->output, out_len);
+        if (!*out) {
+            // an empty object file is still a buffer of its own
+            *out = malloc(1);
+            if (!*out) {
+                allocation_failed();
+            }
+        }
+        on_allocation_failure(outer_handler);
+    } else {
+        // the handler was cleared by allocation_failed()
+        on_allocation_failure(outer_handler);
+        close_writer(&ctx->output);
+        // whatever was half-built is dropped, so the next assembly starts clean
+        free_arena(&ctx->arena);
+        ctx->symtbl = NULL;
+        ctx->reltbl = NULL;
+        init_program(&ctx->prog, 0);
+        const char* msg = "Error: allocation failed\n";
+        ctx->log.len = ctx->log.cap > strlen(msg) ? strlen(msg) : 0;
+        memcpy(ctx->log.buf, msg, ctx->log.len);
+        *out = NULL;
+        *out_len = 0;
+        err = -1;
+    }
+
+    set_num_jobs(outer_jobs);
+    use_arena(outer_arena);
+    capture_log(outer_log);
+    return err;
+}
+
+const char* context_messages(const AsmContext* ctx, size_t* len) {
+    if (len) {
+        *len = ctx->log.len;
+    }
+    if (!ctx->log.buf) {
+        return "";
+    }
+    ctx->log.buf[ctx->log.len] = '\0';
+    return ctx->log.buf;
+}
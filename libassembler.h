@@ -0,0 +1,53 @@
+#ifndef LIBASSEMBLER_H
+#define LIBASSEMBLER_H
+
+#include <stddef.h>
+#include <setjmp.h>
+
+#include "assembler.h"
+#include "src/arena.h"
+
+/* Everything one assembly needs: its options, symbol tables, program,
+   messages and output, the arena they are allocated from, and where to go
+   when memory runs out. Nothing is shared between contexts, so any number of
+   them may assemble at once on different threads. A context may be reused
+   for further assemblies, one at a time; each starts from scratch, but keeps
+   the memory the last one grew, so a reused context allocates little.
+ */
+typedef struct {
+    int options;            // AsmOption flags, ASM_PIPELINE is ignored
+    int jobs;               // threads per assembly, see set_num_jobs()
+    SymbolTable* symtbl;    // labels of the last assembly
+    SymbolTable* reltbl;    // relocations of the last assembly
+    Program prog;
+    Writer log;             // messages of the last assembly
+    Writer output;
+    Arena arena;            // of the program and tables
+    jmp_buf on_oom;
+} AsmContext;
+
+/* Creates a context that assembles with OPTIONS. Returns NULL if out of
+   memory.
+ */
+AsmContext* create_context(int options);
+
+void free_context(AsmContext* ctx);
+
+/* Assembles the SIZE bytes at DATA into an object file, the same as the
+   assembler binary would from a file, and stores it in *OUT, which the caller
+   must free, and its length in *OUT_LEN. Messages do not go to the log; they
+   are kept in CTX, see context_messages().
+
+   Returns 0 on success and 1 if the source has errors, in which case the
+   object file is still produced. Returns -1, with *OUT set to NULL, if memory
+   ran out, on the calling thread or on any of its job threads; the context
+   can still be used or freed afterwards.
+ */
+int assemble_mem(AsmContext* ctx, const char* data, size_t size, char** out, size_t* out_len);
+
+/* Returns the messages of the last assembly, NUL-terminated, and stores
+   their length in *LEN if LEN is not NULL.
+ */
+const char* context_messages(const AsmContext* ctx, size_t* len);
+
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "arena.h"
+
+#define MIN_CLASS_SIZE 16
+#define LARGE_CLASS ARENA_CLASSES
+
+/* Chunks start at MIN_CHUNK_SIZE, so that a small session stays small, and
+   double up to MAX_CHUNK_SIZE.
+ */
+#define MIN_CHUNK_SIZE (64 << 10)
+#define MAX_CHUNK_SIZE (4 << 20)
+
+/* Precedes every block. Its size keeps the block 16-byte aligned. */
+typedef struct {
+    Arena* arena;           // NULL if from malloc() outside any arena
+    uint32_t size_class;    // LARGE_CLASS for blocks from malloc()
+    uint32_t unused;
+} BlockHeader;
+
+/* Precedes the header of a block from malloc(). */
+struct ArenaLarge {
+    ArenaLarge* prev;
+    ArenaLarge* next;
+    size_t size;            // of the block, without the headers
+    size_t unused;
+};
+
+/* Overlays a small block while it is on a free list. */
+struct ArenaFree {
+    ArenaFree* next;
+};
+
+/* The arena that the calling thread allocates from, if any. */
+static __thread Arena* current_arena = NULL;
+
+void init_arena(Arena* arena, size_t limit) {
+    memset(arena, 0, sizeof(Arena));
+    arena->limit = limit;
+}
+
+void free_arena(Arena* arena) {
+    while (arena->children) {
+        free_arena(arena->children);
+    }
+    Arena* parent = arena->parent;
+    if (parent) {
+        // the work of a sub-arena is counted as the session's
+        parent->num_allocs += arena->num_allocs;
+        parent->num_mallocs += arena->num_mallocs;
+        if (parent->used + arena->peak > parent->peak) {
+            parent->peak = parent->used + arena->peak;
+        }
+        if (arena->prev_child) {
+            arena->prev_child->next_child = arena->next_child;
+        } else {
+            parent->children = arena->next_child;
+        }
+        if (arena->next_child) {
+            arena->next_child->prev_child = arena->prev_child;
+        }
+    }
+
+    ArenaLarge* large = arena->large;
+    while (large) {
+        ArenaLarge* next = large->next;
+        free(large);
+        large = next;
+    }
+    for (uint32_t i = 0; i < arena->num_chunks; i++) {
+        free(arena->chunks[i]);
+    }
+    free(arena->chunks);
+    init_arena(arena, arena->limit);
+}
+
+void init_sub_arena(Arena* arena) {
+    Arena* parent = current_arena;
+    init_arena(arena, parent ? parent->limit : 0);
+    if (parent) {
+        arena->parent = parent;
+        arena->next_child = parent->children;
+        if (parent->children) {
+            parent->children->prev_child = arena;
+        }
+        parent->children = arena;
+    }
+}
+
+Arena* use_arena(Arena* arena) {
+    Arena* previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+/* Counts SIZE more bytes as used by ARENA, or fails if that is past its
+   limit.
+ */
+static void count_used(Arena* arena, size_t size) {
+    if (arena->limit && (size > arena->limit || arena->used > arena->limit - size)) {
+        allocation_failed();
+    }
+    arena->used += size;
+    arena->peak = arena->used > arena->peak ? arena->used : arena->peak;
+}
+
+static size_t class_size(uint32_t size_class) {
+    return (size_t) MIN_CLASS_SIZE << size_class;
+}
+
+static uint32_t size_class(size_t size) {
+    uint32_t c = 0;
+    while (c < LARGE_CLASS && class_size(c) < size) {
+        c++;
+    }
+    return c;
+}
+
+/* Returns a block of SIZE bytes from malloc(), tracked by ARENA if it is not
+   NULL.
+ */
+static void* alloc_large(Arena* arena, size_t size) {
+    size_t total = sizeof(ArenaLarge) + sizeof(BlockHeader) + size;
+    if (total < size) {
+        allocation_failed();
+    }
+    if (arena) {
+        count_used(arena, total);
+        arena->num_mallocs++;
+    }
+    ArenaLarge* large = malloc(total);
+    if (!large) {
+        allocation_failed();
+    }
+    large->size = size;
+    BlockHeader* header = (BlockHeader*) (large + 1);
+    header->arena = arena;
+    header->size_class = LARGE_CLASS;
+    if (arena) {
+        large->prev = NULL;
+        large->next = arena->large;
+        if (arena->large) {
+            arena->large->prev = large;
+        }
+        arena->large = large;
+    }
+    return header + 1;
+}
+
+/* Starts a new chunk of ARENA with room for at least NEED bytes. What is
+   left of the last one is abandoned.
+ */
+static void new_chunk(Arena* arena, size_t need) {
+    size_t size = (size_t) MIN_CHUNK_SIZE << (arena->num_chunks < 6 ? arena->num_chunks : 6);
+    size = size < MAX_CHUNK_SIZE ? size : MAX_CHUNK_SIZE;
+    size = size < need ? need : size;
+    count_used(arena, size);
+    if (arena->num_chunks == arena->chunks_cap) {
+        arena->chunks_cap = arena->chunks_cap ? 2 * arena->chunks_cap : 16;
+        arena->chunks = realloc(arena->chunks, arena->chunks_cap * sizeof(char*));
+        arena->num_mallocs++;
+        if (!arena->chunks) {
+            allocation_failed();
+        }
+    }
+    arena->free = malloc(size);
+    arena->num_mallocs++;
+    if (!arena->free) {
+        allocation_failed();
+    }
+    arena->chunks[arena->num_chunks++] = arena->free;
+    arena->free_len = size;
+}
+
+/* Returns a block of size class SIZE_CLASS from ARENA. */
+static void* alloc_small(Arena* arena, uint32_t size_class) {
+    ArenaFree* reused = arena->free_lists[size_class];
+    if (reused) {
+        arena->free_lists[size_class] = reused->next;
+        return reused;
+    }
+    size_t need = sizeof(BlockHeader) + class_size(size_class);
+    if (arena->free_len < need) {
+        new_chunk(arena, need);
+    }
+    BlockHeader* header = (BlockHeader*) arena->free;
+    arena->free += need;
+    arena->free_len -= need;
+    header->arena = arena;
+    header->size_class = size_class;
+    return header + 1;
+}
+
+void* mem_alloc(size_t size) {
+    Arena* arena = current_arena;
+    if (!arena) {
+        return alloc_large(NULL, size);
+    }
+    arena->num_allocs++;
+    uint32_t c = size_class(size);
+    return c < LARGE_CLASS ? alloc_small(arena, c) : alloc_large(arena, size);
+}
+
+void* mem_calloc(size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        allocation_failed();
+    }
+    void* ptr = mem_alloc(count * size);
+    memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size) {
+    if (!ptr) {
+        return mem_alloc(size);
+    }
+    BlockHeader* header = (BlockHeader*) ptr - 1;
+    Arena* arena = header->arena;
+    size_t old_size;
+    if (header->size_class < LARGE_CLASS) {
+        old_size = class_size(header->size_class);
+        if (size <= old_size) {
+            return ptr;
+        }
+    } else {
+        ArenaLarge* large = (ArenaLarge*) header - 1;
+        old_size = large->size;
+        if (!arena || arena == current_arena) {
+            // grown by realloc(), and put back where it was in the list
+            size_t total = sizeof(ArenaLarge) + sizeof(BlockHeader) + size;
+            if (total < size) {
+                allocation_failed();
+            }
+            if (arena) {
+                if (size > old_size) {
+                    count_used(arena, size - old_size);
+                } else {
+                    arena->used -= old_size - size;
+                }
+                arena->num_allocs++;
+                arena->num_mallocs++;
+            }
+            ArenaLarge* moved = realloc(large, total);
+            if (!moved) {
+                allocation_failed();
+            }
+            moved->size = size;
+            if (arena) {
+                if (moved->prev) {
+                    moved->prev->next = moved;
+                } else {
+                    arena->large = moved;
+                }
+                if (moved->next) {
+                    moved->next->prev = moved;
+                }
+            }
+            return (BlockHeader*) (moved + 1) + 1;
+        }
+    }
+
+    // the block belongs to an arena that this thread must not change
+    void* copy = mem_alloc(size);
+    memcpy(copy, ptr, old_size < size ? old_size : size);
+    mem_free(ptr);
+    return copy;
+}
+
+void mem_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    BlockHeader* header = (BlockHeader*) ptr - 1;
+    Arena* arena = header->arena;
+    if (arena && arena != current_arena) {
+        // left to free_arena()
+        return;
+    }
+    if (header->size_class < LARGE_CLASS) {
+        ArenaFree* block = ptr;
+        block->next = arena->free_lists[header->size_class];
+        arena->free_lists[header->size_class] = block;
+        return;
+    }
+
+    ArenaLarge* large = (ArenaLarge*) header - 1;
+    if (arena) {
+        if (large->prev) {
+            large->prev->next = large->next;
+        } else {
+            arena->large = large->next;
+        }
+        if (large->next) {
+            large->next->prev = large->prev;
+        }
+        arena->used -= sizeof(ArenaLarge) + sizeof(BlockHeader) + large->size;
+    }
+    free(large);
+}
+
+void print_arena_stats(const Arena* arena, FILE* output) {
+    fprintf(output, "Memory: %llu blocks, %llu calls to malloc, %zu bytes at peak\n",
+        (unsigned long long) arena->num_allocs, (unsigned long long) arena->num_mallocs,
+        arena->peak);
+}
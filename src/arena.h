@@ -0,0 +1,86 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Size classes of small blocks: 16 bytes, 32, and so on up to 32 KB. */
+#define ARENA_CLASSES 12
+
+typedef struct ArenaFree ArenaFree;
+typedef struct ArenaLarge ArenaLarge;
+
+/* The memory of one assembly session, released all at once by
+   free_arena().
+
+   Small blocks are rounded up to a power-of-two size class and carved from
+   large chunks; a freed one goes on the free list of its class for the next
+   block of that size. Larger blocks come from malloc(), so that growing
+   arrays can still be realloc()ed in place, but are tracked by the arena.
+
+   An arena may have sub-arenas, for threads that work for the session but
+   cannot share its arena; freeing the arena frees them as well.
+ */
+typedef struct Arena {
+    char** chunks;
+    uint32_t num_chunks;
+    uint32_t chunks_cap;
+    char* free;                 // unused space in the last chunk
+    size_t free_len;
+    ArenaFree* free_lists[ARENA_CLASSES];
+    ArenaLarge* large;          // list of the large blocks
+    struct Arena* parent;
+    struct Arena* children;     // list of the sub-arenas
+    struct Arena* prev_child;
+    struct Arena* next_child;
+
+    size_t limit;               // on USED, or 0 for none
+    size_t used;                // bytes in chunks and large blocks
+    size_t peak;                // highest USED
+    uint64_t num_allocs;        // blocks asked for
+    uint64_t num_mallocs;       // calls to malloc() and realloc()
+} Arena;
+
+/* Creates ARENA. Once it holds LIMIT bytes, unless LIMIT is 0, allocating
+   more calls allocation_failed(), as running out of memory does.
+ */
+void init_arena(Arena* arena, size_t limit);
+
+/* Releases every block of ARENA, freed or not, and its sub-arenas. */
+void free_arena(Arena* arena);
+
+/* Creates ARENA as a sub-arena of the arena of the calling thread, if it has
+   one, with the same limit. Until ARENA is freed, freeing that arena frees
+   ARENA too, so nothing allocated from ARENA can outlive the session.
+ */
+void init_sub_arena(Arena* arena);
+
+/* Makes mem_alloc() and the functions below allocate from ARENA on the
+   calling thread, or from malloc() if ARENA is NULL. Returns the arena that
+   was used before, so that it can be put back.
+ */
+Arena* use_arena(Arena* arena);
+
+/* The allocator of symbol tables, string pools and programs. Blocks come
+   from the arena of the calling thread, if it has one. Running out of memory
+   calls allocation_failed(), so these never return NULL.
+
+   A block may be freed or reallocated on any thread. Only the thread using
+   its arena gives it back to the arena; elsewhere, freeing a block of an
+   arena leaves it to free_arena(), and reallocating one copies it out.
+   Blocks allocated outside any arena are plain malloc() blocks wherever they
+   are freed.
+ */
+void* mem_alloc(size_t size);
+
+void* mem_calloc(size_t count, size_t size);
+
+void* mem_realloc(void* ptr, size_t size);
+
+void mem_free(void* ptr);
+
+/* Writes the allocation counts and peak size of ARENA to OUTPUT. */
+void print_arena_stats(const Arena* arena, FILE* output);
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate.h"
+#include "translate_utils.h"
+#include "backpatch.h"
+#include "hash.h"
+#include "arena.h"
+
+#define INITIAL_SIZE 64
+#define SCALING_FACTOR 2
+
+void init_backpatcher(Backpatcher* patcher, Writer* output) {
+    memset(patcher, 0, sizeof(Backpatcher));
+    patcher->output = output;
+    patcher->text_start = writer_size(output);
+    patcher->in_place = output->backend == WRITER_MMAP || output->backend == WRITER_MEM;
+}
+
+/* Grows the array at *PTR of *CAP elements of SIZE bytes by SCALING_FACTOR. */
+static void grow(void** ptr, uint32_t* cap, size_t size) {
+    uint32_t new_cap = *cap ? *cap * SCALING_FACTOR : INITIAL_SIZE;
+    *ptr = mem_realloc(*ptr, (size_t) new_cap * size);
+    *cap = new_cap;
+}
+
+void emit_word(Backpatcher* patcher, uint32_t word) {
+    if (patcher->in_place || patcher->num_unresolved == 0) {
+        write_inst_hex(patcher->output, word);
+    } else {
+        if (patcher->held_len == 0) {
+            patcher->held_start = patcher->num_words;
+        }
+        if (patcher->held_len == patcher->held_cap) {
+            grow((void**) &patcher->held, &patcher->held_cap, sizeof(uint32_t));
+        }
+        patcher->held[patcher->held_len++] = word;
+    }
+    patcher->num_words++;
+}
+
+/* Replaces the word at INDEX, wherever it currently is. */
+static void patch_word(Backpatcher* patcher, uint32_t index, uint32_t word) {
+    if (patcher->in_place) {
+        format_hex32(patcher->output->buf + patcher->text_start + (size_t) index * HEX_LINE_SIZE,
+            word);
+    } else {
+        patcher->held[index - patcher->held_start] = word;
+    }
+}
+
+/* Writes the held words that no longer wait on an unresolved branch. */
+static void release_words(Backpatcher* patcher) {
+    uint32_t limit = patcher->num_words;
+    if (patcher->fixups_head < patcher->fixups_len) {
+        limit = patcher->fixups[patcher->fixups_head].word;
+    }
+    if (patcher->held_len == 0 || limit <= patcher->held_start) {
+        return;
+    }
+
+    uint32_t n = limit - patcher->held_start;
+    write_insts_hex(patcher->output, patcher->held, n);
+    memmove(patcher->held, patcher->held + n, (patcher->held_len - n) * sizeof(uint32_t));
+    patcher->held_len -= n;
+    patcher->held_start = limit;
+}
+
+/* Returns the slot of NAME in the label table, or of the empty slot where it
+   would go.
+ */
+static uint32_t find_label(const Backpatcher* patcher, const char* name, size_t len,
+    uint32_t hash) {
+    uint32_t mask = patcher->labels_cap - 1;
+    uint32_t slot = hash & mask;
+    while (patcher->labels[slot].name) {
+        const PendingLabel* label = &patcher->labels[slot];
+        if (label->hash == hash && strncmp(label->name, name, len) == 0
+            && label->name[len] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Rebuilds the label table with room for twice as many labels. */
+static void grow_labels(Backpatcher* patcher) {
+    PendingLabel* old = patcher->labels;
+    uint32_t old_cap = patcher->labels_cap;
+    patcher->labels_cap = old_cap ? old_cap * SCALING_FACTOR : INITIAL_SIZE;
+    patcher->labels = mem_calloc(patcher->labels_cap, sizeof(PendingLabel));
+
+    uint32_t mask = patcher->labels_cap - 1;
+    for (uint32_t i = 0; i < old_cap; i++) {
+        if (old[i].name) {
+            uint32_t slot = old[i].hash & mask;
+            while (patcher->labels[slot].name) {
+                slot = (slot + 1) & mask;
+            }
+            patcher->labels[slot] = old[i];
+        }
+    }
+    mem_free(old);
+}
+
+/* Removes the label in SLOT, moving later entries of its probe sequence back
+   so that no tombstones are needed.
+ */
+static void remove_label(Backpatcher* patcher, uint32_t slot) {
+    uint32_t mask = patcher->labels_cap - 1;
+    mem_free(patcher->labels[slot].name);
+    patcher->labels[slot].name = NULL;
+    patcher->num_labels--;
+
+    uint32_t next = (slot + 1) & mask;
+    while (patcher->labels[next].name) {
+        uint32_t home = patcher->labels[next].hash & mask;
+        // move the entry if SLOT lies between its home and where it is now
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            patcher->labels[slot] = patcher->labels[next];
+            patcher->labels[next].name = NULL;
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+void emit_forward_branch(Backpatcher* patcher, const Inst* inst, uint32_t addr,
+    const char* name, size_t len, uint32_t line) {
+    if (2 * (patcher->num_labels + 1) > patcher->labels_cap) {
+        grow_labels(patcher);
+    }
+    uint32_t hash = hash_name(name, len);
+    uint32_t slot = find_label(patcher, name, len, hash);
+    PendingLabel* label = &patcher->labels[slot];
+    if (!label->name) {
+        label->name = mem_alloc(len + 1);
+        memcpy(label->name, name, len);
+        label->name[len] = '\0';
+        label->hash = hash;
+        label->head = NO_FIXUP;
+        patcher->num_labels++;
+    }
+
+    // resolved fixups at the front are dropped before growing the array
+    if (patcher->fixups_len == patcher->fixups_cap) {
+        uint32_t head = patcher->fixups_head;
+        if (head > 0) {
+            memmove(patcher->fixups, patcher->fixups + head,
+                (patcher->fixups_len - head) * sizeof(Fixup));
+            patcher->fixups_start += head;
+            patcher->fixups_len -= head;
+            patcher->fixups_head = 0;
+        } else {
+            grow((void**) &patcher->fixups, &patcher->fixups_cap, sizeof(Fixup));
+        }
+    }
+    Fixup* fixup = &patcher->fixups[patcher->fixups_len];
+    fixup->inst = *inst;
+    fixup->addr = addr;
+    fixup->word = patcher->num_words;
+    fixup->line = line;
+    fixup->next = label->head;
+    fixup->resolved = 0;
+    fixup->name = label->name;
+    label->head = patcher->fixups_start + patcher->fixups_len;
+    patcher->fixups_len++;
+    patcher->num_unresolved++;
+
+    // the offset is filled in once the label is defined
+    emit_word(patcher, encode_branch(inst, addr, addr + 4));
+}
+
+void resolve_label(Backpatcher* patcher, const char* name, size_t len, uint32_t label_addr) {
+    if (patcher->num_labels == 0) {
+        return;
+    }
+    uint32_t slot = find_label(patcher, name, len, hash_name(name, len));
+    if (!patcher->labels[slot].name) {
+        return;
+    }
+
+    for (uint32_t n = patcher->labels[slot].head; n != NO_FIXUP; ) {
+        Fixup* fixup = &patcher->fixups[n - patcher->fixups_start];
+        patch_word(patcher, fixup->word, encode_branch(&fixup->inst, fixup->addr, label_addr));
+        fixup->resolved = 1;
+        fixup->name = NULL;
+        patcher->num_unresolved--;
+        n = fixup->next;
+    }
+    remove_label(patcher, slot);
+
+    while (patcher->fixups_head < patcher->fixups_len
+        && patcher->fixups[patcher->fixups_head].resolved) {
+        patcher->fixups_head++;
+    }
+    release_words(patcher);
+}
+
+int finish_backpatcher(Backpatcher* patcher) {
+    int count = 0;
+    for (uint32_t i = patcher->fixups_head; i < patcher->fixups_len; i++) {
+        const Fixup* fixup = &patcher->fixups[i];
+        if (!fixup->resolved) {
+            write_to_log("Error - undefined label at line %u: %s\n", fixup->line, fixup->name);
+            count++;
+        }
+    }
+    write_insts_hex(patcher->output, patcher->held, patcher->held_len);
+    free_backpatcher(patcher);
+    return count;
+}
+
+void free_backpatcher(Backpatcher* patcher) {
+    for (uint32_t i = 0; i < patcher->labels_cap; i++) {
+        mem_free(patcher->labels[i].name);
+    }
+    mem_free(patcher->labels);
+    mem_free(patcher->fixups);
+    mem_free(patcher->held);
+    memset(patcher, 0, sizeof(Backpatcher));
+}
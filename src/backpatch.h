@@ -0,0 +1,85 @@
+#ifndef BACKPATCH_H
+#define BACKPATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ir.h"
+#include "writer.h"
+
+/* A branch whose label had not been defined yet when it was encoded. */
+typedef struct {
+    Inst inst;
+    uint32_t addr;          // address of the branch
+    uint32_t word;          // index of its word in .text
+    uint32_t line;          // input line, for errors
+    uint32_t next;          // next fixup for the same label, or NO_FIXUP
+    int resolved;
+    const char* name;       // owned by the PendingLabel until resolved
+} Fixup;
+
+#define NO_FIXUP UINT32_MAX
+
+/* A label that branches are waiting on, with the list of those branches. */
+typedef struct {
+    char* name;             // NULL if the slot is empty
+    uint32_t hash;
+    uint32_t head;          // most recent fixup, as a fixup number
+} PendingLabel;
+
+/* Writes .text words as they are produced and patches forward branches once
+   their label is defined. If the output is in memory (a mapped file, or a
+   memory writer) words are written right away and patched in place.
+   Otherwise, words from the oldest unresolved branch on are held back until
+   that branch is patched, so memory use depends on how far branches reach
+   forward rather than on the size of the program.
+ */
+typedef struct {
+    Writer* output;
+    size_t text_start;      // offset of the first word in OUTPUT
+    int in_place;
+    uint32_t num_words;
+
+    uint32_t* held;         // words not yet written, starting at HELD_START
+    uint32_t held_start;
+    uint32_t held_len;
+    uint32_t held_cap;
+
+    Fixup* fixups;          // fixup number FIXUPS_START + i is FIXUPS[i]
+    uint32_t fixups_start;
+    uint32_t fixups_head;   // FIXUPS[i] for i < FIXUPS_HEAD are resolved
+    uint32_t fixups_len;
+    uint32_t fixups_cap;
+    uint32_t num_unresolved;
+
+    PendingLabel* labels;   // open addressing hash table
+    uint32_t labels_cap;
+    uint32_t num_labels;
+} Backpatcher;
+
+/* Starts writing words to OUTPUT at its current end. */
+void init_backpatcher(Backpatcher* patcher, Writer* output);
+
+/* Appends the encoded instruction WORD. */
+void emit_word(Backpatcher* patcher, uint32_t word);
+
+/* Appends the branch INST at ADDR, to the label NAME of length LEN that has
+   not been defined yet. LINE is the input line of the branch.
+ */
+void emit_forward_branch(Backpatcher* patcher, const Inst* inst, uint32_t addr,
+    const char* name, size_t len, uint32_t line);
+
+/* Defines the label NAME of length LEN at LABEL_ADDR, and patches every
+   branch waiting on it.
+ */
+void resolve_label(Backpatcher* patcher, const char* name, size_t len, uint32_t label_addr);
+
+/* Writes all remaining words, reports every branch whose label was never
+   defined, and frees PATCHER. Returns the number of such branches.
+ */
+int finish_backpatcher(Backpatcher* patcher);
+
+/* Frees PATCHER without writing or reporting anything. */
+void free_backpatcher(Backpatcher* patcher);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "writer.h"
+#include "bulkio.h"
+
+#define RING_ENTRIES 64
+
+/* What the user data of a completion refers to. */
+#define OP_INPUT 0ULL
+#define OP_OUTPUT 1ULL
+#define OP_CLOSE 2ULL
+
+static uint64_t user_data(uint64_t kind, uint32_t i) {
+    return kind << 32 | i;
+}
+
+void open_bulk_io(BulkIO* io, char* const* in_names, const uint32_t* order, uint32_t num_inputs,
+    BulkBackend backend) {
+    memset(io, 0, sizeof(BulkIO));
+    io->inputs = calloc(num_inputs + 1, sizeof(BulkFile));
+    io->outputs = calloc(num_inputs + 1, sizeof(BulkFile));
+    if (!io->inputs || !io->outputs) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < num_inputs; i++) {
+        io->inputs[i].name = in_names[i];
+        io->inputs[i].fd = io->outputs[i].fd = -1;
+        io->inputs[i].slot = io->outputs[i].slot = -1;
+    }
+    io->num_inputs = io->num_outputs = num_inputs;
+    io->order = order;
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->changed, NULL);
+
+    io->backend = backend;
+    if (backend == BULK_URING && open_uring(&io->ring, RING_ENTRIES) != 0) {
+        io->backend = BULK_PREAD;
+    }
+    if (io->backend != BULK_URING) {
+        return;
+    }
+
+    // small inputs are read into registered buffers, which saves mapping
+    // their pages for every read
+    io->slots = mmap(NULL, (size_t) BULK_SLOTS * BULK_SLOT_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (io->slots == MAP_FAILED) {
+        io->slots = NULL;
+        return;
+    }
+    struct iovec iovecs[BULK_SLOTS];
+    for (int k = 0; k < BULK_SLOTS; k++) {
+        iovecs[k].iov_base = io->slots + (size_t) k * BULK_SLOT_SIZE;
+        iovecs[k].iov_len = BULK_SLOT_SIZE;
+        io->free_slots[k] = BULK_SLOTS - 1 - k;
+    }
+    if (uring_register_buffers(&io->ring, iovecs, BULK_SLOTS) != 0) {
+        munmap(io->slots, (size_t) BULK_SLOTS * BULK_SLOT_SIZE);
+        io->slots = NULL;
+        return;
+    }
+    io->num_free_slots = BULK_SLOTS;
+}
+
+/* Reads or writes all of FILE with pread() or pwrite(). */
+static int transfer_sync(BulkFile* file, int writing) {
+    while (file->done < file->size) {
+        ssize_t n = writing
+            ? pwrite(file->fd, file->data + file->done, file->size - file->done, file->done)
+            : pread(file->fd, file->data + file->done, file->size - file->done, file->done);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            // the input got shorter since it was measured
+            file->size = file->done;
+        }
+        file->done += n;
+    }
+    return 0;
+}
+
+/* Sizes FILE, which has just been opened, and gives it a buffer. */
+static int prepare_input(BulkIO* io, BulkFile* file) {
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) {
+        return -1;
+    }
+    file->size = st.st_size;
+    file->done = 0;
+    if (file->size <= BULK_SLOT_SIZE && io->num_free_slots > 0) {
+        file->slot = io->free_slots[--io->num_free_slots];
+        file->data = io->slots + (size_t) file->slot * BULK_SLOT_SIZE;
+    } else {
+        file->data = malloc(file->size + 1);
+        if (!file->data) {
+            allocation_failed();
+        }
+    }
+    return 0;
+}
+
+static void free_input(BulkIO* io, BulkFile* file) {
+    if (file->slot >= 0) {
+        io->free_slots[io->num_free_slots++] = file->slot;
+    } else {
+        free(file->data);
+    }
+    file->data = NULL;
+    file->slot = -1;
+}
+
+/* Queues an operation on input or output I. The caller holds the lock and
+   has made sure there is room in the ring.
+ */
+static struct io_uring_sqe* queue_op(BulkIO* io, uint64_t kind, uint32_t i, int opcode) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&io->ring);
+    sqe->opcode = opcode;
+    sqe->user_data = user_data(kind, i);
+    io->in_flight++;
+    return sqe;
+}
+
+static void queue_open(BulkIO* io, uint64_t kind, uint32_t i) {
+    BulkFile* file = kind == OP_INPUT ? &io->inputs[i] : &io->outputs[i];
+    struct io_uring_sqe* sqe = queue_op(io, kind, i, IORING_OP_OPENAT);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t) file->name;
+    sqe->open_flags = kind == OP_INPUT ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->len = 0644;
+    file->state = BULK_OPENING;
+}
+
+/* Queues a read or write of the rest of input or output I. */
+static void queue_transfer(BulkIO* io, uint64_t kind, uint32_t i) {
+    BulkFile* file = kind == OP_INPUT ? &io->inputs[i] : &io->outputs[i];
+    int opcode = kind == OP_OUTPUT ? IORING_OP_WRITE
+        : file->slot >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    struct io_uring_sqe* sqe = queue_op(io, kind, i, opcode);
+    sqe->fd = file->fd;
+    sqe->addr = (uintptr_t) (file->data + file->done);
+    sqe->len = file->size - file->done;
+    sqe->off = file->done;
+    if (opcode == IORING_OP_READ_FIXED) {
+        sqe->buf_index = file->slot;
+    }
+    file->state = BULK_READING;
+}
+
+/* Queues closing input or output I. Inputs are done as soon as they are
+   read, so nothing waits for theirs.
+ */
+static void queue_close(BulkIO* io, uint64_t kind, uint32_t i) {
+    BulkFile* file = kind == OP_INPUT ? &io->inputs[i] : &io->outputs[i];
+    struct io_uring_sqe* sqe = queue_op(io, kind == OP_INPUT ? OP_CLOSE : kind, i, IORING_OP_CLOSE);
+    sqe->fd = file->fd;
+    file->fd = -1;
+    file->state = kind == OP_INPUT ? BULK_DONE : BULK_CLOSING;
+}
+
+static void fail(BulkIO* io, uint64_t kind, BulkFile* file) {
+    if (file->fd >= 0) {
+        close(file->fd);
+        file->fd = -1;
+    }
+    if (kind == OP_INPUT) {
+        free_input(io, file);
+    } else {
+        free(file->data);
+        file->data = NULL;
+    }
+    file->state = BULK_FAILED;
+}
+
+/* Handles the completion, with result RES, of an operation on input or
+   output I, and queues the next one. Each completion queues at most one
+   operation, so this never needs more room in the ring than it frees.
+ */
+static void complete(BulkIO* io, uint64_t kind, uint32_t i, int res) {
+    io->in_flight--;
+    if (kind == OP_CLOSE) {
+        return;
+    }
+    BulkFile* file = kind == OP_INPUT ? &io->inputs[i] : &io->outputs[i];
+    if (res < 0 || (kind == OP_OUTPUT && file->state == BULK_READING && res == 0)) {
+        fail(io, kind, file);
+        return;
+    }
+
+    switch (file->state) {
+        case BULK_OPENING:
+            file->fd = res;
+            if (kind == OP_INPUT && prepare_input(io, file) != 0) {
+                fail(io, kind, file);
+                return;
+            }
+            break;
+        case BULK_READING:
+            if (res == 0) {
+                // the input got shorter since it was measured
+                file->size = file->done;
+            }
+            file->done += res;
+            break;
+        default:
+            // an output has been closed
+            free(file->data);
+            file->data = NULL;
+            file->state = BULK_DONE;
+            return;
+    }
+    if (file->done < file->size) {
+        queue_transfer(io, kind, i);
+    } else {
+        queue_close(io, kind, i);
+    }
+}
+
+/* Starts reading input I if it has not been started. Returns 0 if there was
+   no room in the ring.
+ */
+static int start_input(BulkIO* io, uint32_t i) {
+    if (io->inputs[i].state != BULK_IDLE) {
+        return 1;
+    }
+    if (io->in_flight >= RING_ENTRIES) {
+        return 0;
+    }
+    io->ahead++;
+    queue_open(io, OP_INPUT, i);
+    return 1;
+}
+
+/* Queues whatever there is room for, then waits for and handles at least one
+   completion. Called with the lock held, which is dropped while waiting.
+ */
+static void pump(BulkIO* io) {
+    while (io->next < io->num_inputs && io->ahead < BULK_SLOTS
+        && start_input(io, io->order[io->next])) {
+        io->next++;
+    }
+    for (uint32_t i = 0; i < io->num_outputs && io->in_flight < RING_ENTRIES; i++) {
+        if (io->outputs[i].state == BULK_IDLE && io->outputs[i].data) {
+            queue_open(io, OP_OUTPUT, i);
+        }
+    }
+    if (io->in_flight == 0) {
+        return;
+    }
+
+    int err = uring_submit(&io->ring, 0);
+    io->reaping = 1;
+    pthread_mutex_unlock(&io->lock);
+    err |= uring_wait(&io->ring, 1);
+    pthread_mutex_lock(&io->lock);
+    io->reaping = 0;
+
+    struct io_uring_cqe cqe;
+    while (uring_next_cqe(&io->ring, &cqe)) {
+        complete(io, cqe.user_data >> 32, (uint32_t) cqe.user_data, cqe.res);
+    }
+    if (err != 0) {
+        write_to_log("Error: io_uring failed\n");
+        exit(1);
+    }
+    pthread_cond_broadcast(&io->changed);
+}
+
+/* Waits until DONE(IO) is true, reaping completions if no one else is. */
+#define WAIT_UNTIL(io, done) \
+    while (!(done)) { \
+        if ((io)->reaping) { \
+            pthread_cond_wait(&(io)->changed, &(io)->lock); \
+        } else { \
+            pump(io); \
+        } \
+    }
+
+int bulk_read(BulkIO* io, uint32_t i, const char** data, size_t* size) {
+    BulkFile* file = &io->inputs[i];
+    if (io->backend == BULK_PREAD) {
+        file->fd = open(file->name, O_RDONLY);
+        if (file->fd < 0 || prepare_input(io, file) != 0 || transfer_sync(file, 0) != 0) {
+            if (file->fd >= 0) {
+                close(file->fd);
+            }
+            free_input(io, file);
+            return -1;
+        }
+        close(file->fd);
+        *data = file->data;
+        *size = file->size;
+        return 0;
+    }
+
+    pthread_mutex_lock(&io->lock);
+    while (!start_input(io, i)) {
+        pump(io);
+    }
+    WAIT_UNTIL(io, file->state == BULK_DONE || file->state == BULK_FAILED);
+    int ret = file->state == BULK_FAILED ? -1 : 0;
+    *data = file->data;
+    *size = file->size;
+    if (ret != 0) {
+        io->ahead--;
+    }
+    pthread_mutex_unlock(&io->lock);
+    return ret;
+}
+
+void bulk_release(BulkIO* io, uint32_t i) {
+    pthread_mutex_lock(&io->lock);
+    free_input(io, &io->inputs[i]);
+    if (io->backend == BULK_URING) {
+        io->ahead--;
+    }
+    pthread_mutex_unlock(&io->lock);
+}
+
+void bulk_write(BulkIO* io, uint32_t i, const char* out_name, char* data, size_t size) {
+    BulkFile* file = &io->outputs[i];
+    // outputs are opened with O_TRUNC, which would reach into the cache
+    unlink_if_cached(out_name);
+    file->name = out_name;
+    file->size = size;
+    file->done = 0;
+    if (io->backend == BULK_PREAD) {
+        file->data = data;
+        file->fd = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = file->fd < 0 || transfer_sync(file, 1) != 0;
+        if (file->fd >= 0 && close(file->fd) != 0) {
+            err = 1;
+        }
+        file->state = err ? BULK_FAILED : BULK_DONE;
+        free(data);
+        file->data = NULL;
+        return;
+    }
+
+    pthread_mutex_lock(&io->lock);
+    file->data = data;
+    file->state = BULK_IDLE;
+    if (io->in_flight < RING_ENTRIES) {
+        queue_open(io, OP_OUTPUT, i);
+        uring_submit(&io->ring, 0);
+    }
+    pthread_mutex_unlock(&io->lock);
+}
+
+/* Returns 1 once no output is still being written. */
+static int outputs_done(BulkIO* io) {
+    for (uint32_t i = 0; i < io->num_outputs; i++) {
+        BulkState state = io->outputs[i].state;
+        if (io->outputs[i].data && state != BULK_DONE && state != BULK_FAILED) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int bulk_written(BulkIO* io, uint32_t i) {
+    if (io->backend == BULK_URING) {
+        pthread_mutex_lock(&io->lock);
+        WAIT_UNTIL(io, outputs_done(io));
+        pthread_mutex_unlock(&io->lock);
+    }
+    return io->outputs[i].state == BULK_DONE ? 0 : -1;
+}
+
+void close_bulk_io(BulkIO* io) {
+    if (io->backend == BULK_URING) {
+        pthread_mutex_lock(&io->lock);
+        WAIT_UNTIL(io, outputs_done(io) && io->in_flight == 0);
+        pthread_mutex_unlock(&io->lock);
+        close_uring(&io->ring);
+    }
+    if (io->slots) {
+        munmap(io->slots, (size_t) BULK_SLOTS * BULK_SLOT_SIZE);
+    }
+    for (uint32_t i = 0; i < io->num_inputs; i++) {
+        if (io->inputs[i].data) {
+            free_input(io, &io->inputs[i]);
+        }
+    }
+    free(io->inputs);
+    free(io->outputs);
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->changed);
+}
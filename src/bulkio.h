@@ -0,0 +1,95 @@
+#ifndef BULKIO_H
+#define BULKIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "uring.h"
+
+typedef enum {
+    BULK_URING,             // io_uring, with registered buffers where they fit
+    BULK_PREAD              // plain pread() and pwrite(), one file at a time
+} BulkBackend;
+
+/* Number of registered buffers for inputs, and the size of each. Larger
+   inputs are read into buffers of their own.
+ */
+#define BULK_SLOTS 16
+#define BULK_SLOT_SIZE (1 << 20)
+
+/* Where an input or output file is. */
+typedef enum {
+    BULK_IDLE,
+    BULK_OPENING,
+    BULK_READING,           // or writing, for an output
+    BULK_CLOSING,
+    BULK_DONE,
+    BULK_FAILED
+} BulkState;
+
+typedef struct {
+    const char* name;
+    int fd;
+    char* data;
+    size_t size;
+    size_t done;
+    int slot;               // registered buffer holding DATA, or -1
+    BulkState state;
+} BulkFile;
+
+/* Reads and writes many whole files at once. With io_uring, inputs are
+   opened and read ahead, in order, while earlier ones are being assembled,
+   and outputs are written in the background; up to BULK_SLOTS inputs are
+   read ahead. Several threads may use it at once: whichever needs to wait
+   for I/O reaps completions for all of them.
+ */
+typedef struct {
+    BulkBackend backend;
+    Uring ring;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int reaping;            // a thread is waiting on the ring
+
+    BulkFile* inputs;
+    uint32_t num_inputs;
+    const uint32_t* order;  // the order inputs will be asked for in
+    uint32_t next;          // next input in ORDER to read ahead
+    uint32_t ahead;         // inputs read ahead and not released yet
+
+    BulkFile* outputs;
+    uint32_t num_outputs;
+    uint32_t in_flight;     // operations submitted and not completed
+
+    char* slots;            // BULK_SLOTS registered buffers
+    int free_slots[BULK_SLOTS];
+    uint32_t num_free_slots;
+} BulkIO;
+
+/* Prepares to read the NUM_INPUTS files IN_NAMES, which will mostly be asked
+   for in ORDER, and to write up to NUM_INPUTS outputs. Uses io_uring unless
+   it is unavailable or BACKEND is BULK_PREAD.
+ */
+void open_bulk_io(BulkIO* io, char* const* in_names, const uint32_t* order, uint32_t num_inputs,
+    BulkBackend backend);
+
+/* Waits until input I is in memory and stores it in *DATA and *SIZE. Returns
+   0 on success and -1 if it could not be read.
+ */
+int bulk_read(BulkIO* io, uint32_t i, const char** data, size_t* size);
+
+/* Frees input I once it has been used. */
+void bulk_release(BulkIO* io, uint32_t i);
+
+/* Writes the SIZE bytes at DATA, which must come from malloc(), to the file
+   OUT_NAME as output I, and frees them once done. Does not wait.
+ */
+void bulk_write(BulkIO* io, uint32_t i, const char* out_name, char* data, size_t size);
+
+/* Waits for all outputs. Returns 0 if output I was written, -1 if not. */
+int bulk_written(BulkIO* io, uint32_t i);
+
+/* Waits for all outputs and frees IO. */
+void close_bulk_io(BulkIO* io);
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "reader.h"
+#include "writer.h"
+#include "symindex.h"
+#include "cache.h"
+
+/* The multipliers of the hash, odd and with their bits well spread. */
+#define K1 0x9e3779b97f4a7c15ULL
+#define K2 0xc2b2ae3d27d4eb4fULL
+
+/* Tells temporary files of the same process apart. */
+static uint32_t tmp_counter = 0;
+
+static uint64_t rotl(uint64_t x, int r) {
+    return x << r | x >> (64 - r);
+}
+
+static uint64_t finish(uint64_t h) {
+    h ^= h >> 33;
+    h *= K2;
+    h ^= h >> 29;
+    h *= K1;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Hashes the SIZE bytes at DATA, 8 at a time, starting from SEED. It is not
+   meant to resist anyone, only to be fast and spread well.
+ */
+static uint64_t hash_bytes(const char* data, size_t size, uint64_t seed) {
+    uint64_t h = seed ^ (size * K1);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = rotl(h ^ (w * K1), 31) * K2;
+    }
+    if (i < size) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, size - i);
+        h = rotl(h ^ (w * K1), 31) * K2;
+    }
+    return finish(h);
+}
+
+CacheKey cache_key(const char* data, size_t size, int options) {
+    // what the assembler is, so that a rebuilt one does not trust old entries
+    static const char build[] = "cache " __DATE__ " " __TIME__;
+    uint64_t seed = hash_bytes(build, sizeof(build) - 1, CACHE_VERSION);
+    CacheKey key;
+    snprintf(key.name, sizeof(key.name), "%016llx%08x-%x",
+        (unsigned long long) hash_bytes(data, size, seed), (uint32_t) size, options);
+    return key;
+}
+
+int open_cache(AsmCache* cache, const char* dir, uint64_t max_size) {
+    memset(cache, 0, sizeof(AsmCache));
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    cache->dir = malloc(strlen(dir) + 1);
+    if (!cache->dir) {
+        allocation_failed();
+    }
+    strcpy(cache->dir, dir);
+    cache->max_size = max_size;
+    return 0;
+}
+
+/* Returns the path of the file of entry KEY with the extension EXT. The
+   caller must free it.
+ */
+static char* entry_path(const AsmCache* cache, const CacheKey* key, const char* ext) {
+    size_t len = strlen(cache->dir) + strlen(key->name) + strlen(ext) + 2;
+    char* path = malloc(len);
+    if (!path) {
+        allocation_failed();
+    }
+    snprintf(path, len, "%s/%s%s", cache->dir, key->name, ext);
+    return path;
+}
+
+/* Returns a temporary name next to PATH. The caller must free it. */
+static char* tmp_path(const char* path) {
+    size_t len = strlen(path) + 32;
+    char* tmp = malloc(len);
+    if (!tmp) {
+        allocation_failed();
+    }
+    snprintf(tmp, len, "%s.tmp%d.%u", path, (int) getpid(),
+        __atomic_fetch_add(&tmp_counter, 1, __ATOMIC_RELAXED));
+    return tmp;
+}
+
+/* Writes the LEN bytes at DATA, after the LEN2 at DATA2, to the file PATH.
+   Returns 0 on success and -1 on error.
+ */
+static int write_file(const char* path, const char* data, size_t len, const char* data2,
+    size_t len2) {
+    Writer dst;
+    if (open_writer(&dst, path, 0) != 0) {
+        return -1;
+    }
+    put_bytes(&dst, data, len);
+    if (len2 > 0) {
+        put_bytes(&dst, data2, len2);
+    }
+    return close_writer(&dst);
+}
+
+/* Makes DST a hard link to SRC, or a copy of it where links are not
+   possible. Linked files are marked first, so that writers replace them
+   instead of changing the cache. Returns 0 on success and -1 on error.
+ */
+static int link_or_copy(const char* src, const char* dst) {
+    unlink(dst);
+    if (mark_cached(src) == 0 && link(src, dst) == 0) {
+        return 0;
+    }
+    Reader input;
+    if (open_reader(&input, src) != 0) {
+        return -1;
+    }
+    int err = write_file(dst, input.data, input.size, NULL, 0);
+    close_reader(&input);
+    return err;
+}
+
+/* Same as link_or_copy(), but DST appears all at once. */
+static int link_or_copy_atomic(const char* src, const char* dst) {
+    char* tmp = tmp_path(dst);
+    int err = link_or_copy(src, tmp);
+    if (err == 0 && rename(tmp, dst) != 0) {
+        err = -1;
+    }
+    if (err != 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return err;
+}
+
+int cache_fetch(AsmCache* cache, const CacheKey* key, const char* out_name,
+    const char* tmp_name) {
+    char* meta_name = entry_path(cache, key, ".meta");
+    char* obj_name = entry_path(cache, key, ".out");
+    char* int_name = entry_path(cache, key, ".int");
+    char* sym_name = entry_path(cache, key, ".int" SYMBOL_INDEX_SUFFIX);
+    char* tmp_sym_name = tmp_name ? symbol_index_name(tmp_name) : NULL;
+
+    int status = -1;
+    Reader meta;
+    if (open_reader(&meta, meta_name) == 0) {
+        const char* newline = memchr(meta.data, '\n', meta.size);
+        if (newline && (!tmp_name || access(int_name, R_OK) == 0)
+            && link_or_copy(obj_name, out_name) == 0
+            && (!tmp_name || (link_or_copy(int_name, tmp_name) == 0
+                && link_or_copy(sym_name, tmp_sym_name) == 0))) {
+            status = atoi(meta.data);
+            size_t log_len = meta.size - (newline + 1 - meta.data);
+            if (log_len > 0) {
+                write_to_log("%.*s", (int) log_len, newline + 1);
+            }
+            // the modification time of the meta file records the last use
+            utimensat(AT_FDCWD, meta_name, NULL, 0);
+        }
+        close_reader(&meta);
+    }
+    __atomic_fetch_add(status >= 0 ? &cache->hits : &cache->misses, 1, __ATOMIC_RELAXED);
+
+    free(meta_name);
+    free(obj_name);
+    free(int_name);
+    free(sym_name);
+    free(tmp_sym_name);
+    return status;
+}
+
+void cache_store(AsmCache* cache, const CacheKey* key, const char* obj, size_t obj_len,
+    const char* tmp_name, const char* log, size_t log_len, int status) {
+    char* meta_name = entry_path(cache, key, ".meta");
+    char* obj_name = entry_path(cache, key, ".out");
+    char* tmp_obj_name = tmp_path(obj_name);
+    char* tmp_meta_name = tmp_path(meta_name);
+
+    int err = write_file(tmp_obj_name, obj, obj_len, NULL, 0) != 0
+        || rename(tmp_obj_name, obj_name) != 0;
+    if (!err && tmp_name) {
+        char* int_name = entry_path(cache, key, ".int");
+        char* sym_name = entry_path(cache, key, ".int" SYMBOL_INDEX_SUFFIX);
+        char* tmp_sym_name = symbol_index_name(tmp_name);
+        err = link_or_copy_atomic(tmp_name, int_name) != 0
+            || link_or_copy_atomic(tmp_sym_name, sym_name) != 0;
+        free(int_name);
+        free(sym_name);
+        free(tmp_sym_name);
+    }
+
+    // the entry only counts once its meta file is there
+    char status_line[16];
+    int status_len = snprintf(status_line, sizeof(status_line), "%d\n", status);
+    if (!err && (write_file(tmp_meta_name, status_line, status_len, log, log_len) != 0
+        || rename(tmp_meta_name, meta_name) != 0)) {
+        err = 1;
+    }
+    if (err) {
+        unlink(tmp_obj_name);
+        unlink(tmp_meta_name);
+    } else {
+        __atomic_fetch_add(&cache->stores, 1, __ATOMIC_RELAXED);
+    }
+
+    free(meta_name);
+    free(obj_name);
+    free(tmp_obj_name);
+    free(tmp_meta_name);
+}
+
+/* A file in the cache directory. */
+typedef struct {
+    char* name;
+    uint64_t size;
+    int64_t mtime;          // in nanoseconds
+} CacheFile;
+
+/* The files of one entry, found together in the sorted list of files. */
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    uint64_t size;
+    int64_t last_use;
+} CacheEntry;
+
+static int compare_file_names(const void* a, const void* b) {
+    return strcmp(((const CacheFile*) a)->name, ((const CacheFile*) b)->name);
+}
+
+static int compare_last_use(const void* a, const void* b) {
+    const CacheEntry* x = a;
+    const CacheEntry* y = b;
+    return (x->last_use > y->last_use) - (x->last_use < y->last_use);
+}
+
+/* Returns the length of the entry name at the start of the file name NAME. */
+static size_t entry_name_len(const char* name) {
+    const char* dot = strchr(name, '.');
+    return dot ? (size_t) (dot - name) : strlen(name);
+}
+
+/* Removes the least recently used entries of CACHE until it fits. */
+static void evict(AsmCache* cache) {
+    DIR* dir = opendir(cache->dir);
+    if (!dir) {
+        return;
+    }
+    CacheFile* files = NULL;
+    uint32_t num_files = 0, cap = 0;
+    uint64_t total = 0;
+    size_t dir_len = strlen(cache->dir);
+    struct dirent* ent;
+    while ((ent = readdir(dir))) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        char* path = malloc(dir_len + strlen(ent->d_name) + 2);
+        if (!path) {
+            allocation_failed();
+        }
+        sprintf(path, "%s/%s", cache->dir, ent->d_name);
+        struct stat st;
+        if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (num_files == cap) {
+            cap = cap ? 2 * cap : 64;
+            files = realloc(files, cap * sizeof(CacheFile));
+            if (!files) {
+                allocation_failed();
+            }
+        }
+        files[num_files].name = path;
+        files[num_files].size = st.st_size;
+        files[num_files].mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        num_files++;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (total > cache->max_size) {
+        qsort(files, num_files, sizeof(CacheFile), compare_file_names);
+        CacheEntry* entries = malloc((num_files + 1) * sizeof(CacheEntry));
+        if (!entries) {
+            allocation_failed();
+        }
+        uint32_t num_entries = 0;
+        for (uint32_t i = 0; i < num_files; i++) {
+            const char* name = files[i].name + dir_len + 1;
+            size_t len = entry_name_len(name);
+            const char* prev = i > 0 ? files[i - 1].name + dir_len + 1 : NULL;
+            if (!prev || entry_name_len(prev) != len || strncmp(prev, name, len) != 0) {
+                CacheEntry* entry = &entries[num_entries++];
+                entry->first = i;
+                entry->count = 0;
+                entry->size = 0;
+                entry->last_use = files[i].mtime;
+            }
+            CacheEntry* entry = &entries[num_entries - 1];
+            entry->count++;
+            entry->size += files[i].size;
+            // a finished entry was last used when its meta file was touched
+            if (strcmp(name + len, ".meta") == 0) {
+                entry->last_use = files[i].mtime;
+            }
+        }
+
+        qsort(entries, num_entries, sizeof(CacheEntry), compare_last_use);
+        for (uint32_t e = 0; e < num_entries && total > cache->max_size; e++) {
+            // the meta file goes first, so the entry is never seen half gone
+            for (uint32_t i = 0; i < entries[e].count; i++) {
+                const char* name = files[entries[e].first + i].name;
+                if (strcmp(name + strlen(name) - 5, ".meta") == 0) {
+                    unlink(name);
+                }
+            }
+            for (uint32_t i = 0; i < entries[e].count; i++) {
+                unlink(files[entries[e].first + i].name);
+            }
+            total -= entries[e].size;
+            cache->evictions++;
+        }
+        free(entries);
+    }
+
+    for (uint32_t i = 0; i < num_files; i++) {
+        free(files[i].name);
+    }
+    free(files);
+}
+
+void close_cache(AsmCache* cache) {
+    evict(cache);
+    free(cache->dir);
+    cache->dir = NULL;
+}
+
+void print_cache_stats(const AsmCache* cache, FILE* output) {
+    fprintf(output, "Cache: %llu hits, %llu misses, %llu stored, %llu evicted\n",
+        (unsigned long long) cache->hits, (unsigned long long) cache->misses,
+        (unsigned long long) cache->stores, (unsigned long long) cache->evictions);
+}
@@ -0,0 +1,70 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Bumped whenever what goes into an entry changes. Entries are also keyed
+   on when the assembler was built, so a rebuilt assembler starts afresh.
+ */
+#define CACHE_VERSION 1
+
+/* Default limit on the size of a cache directory. */
+#define CACHE_DEFAULT_SIZE (256ULL << 20)
+
+/* An on-disk cache of assembled files, keyed on a hash of the source bytes,
+   the assembler and the options. An entry KEY in the directory consists of
+   KEY.out, the object file, KEY.int and KEY.int.sym if an intermediate file
+   was written, and KEY.meta, which holds the exit status and the messages
+   and whose modification time records the last use. Files are written under
+   a temporary name and renamed into place, so any number of threads and
+   processes may share a cache.
+ */
+typedef struct {
+    char* dir;
+    uint64_t max_size;
+    uint64_t hits;          // counters are updated atomically
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+} AsmCache;
+
+typedef struct {
+    char name[40];          // of the entry in the cache directory
+} CacheKey;
+
+/* Opens the cache in the directory DIR, creating it if needed, limited to
+   MAX_SIZE bytes. Returns 0 on success and -1 if DIR cannot be used.
+ */
+int open_cache(AsmCache* cache, const char* dir, uint64_t max_size);
+
+/* Evicts the least recently used entries until the cache fits its limit,
+   and releases CACHE.
+ */
+void close_cache(AsmCache* cache);
+
+/* Returns the key for the SIZE bytes of source at DATA assembled with the
+   AsmOption flags OPTIONS.
+ */
+CacheKey cache_key(const char* data, size_t size, int options);
+
+/* Looks KEY up. On a hit, links or copies the object file to OUT_NAME and,
+   if TMP_NAME is not NULL, the intermediate file and its symbol index to
+   TMP_NAME, replays the messages with write_to_log(), and returns the
+   status the assembly had. Returns -1 on a miss.
+ */
+int cache_fetch(AsmCache* cache, const CacheKey* key, const char* out_name,
+    const char* tmp_name);
+
+/* Stores the object file OBJ of OBJ_LEN bytes under KEY, along with the
+   intermediate file TMP_NAME and its symbol index if TMP_NAME is not NULL,
+   the LOG_LEN bytes of messages at LOG, and STATUS.
+ */
+void cache_store(AsmCache* cache, const CacheKey* key, const char* obj, size_t obj_len,
+    const char* tmp_name, const char* log, size_t log_len, int status);
+
+/* Writes the hit, miss, store and eviction counts to OUTPUT. */
+void print_cache_stats(const AsmCache* cache, FILE* output);
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "hash.h"
+#include "arena.h"
+#include "globals.h"
+
+#define EMPTY 0
+
+/* Ids handed to tables, so that a thread can tell whether the names it
+   keeps belong to a table that is still there.
+ */
+static uint64_t last_table_id = 0;
+
+/* The names the calling thread adds to the table with id NAMES_TABLE. */
+static __thread GlobalNames* thread_names = NULL;
+static __thread uint64_t names_table = 0;
+
+void init_global_table(GlobalTable* table, uint32_t max_symbols) {
+    memset(table, 0, sizeof(GlobalTable));
+    // at most half full, so that probes stay short
+    uint64_t num_slots = 16;
+    while (num_slots < 2 * (uint64_t) max_symbols) {
+        num_slots *= 2;
+    }
+    if (num_slots > UINT32_MAX) {
+        allocation_failed();
+    }
+    table->slots = calloc(num_slots, sizeof(uint64_t));
+    // a symbol number is used up whenever two threads race to add the same
+    // name, so there is one per slot, bar one slot that always stays empty
+    table->symbols = malloc((num_slots - 1) * sizeof(GlobalSymbol));
+    if (!table->slots || !table->symbols) {
+        allocation_failed();
+    }
+    table->slot_mask = num_slots - 1;
+    table->id = __atomic_add_fetch(&last_table_id, 1, __ATOMIC_RELAXED);
+}
+
+void free_global_table(GlobalTable* table) {
+    // names are kept out of any arena, so that this thread can free them
+    Arena* outer = use_arena(NULL);
+    GlobalNames* names = table->names;
+    while (names) {
+        GlobalNames* next = names->next;
+        free_pool(&names->pool);
+        free(names);
+        names = next;
+    }
+    use_arena(outer);
+    free(table->slots);
+    free(table->symbols);
+    memset(table, 0, sizeof(GlobalTable));
+}
+
+/* Returns the names of the calling thread for TABLE, and adds them to it the
+   first time.
+ */
+static GlobalNames* names_of_thread(GlobalTable* table) {
+    if (names_table == table->id) {
+        return thread_names;
+    }
+    GlobalNames* names = malloc(sizeof(GlobalNames));
+    if (!names) {
+        allocation_failed();
+    }
+    init_pool(&names->pool, 0);
+    names->next = __atomic_load_n(&table->names, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&table->names, &names->next, names, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        continue;
+    }
+    thread_names = names;
+    names_table = table->id;
+    return names;
+}
+
+/* Returns 1 if SLOT, which is not empty, holds the LEN bytes at NAME, whose
+   hash is HASH.
+ */
+static int slot_matches(const GlobalTable* table, uint64_t slot, uint32_t hash,
+    const char* name, size_t len) {
+    if ((uint32_t) (slot >> 32) != hash) {
+        return 0;
+    }
+    const GlobalSymbol* symbol = &table->symbols[(uint32_t) slot - 1];
+    return symbol->len == len && memcmp(symbol->name, name, len) == 0;
+}
+
+const GlobalSymbol* find_global(const GlobalTable* table, const char* name, size_t len) {
+    uint32_t hash = hash_name(name, len);
+    // every slot is looked at once at most, so this always finishes
+    for (uint32_t i = hash & table->slot_mask, n = 0; n <= table->slot_mask;
+        i = (i + 1) & table->slot_mask, n++) {
+        uint64_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == EMPTY) {
+            return NULL;
+        }
+        if (slot_matches(table, slot, hash, name, len)) {
+            return &table->symbols[(uint32_t) slot - 1];
+        }
+    }
+    return NULL;
+}
+
+int64_t get_global(const GlobalTable* table, const char* name, size_t len) {
+    const GlobalSymbol* symbol = find_global(table, name, len);
+    return symbol ? (int64_t) symbol->addr : -1;
+}
+
+int add_global(GlobalTable* table, const char* name, size_t len, uint32_t addr) {
+    // most duplicates are found without copying the name
+    const GlobalSymbol* found = find_global(table, name, len);
+    if (found) {
+        name_already_exists(found->name);
+        return -1;
+    }
+
+    uint32_t index = __atomic_fetch_add(&table->next, 1, __ATOMIC_RELAXED);
+    if (index >= table->slot_mask) {
+        write_to_log("Error: global symbol table is full.\n");
+        return -1;
+    }
+    uint32_t hash = hash_name(name, len);
+    Arena* outer = use_arena(NULL);
+    GlobalNames* names = names_of_thread(table);
+    // a name this thread has tried before is not copied again
+    uint32_t id = pool_intern_hashed(&names->pool, name, len, hash);
+    use_arena(outer);
+    GlobalSymbol* symbol = &table->symbols[index];
+    symbol->name = pool_str(&names->pool, id);
+    symbol->len = len;
+    symbol->addr = addr;
+
+    uint64_t mine = (uint64_t) hash << 32 | (index + 1);
+    for (uint32_t i = hash & table->slot_mask; ; i = (i + 1) & table->slot_mask) {
+        uint64_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        // the release publishes the symbol along with the slot
+        if (slot == EMPTY && __atomic_compare_exchange_n(&table->slots[i], &slot, mine, 0,
+            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_add(&table->len, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        // SLOT now holds what another thread put there first
+        if (slot_matches(table, slot, hash, name, len)) {
+            // the symbol number is used up; its name stays in this thread's pool
+            name_already_exists(symbol->name);
+            return -1;
+        }
+    }
+}
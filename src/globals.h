@@ -0,0 +1,66 @@
+#ifndef GLOBALS_H
+#define GLOBALS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "strpool.h"
+
+typedef struct {
+    const char* name;       // null-terminated, in the names of one thread
+    uint32_t len;
+    uint32_t addr;
+} GlobalSymbol;
+
+/* The names one thread has added to a GlobalTable. Only that thread changes
+   POOL, and its chunks never move, so other threads may read names in it.
+ */
+typedef struct GlobalNames {
+    StringPool pool;
+    struct GlobalNames* next;
+} GlobalNames;
+
+/* A symbol table that any number of threads may add to and look up in at
+   once, for gathering the global labels of files assembled in parallel.
+   Adding is lock-free and looking up is wait-free; neither takes a lock.
+
+   The capacity is fixed when the table is created. Slots of the hash table
+   hold the hash_name() of a name in their upper 32 bits and its symbol
+   number plus one in the lower 32, or 0 if empty, and are probed linearly.
+   A slot is written once, with a compare-and-swap, and never changes after
+   that, so a reader that sees it can trust it. Symbols are never removed.
+
+   Each thread interns the names it adds in a StringPool of its own, so a
+   name is copied at most once per thread however often it is tried.
+ */
+typedef struct {
+    uint64_t* slots;
+    uint32_t slot_mask;     // number of slots minus one
+    GlobalSymbol* symbols;  // one fewer than there are slots
+    uint32_t next;          // symbol numbers handed out, updated atomically
+    uint32_t len;           // symbols added, updated atomically
+    uint64_t id;            // tells this table from any freed before it
+    GlobalNames* names;     // of every thread that has added, pushed atomically
+} GlobalTable;
+
+/* Creates TABLE with room for at least MAX_SYMBOLS names. */
+void init_global_table(GlobalTable* table, uint32_t max_symbols);
+
+void free_global_table(GlobalTable* table);
+
+/* Adds the LEN bytes at NAME with ADDR, unless the name is already there.
+   Returns 0 if it was added. Returns -1 if it was there already, in which
+   case the error is reported with name_already_exists(), or if the table is
+   full.
+ */
+int add_global(GlobalTable* table, const char* name, size_t len, uint32_t addr);
+
+/* Returns the address of the LEN bytes at NAME, or -1 if it is not in TABLE.
+   A name whose add_global() has returned is always found.
+ */
+int64_t get_global(const GlobalTable* table, const char* name, size_t len);
+
+/* Returns the symbol for the LEN bytes at NAME, or NULL. */
+const GlobalSymbol* find_global(const GlobalTable* table, const char* name, size_t len);
+
+#endif
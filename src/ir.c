@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "ir.h"
+#include "arena.h"
+
+#define INITIAL_SIZE 64
+#define SCALING_FACTOR 2
+
+/* Grows the array at *PTR of *CAP elements of SIZE bytes so that it can hold
+   at least NEEDED elements.
+ */
+static void reserve(void** ptr, uint32_t* cap, size_t size, size_t needed) {
+    if (needed <= *cap) {
+        return;
+    }
+    size_t new_cap = *cap ? *cap : INITIAL_SIZE;
+    while (new_cap < needed) {
+        new_cap *= SCALING_FACTOR;
+    }
+    if (new_cap > UINT32_MAX) {
+        allocation_failed();
+    }
+    *ptr = mem_realloc(*ptr, new_cap * size);
+    *cap = new_cap;
+}
+
+void init_program(Program* prog, int keep_text) {
+    memset(prog, 0, sizeof(Program));
+    prog->keep_text = keep_text;
+    init_pool(&prog->names, 0);
+}
+
+void free_program(Program* prog) {
+    mem_free(prog->insts);
+    mem_free(prog->text);
+    free_pool(&prog->names);
+    memset(prog, 0, sizeof(Program));
+}
+
+void reset_program(Program* prog) {
+    prog->len = 0;
+    prog->text_len = 0;
+    clear_pool(&prog->names);
+}
+
+Inst* add_inst(Program* prog) {
+    reserve((void**) &prog->insts, &prog->cap, sizeof(Inst), prog->len + 1);
+    Inst* inst = &prog->insts[prog->len++];
+    memset(inst, 0, sizeof(Inst));
+    inst->text = NO_TEXT;
+    return inst;
+}
+
+uint32_t add_text(Program* prog, const Token* name, const Token* args, int num_args) {
+    size_t len = name->len + 1;
+    for (int i = 0; i < num_args; i++) {
+        len += args[i].len + 1;
+    }
+    reserve((void**) &prog->text, &prog->text_cap, 1, (size_t) prog->text_len + len);
+
+    uint32_t offset = prog->text_len;
+    char* p = prog->text + offset;
+    memcpy(p, name->start, name->len);
+    p += name->len;
+    for (int i = 0; i < num_args; i++) {
+        *p++ = ' ';
+        memcpy(p, args[i].start, args[i].len);
+        p += args[i].len;
+    }
+    *p = '\0';
+    prog->text_len += len;
+    return offset;
+}
+
+uint32_t intern_name(Program* prog, const char* name, size_t len) {
+    return pool_intern(&prog->names, name, len);
+}
+
+const char* get_name(const Program* prog, uint32_t id) {
+    return pool_str(&prog->names, id);
+}
+
+const char* get_text(const Program* prog, const Inst* inst) {
+    return inst->text == NO_TEXT ? NULL : prog->text + inst->text;
+}
+
+void append_program(Program* dst, const Program* src) {
+    const StringPool* names = &src->names;
+    uint32_t* ids = mem_alloc((names->len + 1) * sizeof(uint32_t));
+    for (uint32_t id = 0; id < names->len; id++) {
+        ids[id] = pool_intern_hashed(&dst->names, pool_str(names, id), pool_len(names, id),
+            pool_hash(names, id));
+    }
+
+    reserve((void**) &dst->insts, &dst->cap, sizeof(Inst), (size_t) dst->len + src->len);
+    uint32_t text_start = dst->text_len;
+    for (uint32_t i = 0; i < src->len; i++) {
+        Inst* inst = &dst->insts[dst->len + i];
+        *inst = src->insts[i];
+        if (inst->op == OP_BEQ || inst->op == OP_BNE || inst->op == OP_J || inst->op == OP_JAL) {
+            inst->sym = ids[inst->sym];
+        }
+        if (inst->text != NO_TEXT) {
+            inst->text += text_start;
+        }
+    }
+    dst->len += src->len;
+    mem_free(ids);
+
+    if (src->text_len > 0) {
+        reserve((void**) &dst->text, &dst->text_cap, 1, (size_t) dst->text_len + src->text_len);
+        memcpy(dst->text + dst->text_len, src->text, src->text_len);
+        dst->text_len += src->text_len;
+    }
+}
+
+void write_program_text(const Program* prog, Writer* output) {
+    for (uint32_t i = 0; i < prog->len; i++) {
+        const char* text = get_text(prog, &prog->insts[i]);
+        if (text) {
+            put_str(output, text);
+        }
+        put_char(output, '\n');
+    }
+}
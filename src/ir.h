@@ -0,0 +1,95 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lexer.h"
+#include "writer.h"
+#include "strpool.h"
+#include "hash.h"
+
+/* Instructions understood by pass two. Pseudoinstructions never appear here;
+   they are expanded by write_pass_one() first.
+ */
+typedef enum {
+    OP_NONE,        // blank line in a text intermediate file
+    OP_INVALID,     // could not be parsed; pass two reports it
+    OP_ADDU, OP_OR, OP_SLT, OP_SLTU, OP_SLL, OP_JR,
+    OP_ADDIU, OP_ORI, OP_LUI,
+    OP_LB, OP_LBU, OP_LW, OP_SB, OP_SW,
+    OP_BEQ, OP_BNE, OP_J, OP_JAL,
+    OP_MULT, OP_DIV, OP_MFHI, OP_MFLO,
+    NUM_OPS
+} Opcode;
+
+#define NO_TEXT UINT32_MAX
+
+/* One intermediate instruction. Register numbers are stored by the field they
+   are encoded into, so pass two only has to shift them into place.
+ */
+typedef struct {
+    uint8_t op;         // Opcode
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    int32_t imm;        // immediate, memory offset or shift amount
+    uint32_t sym;       // name id of a branch or jump target
+    uint32_t text;      // offset of the text form in the text pool, or NO_TEXT
+} Inst;
+
+/* The output of pass one: a list of Insts, the names they refer to and,
+   where needed, their text form.
+
+   The text form of an instruction is what the .int file contains for it. It
+   is kept for every instruction if KEEP_TEXT is set (so the program can be
+   written out with write_program_text()), and otherwise only for
+   instructions that pass two may still reject, so that it can report them.
+ */
+typedef struct {
+    Inst* insts;
+    uint32_t len;
+    uint32_t cap;
+    int keep_text;
+
+    char* text;         // null-terminated instruction texts
+    uint32_t text_len;
+    uint32_t text_cap;
+
+    StringPool names;   // branch and jump target names, by name id
+} Program;
+
+void init_program(Program* prog, int keep_text);
+
+void free_program(Program* prog);
+
+/* Removes all instructions and names from PROG but keeps its memory. */
+void reset_program(Program* prog);
+
+/* Appends a new instruction with all fields cleared and returns it. The
+   pointer is only valid until the next call to add_inst().
+ */
+Inst* add_inst(Program* prog);
+
+/* Stores "NAME ARGS..." in the text pool and returns its offset. */
+uint32_t add_text(Program* prog, const Token* name, const Token* args, int num_args);
+
+/* Returns the id of the LEN bytes at NAME, adding it if it is new. */
+uint32_t intern_name(Program* prog, const char* name, size_t len);
+
+const char* get_name(const Program* prog, uint32_t id);
+
+/* Returns the text form of INST, or NULL if it was not kept. */
+const char* get_text(const Program* prog, const Inst* inst);
+
+/* Appends every instruction of SRC to DST, along with the names and text
+   forms they use. DST must keep text forms if SRC does.
+ */
+void append_program(Program* dst, const Program* src);
+
+/* Writes PROG in the text intermediate format, one instruction per line.
+   PROG must have been created with KEEP_TEXT set.
+ */
+void write_program_text(const Program* prog, Writer* output);
+
+#endif
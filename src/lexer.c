@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "scanner.h"
+#include "lexer.h"
+
+/* Classifies the block of bytes at BLOCK with scan_block() and stores which
+   of them end a token. The first '#' ends the line, so it and everything
+   after it, along with anything past the end of the line, counts as a
+   boundary.
+ */
+static void load_block(Lexer* lexer, const char* block) {
+    size_t n = lexer->end - block;
+    if (n > SCAN_BLOCK_SIZE) {
+        n = SCAN_BLOCK_SIZE;
+    }
+
+    ScanMasks masks;
+    scan_block(block, n, &masks);
+
+    uint64_t valid = n == SCAN_BLOCK_SIZE ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1;
+    if (masks.comment) {
+        int first = __builtin_ctzll(masks.comment);
+        lexer->end = block + first;
+        valid &= ((uint64_t) 1 << first) - 1;
+    }
+    lexer->block = block;
+    lexer->delims = masks.delim | ~valid;
+}
+
+/* Returns the first byte at or after P that is a token boundary if DELIM is
+   1, or that is part of a token if DELIM is 0. Returns the end of the line if
+   there is none.
+ */
+static const char* find_boundary(Lexer* lexer, const char* p, int delim) {
+    while (p < lexer->end) {
+        if (p >= lexer->block + SCAN_BLOCK_SIZE) {
+            load_block(lexer, lexer->block + SCAN_BLOCK_SIZE);
+            continue;
+        }
+        uint64_t bits = delim ? lexer->delims : ~lexer->delims;
+        bits >>= p - lexer->block;
+        if (bits) {
+            p += __builtin_ctzll(bits);
+            return p < lexer->end ? p : lexer->end;
+        }
+        p = lexer->block + SCAN_BLOCK_SIZE;
+    }
+    return lexer->end;
+}
+
+void init_lexer(Lexer* lexer, const char* line, size_t len) {
+    lexer->pos = line;
+    lexer->end = line + len;
+    lexer->count = 0;
+    lexer->seen_mnemonic = 0;
+    lexer->in_parens = 0;
+    load_block(lexer, line);
+}
+
+/* Returns the type of an operand outside parentheses that starts with C. */
+static TokenType operand_type(char c) {
+    if (c == '$') {
+        return TOK_REGISTER;
+    } else if ((c >= '0' && c <= '9') || c == '-' || c == '+') {
+        return TOK_IMMEDIATE;
+    }
+    return TOK_SYMBOL;
+}
+
+int next_token(Lexer* lexer, Token* tok) {
+    const char* skipped = lexer->pos;
+    const char* start = find_boundary(lexer, skipped, 0);
+    if (start == lexer->end) {
+        lexer->pos = start;
+        return 0;
+    }
+
+    // Remember whether the skipped delimiters entered a memory operand
+    for (; skipped < start; skipped++) {
+        if (*skipped == '(') {
+            lexer->in_parens = 1;
+        } else if (*skipped == ')') {
+            lexer->in_parens = 0;
+        }
+    }
+
+    const char* p = find_boundary(lexer, start, 1);
+
+    tok->start = start;
+    tok->len = p - start;
+    if (!lexer->seen_mnemonic) {
+        // Only the first token can be a label; the token after it is the name
+        if (lexer->count == 0 && p[-1] == ':') {
+            tok->type = TOK_LABEL;
+        } else {
+            tok->type = TOK_MNEMONIC;
+            lexer->seen_mnemonic = 1;
+        }
+    } else if (lexer->in_parens) {
+        tok->type = TOK_MEMORY;
+    } else {
+        tok->type = operand_type(*start);
+    }
+
+    lexer->pos = p;
+    lexer->count++;
+    return 1;
+}
+
+Token token_from_str(const char* str, TokenType type) {
+    Token tok;
+    tok.start = str;
+    tok.len = str ? strlen(str) : 0;
+    tok.type = type;
+    return tok;
+}
+
+Token operand_from_str(const char* str) {
+    Token tok = token_from_str(str, TOK_SYMBOL);
+    if (tok.len > 0) {
+        tok.type = operand_type(*str);
+    }
+    return tok;
+}
+
+int token_equals(const Token* tok, const char* str) {
+    return strncmp(tok->start, str, tok->len) == 0 && str[tok->len] == '\0';
+}
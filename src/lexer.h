@@ -0,0 +1,62 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* What a token is, decided from its position in the line and its first and
+   last characters while it is being scanned.
+ */
+typedef enum {
+    TOK_LABEL,      // first token of a line ending in ':'
+    TOK_MNEMONIC,   // instruction name
+    TOK_REGISTER,   // starts with '$'
+    TOK_IMMEDIATE,  // starts with a digit or a sign
+    TOK_MEMORY,     // base register of a memory operand, e.g. $t1 in 0($t1)
+    TOK_SYMBOL      // any other operand, e.g. a branch or jump target
+} TokenType;
+
+/* A token is a span of the line it was read from. It is NOT null-terminated
+   and the line is never modified.
+ */
+typedef struct {
+    const char* start;
+    size_t len;
+    TokenType type;
+} Token;
+
+/* Per-line lexer state. Each Lexer is independent, so any number of lines
+   may be tokenized at the same time.
+ */
+typedef struct {
+    const char* pos;
+    const char* end;
+    const char* block;  // start of the block described by DELIMS
+    uint64_t delims;    // token boundaries in BLOCK, see scanner.h
+    int count;      // number of tokens returned so far
+    int seen_mnemonic;
+    int in_parens;  // 1 if inside the parentheses of a memory operand
+} Lexer;
+
+/* Prepares LEXER to tokenize the LEN bytes of LINE. Everything from the first
+   '#' onwards is treated as a comment and ignored.
+ */
+void init_lexer(Lexer* lexer, const char* line, size_t len);
+
+/* Stores the next token in TOK. Returns 1 if a token was found and 0 at the
+   end of the line.
+ */
+int next_token(Lexer* lexer, Token* tok);
+
+/* Returns a token spanning the null-terminated string STR. */
+Token token_from_str(const char* str, TokenType type);
+
+/* Same as token_from_str(), but typed the way next_token() types an operand
+   outside parentheses.
+ */
+Token operand_from_str(const char* str);
+
+/* Returns 1 if TOK is exactly the null-terminated string STR. */
+int token_equals(const Token* tok, const char* str);
+
+#endif
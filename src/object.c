@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "ir.h"
+#include "translate_utils.h"
+#include "object.h"
+#include "strpool.h"
+#include "arena.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary objects are only supported on little-endian hosts"
+#endif
+
+static uint32_t align_up(uint32_t n) {
+    return (n + OBJECT_ALIGN - 1) & ~(uint32_t) (OBJECT_ALIGN - 1);
+}
+
+static void put_padding(Writer* output, uint32_t n) {
+    char* p = reserve_output(output, n);
+    memset(p, 0, n);
+    output->len += n;
+}
+
+/* Writes the line starting section NAME, with its size header if
+   SIZE_HEADERS is set.
+ */
+static void put_section(Writer* output, const char* name, int size_headers, uint32_t count,
+    uint32_t size) {
+    put_str(output, name);
+    if (size_headers) {
+        put_char(output, ' ');
+        put_dec32(output, count);
+        put_char(output, ' ');
+        put_dec32(output, size);
+    }
+    put_char(output, '\n');
+}
+
+/* Returns the bytes needed to store the names in TABLE with their nulls. */
+static uint32_t names_size(const SymbolTable* table) {
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < table->len; i++) {
+        size += symbol_name_len(table, i) + 1;
+    }
+    return size;
+}
+
+void write_object_text(Writer* output, const uint32_t* text, uint32_t num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl, int size_headers) {
+    put_section(output, ".text", size_headers, num_words, num_words * 4);
+    write_insts_hex(output, text, num_words);
+
+    put_char(output, '\n');
+    put_section(output, ".symbol", size_headers, symtbl->len,
+        size_headers ? names_size(symtbl) : 0);
+    write_table_to(symtbl, output);
+
+    put_char(output, '\n');
+    put_section(output, ".relocation", size_headers, reltbl->len,
+        size_headers ? names_size(reltbl) : 0);
+    write_table_to(reltbl, output);
+}
+
+/* The string section of a binary object: every name once, null-terminated,
+   in the order they are first used.
+ */
+typedef struct {
+    StringPool pool;
+    uint32_t* offsets;      // by id, into the section
+    uint32_t size;
+} ObjectStrings;
+
+/* Adds the names in TABLE to STRINGS and stores one record per symbol in
+   RECORDS.
+ */
+static void make_records(ObjectStrings* strings, SymbolTable* table, ObjectSymbol* records) {
+    for (uint32_t i = 0; i < table->len; i++) {
+        uint32_t num_names = strings->pool.len;
+        uint32_t len = symbol_name_len(table, i);
+        uint32_t id = pool_intern(&strings->pool, symbol_name(table, i), len);
+        if (id == num_names) {
+            strings->offsets[id] = strings->size;
+            strings->size += len + 1;
+        }
+        records[i].addr = table->tbl[i].addr;
+        records[i].name = strings->offsets[id];
+    }
+}
+
+void write_object_binary(Writer* output, const uint32_t* text, uint32_t num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
+    ObjectStrings strings;
+    init_pool(&strings.pool, 0);
+    strings.offsets = mem_alloc(((size_t) symtbl->len + reltbl->len + 1) * sizeof(uint32_t));
+    strings.size = 0;
+    ObjectSymbol* symbols = mem_alloc((symtbl->len + 1) * sizeof(ObjectSymbol));
+    ObjectSymbol* relocs = mem_alloc((reltbl->len + 1) * sizeof(ObjectSymbol));
+    make_records(&strings, symtbl, symbols);
+    make_records(&strings, reltbl, relocs);
+
+    ObjectHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OBJECT_MAGIC, sizeof(header.magic));
+    header.version = OBJECT_VERSION;
+    header.text_offset = align_up(sizeof(ObjectHeader));
+    header.text_count = num_words;
+    header.symbol_offset = align_up(header.text_offset + num_words * sizeof(uint32_t));
+    header.symbol_count = symtbl->len;
+    header.reloc_offset = header.symbol_offset + symtbl->len * sizeof(ObjectSymbol);
+    header.reloc_count = reltbl->len;
+    header.strings_offset = header.reloc_offset + reltbl->len * sizeof(ObjectSymbol);
+    header.strings_size = align_up(strings.size);
+
+    put_bytes(output, (const char*) &header, sizeof(header));
+    put_padding(output, header.text_offset - sizeof(header));
+    put_bytes(output, (const char*) text, num_words * sizeof(uint32_t));
+    put_padding(output, header.symbol_offset - header.text_offset - num_words * sizeof(uint32_t));
+    put_bytes(output, (const char*) symbols, symtbl->len * sizeof(ObjectSymbol));
+    put_bytes(output, (const char*) relocs, reltbl->len * sizeof(ObjectSymbol));
+    for (uint32_t id = 0; id < strings.pool.len; id++) {
+        put_bytes(output, pool_str(&strings.pool, id), pool_len(&strings.pool, id) + 1);
+    }
+    put_padding(output, header.strings_size - strings.size);
+
+    mem_free(symbols);
+    mem_free(relocs);
+    mem_free(strings.offsets);
+    free_pool(&strings.pool);
+}
+
+/* Returns 1 if the COUNT records of SIZE bytes at OFFSET lie within the first
+   LIMIT bytes and start at an aligned offset.
+ */
+static int section_fits(uint32_t offset, uint32_t count, size_t size, size_t limit) {
+    return offset % OBJECT_ALIGN == 0 && offset <= limit
+        && (uint64_t) count * size <= limit - offset;
+}
+
+static int names_valid(const ObjectSymbol* records, uint32_t count, uint32_t strings_size) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (records[i].name >= strings_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int open_object_view(ObjectView* view, const char* data, size_t size) {
+    if (size < sizeof(ObjectHeader) || (uintptr_t) data % OBJECT_ALIGN != 0) {
+        return -1;
+    }
+    const ObjectHeader* header = (const ObjectHeader*) data;
+    if (memcmp(header->magic, OBJECT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != OBJECT_VERSION) {
+        return -1;
+    }
+    if (!section_fits(header->text_offset, header->text_count, sizeof(uint32_t), size)
+        || !section_fits(header->symbol_offset, header->symbol_count, sizeof(ObjectSymbol), size)
+        || !section_fits(header->reloc_offset, header->reloc_count, sizeof(ObjectSymbol), size)
+        || !section_fits(header->strings_offset, header->strings_size, 1, size)) {
+        return -1;
+    }
+
+    // every name must be null-terminated within the pool
+    const char* strings = data + header->strings_offset;
+    if (header->strings_size > 0 && strings[header->strings_size - 1] != '\0') {
+        return -1;
+    }
+    view->header = header;
+    view->text = (const uint32_t*) (data + header->text_offset);
+    view->symbols = (const ObjectSymbol*) (data + header->symbol_offset);
+    view->relocs = (const ObjectSymbol*) (data + header->reloc_offset);
+    view->strings = strings;
+    if (!names_valid(view->symbols, header->symbol_count, header->strings_size)
+        || !names_valid(view->relocs, header->reloc_count, header->strings_size)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns the bytes needed to store the names of RECORDS with their nulls. */
+static uint32_t record_names_size(const ObjectView* view, const ObjectSymbol* records,
+    uint32_t count) {
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size += strlen(view->strings + records[i].name) + 1;
+    }
+    return size;
+}
+
+/* Writes the object in VIEW to OUTPUT in the text format. */
+static void write_view_text(Writer* output, const ObjectView* view, int size_headers) {
+    const ObjectHeader* header = view->header;
+    put_section(output, ".text", size_headers, header->text_count, header->text_count * 4);
+    write_insts_hex(output, view->text, header->text_count);
+
+    put_char(output, '\n');
+    put_section(output, ".symbol", size_headers, header->symbol_count, size_headers
+        ? record_names_size(view, view->symbols, header->symbol_count) : 0);
+    for (uint32_t i = 0; i < header->symbol_count; i++) {
+        write_symbol(output, view->symbols[i].addr, view->strings + view->symbols[i].name);
+    }
+
+    put_char(output, '\n');
+    put_section(output, ".relocation", size_headers, header->reloc_count, size_headers
+        ? record_names_size(view, view->relocs, header->reloc_count) : 0);
+    for (uint32_t i = 0; i < header->reloc_count; i++) {
+        write_symbol(output, view->relocs[i].addr, view->strings + view->relocs[i].name);
+    }
+}
+
+/* Parses the LEN bytes at LINE as exactly 8 hex digits. */
+static int parse_hex_word(const char* line, size_t len, uint32_t* word) {
+    if (len != 8) {
+        return -1;
+    }
+    uint32_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = line[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return -1;
+        }
+        value = (value << 4) | digit;
+    }
+    *word = value;
+    return 0;
+}
+
+/* Parses a line written by write_symbol() and adds it to TABLE. */
+static int parse_symbol_line(const char* line, size_t len, SymbolTable* table) {
+    const char* tab = memchr(line, '\t', len);
+    if (!tab || tab == line || tab == line + len - 1) {
+        return -1;
+    }
+    uint64_t addr = 0;
+    for (const char* p = line; p < tab; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        addr = addr * 10 + (*p - '0');
+        if (addr > UINT32_MAX) {
+            return -1;
+        }
+    }
+    return add_to_table_span(table, tab + 1, line + len - tab - 1, addr);
+}
+
+/* Parses the decimal number at *P, which must end before END, and moves *P
+   past it.
+ */
+static int parse_dec(const char** p, const char* end, uint32_t* value) {
+    uint64_t n = 0;
+    const char* start = *p;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        n = n * 10 + (**p - '0');
+        if (n > UINT32_MAX) {
+            return -1;
+        }
+        (*p)++;
+    }
+    *value = n;
+    return *p == start ? -1 : 0;
+}
+
+/* The sections of a text object file, with their optional size headers. */
+enum { SECTION_TEXT, SECTION_SYMBOL, SECTION_RELOC, NUM_SECTIONS };
+
+static const char* const SECTION_NAMES[NUM_SECTIONS] = {
+    ".text", ".symbol", ".relocation"
+};
+
+typedef struct {
+    int has_header;
+    uint32_t count;     // from the header
+    uint32_t size;
+} SectionHeader;
+
+/* If the LEN bytes at LINE start a section, stores it in *SECTION and its
+   size header, if any, in HEADERS. Returns 1 if the line starts a section, 0
+   if not, and -1 if its size header is malformed.
+ */
+static int parse_section_line(const char* line, size_t len, int* section,
+    SectionHeader* headers) {
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        size_t name_len = strlen(SECTION_NAMES[i]);
+        if (len < name_len || memcmp(line, SECTION_NAMES[i], name_len) != 0
+            || (len > name_len && line[name_len] != ' ')) {
+            continue;
+        }
+        *section = i;
+        headers[i].has_header = len > name_len;
+        if (!headers[i].has_header) {
+            return 1;
+        }
+        const char* p = line + name_len + 1;
+        const char* end = line + len;
+        if (parse_dec(&p, end, &headers[i].count) != 0 || p == end || *p++ != ' '
+            || parse_dec(&p, end, &headers[i].size) != 0 || p != end) {
+            return -1;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns 0 if the size header of every section matches what was read. */
+static int check_headers(const SectionHeader* headers, uint32_t num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
+    const SectionHeader* text = &headers[SECTION_TEXT];
+    const SectionHeader* sym = &headers[SECTION_SYMBOL];
+    const SectionHeader* rel = &headers[SECTION_RELOC];
+    if ((text->has_header && (text->count != num_words || text->size != num_words * 4))
+        || (sym->has_header && (sym->count != symtbl->len || sym->size != names_size(symtbl)))
+        || (rel->has_header && (rel->count != reltbl->len || rel->size != names_size(reltbl)))) {
+        write_to_log("Error: object file section sizes do not match their headers\n");
+        return -1;
+    }
+    return 0;
+}
+
+int parse_object_text(Reader* input, uint32_t** text, uint32_t* num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
+    int section = -1;
+    SectionHeader headers[NUM_SECTIONS];
+    uint32_t* words = NULL;
+    uint32_t len = 0, cap = 0;
+    const char* line;
+    size_t line_len;
+    uint32_t line_num = 0;
+
+    memset(headers, 0, sizeof(headers));
+    while (next_line(input, &line, &line_len)) {
+        line_num++;
+        if (line_len == 0) {
+            continue;
+        }
+
+        // a malformed size header is an error like any other invalid line
+        int err = -1;
+        int starts_section = parse_section_line(line, line_len, &section, headers);
+        if (starts_section == 1) {
+            // the header of .text says how many words to expect, which is
+            // believed as long as the rest of the file could hold them
+            uint32_t count = headers[SECTION_TEXT].count;
+            if (section == SECTION_TEXT && count > cap
+                && (uint64_t) count * HEX_LINE_SIZE <= input->size - input->pos) {
+                cap = count;
+                words = realloc(words, cap * sizeof(uint32_t));
+                if (!words) {
+                    allocation_failed();
+                }
+            }
+            continue;
+        }
+        if (starts_section == 0 && section == SECTION_TEXT) {
+            if (len == cap) {
+                cap = cap ? cap * 2 : 1024;
+                words = realloc(words, cap * sizeof(uint32_t));
+                if (!words) {
+                    allocation_failed();
+                }
+            }
+            err = parse_hex_word(line, line_len, &words[len]);
+            len += err == 0;
+        } else if (starts_section == 0 && section == SECTION_SYMBOL) {
+            err = parse_symbol_line(line, line_len, symtbl);
+        } else if (starts_section == 0 && section == SECTION_RELOC) {
+            err = parse_symbol_line(line, line_len, reltbl);
+        }
+        if (err != 0) {
+            write_to_log("Error: invalid object file line %u: %.*s\n", line_num,
+                (int) line_len, line);
+            free(words);
+            return -1;
+        }
+    }
+    if (check_headers(headers, len, symtbl, reltbl) != 0) {
+        free(words);
+        return -1;
+    }
+    *text = words;
+    *num_words = len;
+    return 0;
+}
+
+int convert_object(const char* in_name, const char* out_name, int to_binary,
+    int size_headers) {
+    Reader input;
+    Writer output;
+    if (open_reader(&input, in_name) != 0) {
+        write_to_log("Error: unable to open input file: %s\n", in_name);
+        return -1;
+    }
+
+    int err = 0;
+    if (to_binary) {
+        uint32_t* text = NULL;
+        uint32_t num_words = 0;
+        SymbolTable* symtbl = create_table(SYMTBL_NON_UNIQUE);
+        SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
+        err = parse_object_text(&input, &text, &num_words, symtbl, reltbl);
+        if (err == 0) {
+            if (open_writer(&output, out_name, input.size) != 0) {
+                write_to_log("Error: unable to open output file: %s\n", out_name);
+                err = -1;
+            } else {
+                write_object_binary(&output, text, num_words, symtbl, reltbl);
+                err = close_writer(&output);
+            }
+        }
+        free(text);
+        free_table(symtbl);
+        free_table(reltbl);
+    } else {
+        ObjectView view;
+        if (open_object_view(&view, input.data, input.size) != 0) {
+            write_to_log("Error: not a binary object file: %s\n", in_name);
+            err = -1;
+        } else if (open_writer(&output, out_name, 3 * input.size) != 0) {
+            write_to_log("Error: unable to open output file: %s\n", out_name);
+            err = -1;
+        } else {
+            write_view_text(&output, &view, size_headers);
+            err = close_writer(&output);
+        }
+    }
+    close_reader(&input);
+    return err;
+}
@@ -0,0 +1,88 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tables.h"
+#include "reader.h"
+#include "writer.h"
+
+#define OBJECT_MAGIC "MOBJ"
+#define OBJECT_VERSION 1
+
+/* Every section of a binary object starts at a multiple of this. */
+#define OBJECT_ALIGN 8
+
+/* A binary object file holds the header, the .text words, the symbol
+   records, the relocation records and the string pool, in that order. All
+   fields are little-endian, so a mapped file can be used in place.
+ */
+typedef struct {
+    char magic[4];          // OBJECT_MAGIC, not null-terminated
+    uint32_t version;
+    uint32_t text_offset;   // offsets are in bytes from the start of the file
+    uint32_t text_count;    // number of words
+    uint32_t symbol_offset;
+    uint32_t symbol_count;
+    uint32_t reloc_offset;
+    uint32_t reloc_count;
+    uint32_t strings_offset;
+    uint32_t strings_size;  // in bytes, including padding
+} ObjectHeader;
+
+typedef struct {
+    uint32_t addr;
+    uint32_t name;          // offset of the null-terminated name in the string pool
+} ObjectSymbol;
+
+/* Points into a binary object held in memory. */
+typedef struct {
+    const ObjectHeader* header;
+    const uint32_t* text;
+    const ObjectSymbol* symbols;
+    const ObjectSymbol* relocs;
+    const char* strings;
+} ObjectView;
+
+/* Writes the object file with the NUM_WORDS words of TEXT and the two tables
+   to OUTPUT in the text format: the .text, .symbol and .relocation sections.
+
+   If SIZE_HEADERS is set, each section name is followed by two numbers so
+   that readers can allocate everything up front:
+     .text <instructions> <bytes of machine code>
+     .symbol <entries> <bytes of names, counting a null after each>
+     .relocation <entries> <bytes of names, counting a null after each>
+ */
+void write_object_text(Writer* output, const uint32_t* text, uint32_t num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl, int size_headers);
+
+/* Same as write_object_text(), but in the binary format. Names used more
+   than once are stored once in the string pool.
+ */
+void write_object_binary(Writer* output, const uint32_t* text, uint32_t num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl);
+
+/* Checks the SIZE bytes at DATA, which must be aligned to OBJECT_ALIGN, and
+   points VIEW at the sections of the binary object they hold. Returns 0 on
+   success and -1 if DATA is not a valid binary object.
+ */
+int open_object_view(ObjectView* view, const char* data, size_t size);
+
+/* Parses an object file in the text format from INPUT. The words of .text are
+   stored in a new array at *TEXT, and their number in NUM_WORDS. Symbols and
+   relocations are added to SYMTBL and RELTBL in file order. Size headers
+   are optional, but must be correct if present. Returns 0 on success and -1
+   on error.
+ */
+int parse_object_text(Reader* input, uint32_t** text, uint32_t* num_words,
+    SymbolTable* symtbl, SymbolTable* reltbl);
+
+/* Converts the object file IN_NAME to the binary format if TO_BINARY is set,
+   or to the text format otherwise, and writes it to OUT_NAME. SIZE_HEADERS is
+   passed on to write_object_text(). Returns 0 on success and -1 on error.
+ */
+int convert_object(const char* in_name, const char* out_name, int to_binary,
+    int size_headers);
+
+#endif
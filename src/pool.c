@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "pool.h"
+
+/* The tasks dealt to one thread that it has not started yet. Tasks are only
+   ever taken out, so a lock held for a couple of instructions is enough; a
+   task is a whole file.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t* tasks;
+    uint32_t head;
+    uint32_t tail;
+} PoolQueue;
+
+typedef struct {
+    PoolQueue* queues;
+    uint32_t num_queues;
+    PoolTask task;
+    void* ctx;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    uint32_t id;
+} PoolWorker;
+
+/* Takes the first task left in QUEUE. Returns 0 if there is none. */
+static int take_task(PoolQueue* queue, uint32_t* task) {
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *task = queue->tasks[queue->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+/* Runs the tasks of its own queue, then steals from the others. Thieves take
+   the first task too: queues are in ORDER, so that is the longest one left,
+   which keeps the slowest thread from finishing last with a long task.
+ */
+static void* run_worker(void* arg) {
+    PoolWorker* worker = arg;
+    Pool* pool = worker->pool;
+    uint32_t task;
+    for (uint32_t i = 0; i < pool->num_queues; ) {
+        PoolQueue* queue = &pool->queues[(worker->id + i) % pool->num_queues];
+        if (take_task(queue, &task)) {
+            pool->task(pool->ctx, task);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    return NULL;
+}
+
+void run_pool(uint32_t num_threads, const uint32_t* order, uint32_t num_tasks, PoolTask task,
+    void* ctx) {
+    if (num_threads > num_tasks) {
+        num_threads = num_tasks;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    Pool pool;
+    pool.queues = calloc(num_threads, sizeof(PoolQueue));
+    PoolWorker* workers = malloc(num_threads * sizeof(PoolWorker));
+    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+    int* started = calloc(num_threads, sizeof(int));
+    if (!pool.queues || !workers || !threads || !started) {
+        allocation_failed();
+    }
+    pool.num_queues = num_threads;
+    pool.task = task;
+    pool.ctx = ctx;
+
+    // deal the tasks out in turn, so every queue is in ORDER as well
+    for (uint32_t t = 0; t < num_threads; t++) {
+        PoolQueue* queue = &pool.queues[t];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->tasks = malloc((num_tasks / num_threads + 1) * sizeof(uint32_t));
+        if (!queue->tasks) {
+            allocation_failed();
+        }
+        for (uint32_t i = t; i < num_tasks; i += num_threads) {
+            queue->tasks[queue->tail++] = order[i];
+        }
+        workers[t].pool = &pool;
+        workers[t].id = t;
+    }
+
+    // if a thread cannot be started, the others steal its tasks
+    for (uint32_t t = 1; t < num_threads; t++) {
+        started[t] = pthread_create(&threads[t], NULL, run_worker, &workers[t]) == 0;
+    }
+    run_worker(&workers[0]);
+    for (uint32_t t = 1; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    for (uint32_t t = 0; t < num_threads; t++) {
+        pthread_mutex_destroy(&pool.queues[t].lock);
+        free(pool.queues[t].tasks);
+    }
+    free(pool.queues);
+    free(workers);
+    free(threads);
+    free(started);
+}
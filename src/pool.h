@@ -0,0 +1,17 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+/* Runs task number TASK. CTX is passed through from run_pool(). */
+typedef void (*PoolTask)(void* ctx, uint32_t task);
+
+/* Runs TASK for each of the NUM_TASKS task numbers in ORDER on NUM_THREADS
+   threads, the calling thread being one of them, and returns once all are
+   done. Tasks are dealt out to the threads in ORDER, and a thread that runs
+   out steals from the others, so tasks should be listed longest first.
+ */
+void run_pool(uint32_t num_threads, const uint32_t* order, uint32_t num_tasks, PoolTask task,
+    void* ctx);
+
+#endif
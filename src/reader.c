@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "reader.h"
+
+#define READ_CHUNK 65536
+
+/* Reads all of FD into a heap buffer. Used for inputs that cannot be mapped. */
+static int read_all(Reader* reader, int fd) {
+    size_t cap = READ_CHUNK, size = 0;
+    char* buf = malloc(cap);
+    if (!buf) {
+        allocation_failed();
+    }
+
+    ssize_t n;
+    while ((n = read(fd, buf + size, cap - size)) != 0) {
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        size += n;
+        if (size == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (!buf) {
+                allocation_failed();
+            }
+        }
+    }
+
+    memset(reader, 0, sizeof(Reader));
+    reader->data = buf;
+    reader->size = size;
+    reader->owned = 1;
+    reader->fd = -1;
+    return 0;
+}
+
+int open_reader_fd(Reader* reader, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            memset(reader, 0, sizeof(Reader));
+            reader->data = data;
+            reader->size = st.st_size;
+            reader->mapped = 1;
+            reader->owned = 1;
+            reader->fd = -1;
+            return 0;
+        }
+    }
+    return read_all(reader, fd);
+}
+
+int open_reader(Reader* reader, const char* filename) {
+    if (strcmp(filename, "-") == 0) {
+        return open_reader_fd(reader, STDIN_FILENO);
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = open_reader_fd(reader, fd);
+    close(fd);
+    return ret;
+}
+
+int open_reader_stream(Reader* reader, const char* filename) {
+    int fd = STDIN_FILENO;
+    if (strcmp(filename, "-") != 0) {
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return -1;
+        }
+    }
+
+    // regular files are all there already, so they are simply mapped
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        int ret = open_reader_fd(reader, fd);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return ret;
+    }
+
+    char* buf = malloc(READ_CHUNK);
+    if (!buf) {
+        allocation_failed();
+    }
+    memset(reader, 0, sizeof(Reader));
+    reader->data = buf;
+    reader->owned = 1;
+    reader->fd = fd;
+    reader->streaming = 1;
+    reader->cap = READ_CHUNK;
+    return 0;
+}
+
+void open_reader_mem(Reader* reader, const char* data, size_t size) {
+    memset(reader, 0, sizeof(Reader));
+    reader->data = data;
+    reader->size = size;
+    reader->fd = -1;
+}
+
+/* Moves the unread part of a streaming reader's buffer to the front and
+   reads more after it. Returns 0 at the end of the input.
+ */
+static int refill(Reader* reader) {
+    char* buf = (char*) reader->data;
+    size_t remaining = reader->size - reader->pos;
+    memmove(buf, buf + reader->pos, remaining);
+    reader->scanned -= reader->pos;
+    reader->size = remaining;
+    reader->pos = 0;
+
+    // a line longer than the buffer
+    if (reader->size == reader->cap) {
+        reader->cap *= 2;
+        buf = realloc(buf, reader->cap);
+        if (!buf) {
+            allocation_failed();
+        }
+        reader->data = buf;
+    }
+
+    ssize_t n;
+    do {
+        n = read(reader->fd, buf + reader->size, reader->cap - reader->size);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        reader->streaming = 0;
+        return 0;
+    }
+    reader->size += n;
+    return 1;
+}
+
+/* Looks for the newline that ends the line at POS in what is buffered, going
+   on from where the last search stopped. Returns 1 if it is there.
+ */
+static int find_eol(Reader* reader) {
+    if (reader->eol > reader->pos) {
+        return 1;
+    }
+    if (reader->scanned < reader->pos) {
+        reader->scanned = reader->pos;
+    }
+    const char* newline = memchr(reader->data + reader->scanned, '\n',
+        reader->size - reader->scanned);
+    if (!newline) {
+        reader->scanned = reader->size;
+        return 0;
+    }
+    reader->eol = newline - reader->data + 1;
+    return 1;
+}
+
+int reader_would_block(Reader* reader) {
+    if (!reader->streaming || find_eol(reader)) {
+        return 0;
+    }
+    // end of input and errors wake poll() as well, and do not block either
+    struct pollfd ready = { .fd = reader->fd, .events = POLLIN };
+    return poll(&ready, 1, 0) == 0;
+}
+
+int next_line(Reader* reader, const char** line, size_t* len) {
+    while (!find_eol(reader) && reader->streaming && refill(reader)) {
+        continue;
+    }
+    if (reader->pos >= reader->size) {
+        return 0;
+    }
+
+    *line = reader->data + reader->pos;
+    if (reader->eol) {
+        *len = reader->eol - 1 - reader->pos;
+        reader->pos = reader->eol;
+        reader->eol = 0;
+    } else {
+        *len = reader->size - reader->pos;
+        reader->pos = reader->size;
+    }
+    return 1;
+}
+
+void close_reader(Reader* reader) {
+    if (reader->owned) {
+        if (reader->mapped) {
+            munmap((void*) reader->data, reader->size);
+        } else {
+            free((void*) reader->data);
+        }
+    }
+    if (reader->fd > STDIN_FILENO) {
+        close(reader->fd);
+    }
+    reader->data = NULL;
+    reader->size = reader->pos = 0;
+    reader->owned = 0;
+    reader->streaming = 0;
+    reader->fd = -1;
+}
@@ -0,0 +1,55 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+/* Reads an input file line by line without copying it. Regular files are
+   mapped into memory; anything that cannot be mapped (pipes, terminals) is
+   read into a single heap buffer instead. Either way, lines are handed out
+   as (pointer, length) spans into that one buffer.
+ */
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t pos;
+    int mapped;     // 1 if DATA is an mmap()ed region, 0 if it is heap memory
+    int owned;      // 1 if DATA should be released by close_reader()
+    int streaming;  // 1 while more input may still be read from FD
+    int fd;         // read from by a streaming reader, -1 otherwise
+    size_t cap;     // size of the buffer of a streaming reader
+    size_t eol;     // offset just past the newline that ends the next line, 0 if not found yet
+    size_t scanned; // offset up to which there is no newline after POS
+} Reader;
+
+/* Opens FILENAME for reading, or standard input if FILENAME is "-". Returns
+   0 on success and -1 on error.
+ */
+int open_reader(Reader* reader, const char* filename);
+
+/* Opens the already open file descriptor FD for reading. FD is not closed. */
+int open_reader_fd(Reader* reader, int fd);
+
+/* Same as open_reader(), but input that cannot be mapped is read a chunk at
+   a time as lines are needed, rather than all at once. Each line is then only
+   valid until the next call to next_line().
+ */
+int open_reader_stream(Reader* reader, const char* filename);
+
+/* Returns 1 if the next call to next_line() would have to wait for more
+   input to arrive: no complete line is buffered and none is ready to be read.
+ */
+int reader_would_block(Reader* reader);
+
+/* Reads from SIZE bytes of memory at DATA. The memory is not copied and must
+   stay valid until the reader is closed.
+ */
+void open_reader_mem(Reader* reader, const char* data, size_t size);
+
+/* Stores the next line in LINE and its length (without the newline) in LEN.
+   Returns 1 if a line was read and 0 at the end of the input.
+ */
+int next_line(Reader* reader, const char** line, size_t* len);
+
+void close_reader(Reader* reader);
+
+#endif
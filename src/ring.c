@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "ring.h"
+
+/* Spins this many times before yielding, and yields this many times more
+   before sleeping, so that a waiting stage gives its core up quickly.
+ */
+#define SPIN_LIMIT 64
+#define YIELD_LIMIT 128
+#define SLEEP_NS 50000
+
+void init_ring(Ring* ring, uint32_t cap) {
+    ring->cap = 1;
+    while (ring->cap < cap) {
+        ring->cap *= 2;
+    }
+    ring->slots = malloc(ring->cap * sizeof(void*));
+    if (!ring->slots) {
+        allocation_failed();
+    }
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+void free_ring(Ring* ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int ring_push(Ring* ring, void* item) {
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->cap) {
+        return -1;
+    }
+    ring->slots[tail & (ring->cap - 1)] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void* ring_pop(Ring* ring) {
+    uint32_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    void* item = ring->slots[head & (ring->cap - 1)];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+double ring_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Waits a little longer each time it is called in a row. */
+static void back_off(uint32_t* tries) {
+    if (*tries < SPIN_LIMIT) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_ia32_pause();
+#endif
+    } else if (*tries < SPIN_LIMIT + YIELD_LIMIT) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, SLEEP_NS };
+        nanosleep(&ts, NULL);
+    }
+    (*tries)++;
+}
+
+double ring_push_wait(Ring* ring, void* item) {
+    if (ring_push(ring, item) == 0) {
+        return 0;
+    }
+    double start = ring_clock();
+    uint32_t tries = 0;
+    while (ring_push(ring, item) != 0) {
+        back_off(&tries);
+    }
+    return ring_clock() - start;
+}
+
+double ring_pop_wait(Ring* ring, void** item) {
+    if ((*item = ring_pop(ring))) {
+        return 0;
+    }
+    double start = ring_clock();
+    uint32_t tries = 0;
+    while (!(*item = ring_pop(ring))) {
+        back_off(&tries);
+    }
+    return ring_clock() - start;
+}
@@ -0,0 +1,44 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+
+/* A bounded queue of pointers between exactly one producer thread and one
+   consumer thread. Neither side takes a lock: the producer only writes TAIL
+   and the consumer only writes HEAD, each on a cache line of its own.
+ */
+typedef struct {
+    void** slots;
+    uint32_t cap;           // a power of two
+    uint32_t head __attribute__((aligned(RING_CACHE_LINE)));    // next slot to read
+    uint32_t tail __attribute__((aligned(RING_CACHE_LINE)));    // next slot to write
+} Ring;
+
+/* Creates an empty ring that holds at least CAP items. */
+void init_ring(Ring* ring, uint32_t cap);
+
+void free_ring(Ring* ring);
+
+/* Adds ITEM at the end of RING. Returns 0 on success, or -1 if it is full.
+   Only the producer may call it.
+ */
+int ring_push(Ring* ring, void* item);
+
+/* Removes the first item of RING and returns it, or returns NULL if it is
+   empty. Only the consumer may call it.
+ */
+void* ring_pop(Ring* ring);
+
+/* Same as ring_push() and ring_pop(), but wait until there is room or an
+   item. They return the number of seconds spent waiting.
+ */
+double ring_push_wait(Ring* ring, void* item);
+
+double ring_pop_wait(Ring* ring, void** item);
+
+/* Returns the current time in seconds, for measuring stages. */
+double ring_clock();
+
+#endif
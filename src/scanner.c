@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "scanner.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+void scan_block_scalar(const char* p, size_t n, ScanMasks* masks) {
+    uint64_t newline = 0, comment = 0, delim = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bit = (uint64_t) 1 << i;
+        switch (p[i]) {
+            case '\n':
+                newline |= bit;
+                delim |= bit;
+                break;
+            case '#':
+                comment |= bit;
+                break;
+            case ' ': case '\f': case '\r': case '\t': case '\v':
+            case ',': case '(': case ')':
+                delim |= bit;
+                break;
+        }
+    }
+    masks->newline = newline;
+    masks->comment = comment;
+    masks->delim = delim;
+}
+
+#ifdef HAVE_X86_SIMD
+
+#define PAGE_SIZE 4096
+
+/* The vector versions always read a whole block. Reading past the end of a
+   short block is harmless as long as it stays within the same page, since
+   the extra bits are masked off. Otherwise the block is copied into a padded
+   buffer first so that we never read past the end of a mapping. Because of
+   this, AddressSanitizer is turned off for the vector versions.
+ */
+static const char* pad_block(const char* p, size_t n, char* buf) {
+    if (n == SCAN_BLOCK_SIZE
+        || ((uintptr_t) p & (PAGE_SIZE - 1)) <= PAGE_SIZE - SCAN_BLOCK_SIZE) {
+        return p;
+    }
+    memcpy(buf, p, n);
+    memset(buf + n, 0, SCAN_BLOCK_SIZE - n);
+    return buf;
+}
+
+static uint64_t valid_bits(size_t n) {
+    return n == SCAN_BLOCK_SIZE ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1;
+}
+
+__attribute__((target("sse2"), no_sanitize_address))
+static void scan_block_sse2(const char* p, size_t n, ScanMasks* masks) {
+    char buf[SCAN_BLOCK_SIZE];
+    const char* block = pad_block(p, n, buf);
+
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i lparen = _mm_set1_epi8('(');
+    const __m128i rparen = _mm_set1_epi8(')');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+
+    uint64_t newline = 0, comment = 0, delim = 0;
+    for (int i = 0; i < SCAN_BLOCK_SIZE; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (block + i));
+
+        // '\t' through '\r' are contiguous: (c - '\t') <= 4 as unsigned bytes
+        __m128i ws = _mm_sub_epi8(v, tab);
+        __m128i is_ws = _mm_cmpeq_epi8(_mm_min_epu8(ws, four), ws);
+
+        __m128i d = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, comma)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, lparen), _mm_cmpeq_epi8(v, rparen)));
+        d = _mm_or_si128(d, is_ws);
+
+        newline |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << i;
+        comment |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, hash)) << i;
+        delim |= (uint64_t) (uint16_t) _mm_movemask_epi8(d) << i;
+    }
+
+    uint64_t valid = valid_bits(n);
+    masks->newline = newline & valid;
+    masks->comment = comment & valid;
+    masks->delim = delim & valid;
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static void scan_block_avx2(const char* p, size_t n, ScanMasks* masks) {
+    char buf[SCAN_BLOCK_SIZE];
+    const char* block = pad_block(p, n, buf);
+
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i hash = _mm256_set1_epi8('#');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i lparen = _mm256_set1_epi8('(');
+    const __m256i rparen = _mm256_set1_epi8(')');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+
+    uint64_t newline = 0, comment = 0, delim = 0;
+    for (int i = 0; i < SCAN_BLOCK_SIZE; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (block + i));
+
+        __m256i ws = _mm256_sub_epi8(v, tab);
+        __m256i is_ws = _mm256_cmpeq_epi8(_mm256_min_epu8(ws, four), ws);
+
+        __m256i d = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, comma)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, lparen), _mm256_cmpeq_epi8(v, rparen)));
+        d = _mm256_or_si256(d, is_ws);
+
+        newline |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)) << i;
+        comment |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, hash)) << i;
+        delim |= (uint64_t) (uint32_t) _mm256_movemask_epi8(d) << i;
+    }
+
+    uint64_t valid = valid_bits(n);
+    masks->newline = newline & valid;
+    masks->comment = comment & valid;
+    masks->delim = delim & valid;
+}
+
+#endif
+
+typedef void (*ScanFn)(const char*, size_t, ScanMasks*);
+
+static ScanFn scan_impl = scan_block_scalar;
+static ScanLevel scan_level = SCAN_SCALAR;
+
+/* Picks the best implementation once, before main() runs, so that
+   scan_block() never has to synchronize on the choice.
+ */
+__attribute__((constructor))
+static void init_scanner() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (set_scan_level(SCAN_AVX2) == 0) {
+        return;
+    }
+    set_scan_level(SCAN_SSE2);
+#endif
+}
+
+void scan_block(const char* p, size_t n, ScanMasks* masks) {
+    scan_impl(p, n, masks);
+}
+
+ScanLevel get_scan_level() {
+    return scan_level;
+}
+
+int set_scan_level(ScanLevel level) {
+    switch (level) {
+        case SCAN_SCALAR:
+            scan_impl = scan_block_scalar;
+            break;
+#ifdef HAVE_X86_SIMD
+        case SCAN_SSE2:
+            if (!__builtin_cpu_supports("sse2")) {
+                return -1;
+            }
+            scan_impl = scan_block_sse2;
+            break;
+        case SCAN_AVX2:
+            if (!__builtin_cpu_supports("avx2")) {
+                return -1;
+            }
+            scan_impl = scan_block_avx2;
+            break;
+#endif
+        default:
+            return -1;
+    }
+    scan_level = level;
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of bytes classified by one call to scan_block(). */
+#define SCAN_BLOCK_SIZE 64
+
+/* Bit i of each mask describes byte i of the block. */
+typedef struct {
+    uint64_t newline;   // '\n'
+    uint64_t comment;   // '#'
+    uint64_t delim;     // any of " \f\n\r\t\v,()"
+} ScanMasks;
+
+typedef enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanLevel;
+
+/* Classifies the first N bytes at P (N <= SCAN_BLOCK_SIZE) in one pass and
+   stores the result in MASKS. Bits at or past N are always zero. Uses the
+   widest vector unit available on the running CPU.
+ */
+void scan_block(const char* p, size_t n, ScanMasks* masks);
+
+/* The portable version of scan_block(). */
+void scan_block_scalar(const char* p, size_t n, ScanMasks* masks);
+
+/* Returns the implementation currently used by scan_block(). */
+ScanLevel get_scan_level();
+
+/* Forces scan_block() to use LEVEL. Returns 0 on success, or -1 if the CPU or
+   compiler does not support LEVEL.
+ */
+int set_scan_level(ScanLevel level);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "hash.h"
+#include "strpool.h"
+#include "arena.h"
+
+#define INITIAL_SIZE 16
+#define SCALING_FACTOR 2
+
+/* Chunks start small, so that small pools stay small, and double up to
+   MAX_CHUNK_SIZE. A longer string gets a chunk of its own size.
+ */
+#define MIN_CHUNK_SIZE 4096
+#define MAX_CHUNK_SIZE (1 << 20)
+
+#define EMPTY 0
+
+/* Builds the index of POOL afresh with at least MIN_SLOTS slots. */
+static void grow_index(StringPool* pool, uint64_t min_slots) {
+    uint64_t num_slots = INITIAL_SIZE;
+    while (num_slots < min_slots) {
+        num_slots *= SCALING_FACTOR;
+    }
+    if (num_slots > UINT32_MAX) {
+        allocation_failed();
+    }
+    uint32_t* index = mem_calloc(num_slots, sizeof(uint32_t));
+    uint32_t mask = num_slots - 1;
+    for (uint32_t id = 0; id < pool->len; id++) {
+        uint32_t slot = pool->strings[id].hash & mask;
+        while (index[slot] != EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = id + 1;
+    }
+    mem_free(pool->index);
+    pool->index = index;
+    pool->index_mask = mask;
+}
+
+void init_pool(StringPool* pool, uint32_t cap_hint) {
+    memset(pool, 0, sizeof(StringPool));
+    reserve_pool(pool, cap_hint > INITIAL_SIZE ? cap_hint : INITIAL_SIZE);
+}
+
+void free_pool(StringPool* pool) {
+    for (uint32_t i = 0; i < pool->num_chunks; i++) {
+        mem_free(pool->chunks[i]);
+    }
+    mem_free(pool->chunks);
+    mem_free(pool->strings);
+    mem_free(pool->index);
+    memset(pool, 0, sizeof(StringPool));
+}
+
+void clear_pool(StringPool* pool) {
+    for (uint32_t i = 1; i < pool->num_chunks; i++) {
+        mem_free(pool->chunks[i]);
+    }
+    if (pool->num_chunks > 0) {
+        pool->num_chunks = 1;
+        pool->free = pool->chunks[0];
+        pool->free_len = pool->first_chunk_len;
+    }
+    pool->len = 0;
+    memset(pool->index, 0, ((size_t) pool->index_mask + 1) * sizeof(uint32_t));
+}
+
+void reserve_pool(StringPool* pool, uint32_t count) {
+    uint64_t needed = (uint64_t) pool->len + count;
+    if (needed > pool->cap) {
+        uint64_t cap = pool->cap ? pool->cap : INITIAL_SIZE;
+        while (cap < needed) {
+            cap *= SCALING_FACTOR;
+        }
+        if (cap > UINT32_MAX / 2) {
+            allocation_failed();
+        }
+        pool->strings = mem_realloc(pool->strings, cap * sizeof(PoolString));
+        pool->cap = cap;
+    }
+    if (2 * needed > (uint64_t) pool->index_mask + 1) {
+        grow_index(pool, 2 * needed);
+    }
+}
+
+/* Copies the LEN bytes at STR, null-terminated, into the chunks of POOL. */
+static const char* store(StringPool* pool, const char* str, size_t len) {
+    if (pool->free_len < len + 1) {
+        size_t size = (size_t) MIN_CHUNK_SIZE << (pool->num_chunks < 8 ? pool->num_chunks : 8);
+        size = size < MAX_CHUNK_SIZE ? size : MAX_CHUNK_SIZE;
+        size = size < len + 1 ? len + 1 : size;
+        if (pool->num_chunks == pool->chunks_cap) {
+            pool->chunks_cap = pool->chunks_cap ? pool->chunks_cap * SCALING_FACTOR : INITIAL_SIZE;
+            pool->chunks = mem_realloc(pool->chunks, pool->chunks_cap * sizeof(char*));
+        }
+        pool->free = mem_alloc(size);
+        if (pool->num_chunks == 0) {
+            pool->first_chunk_len = size;
+        }
+        pool->chunks[pool->num_chunks++] = pool->free;
+        pool->free_len = size;
+    }
+    char* copy = pool->free;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    pool->free += len + 1;
+    pool->free_len -= len + 1;
+    return copy;
+}
+
+/* Returns the index slot holding the LEN bytes at STR, whose hash is HASH,
+   or else the empty slot where they would go.
+ */
+static uint32_t find_slot(const StringPool* pool, const char* str, size_t len, uint32_t hash) {
+    uint32_t slot = hash & pool->index_mask;
+    while (pool->index[slot] != EMPTY) {
+        const PoolString* s = &pool->strings[pool->index[slot] - 1];
+        if (s->hash == hash && s->len == len && memcmp(s->str, str, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & pool->index_mask;
+    }
+    return slot;
+}
+
+uint32_t pool_intern(StringPool* pool, const char* str, size_t len) {
+    return pool_intern_hashed(pool, str, len, hash_name(str, len));
+}
+
+uint32_t pool_intern_hashed(StringPool* pool, const char* str, size_t len, uint32_t hash) {
+    uint32_t slot = find_slot(pool, str, len, hash);
+    if (pool->index[slot] != EMPTY) {
+        return pool->index[slot] - 1;
+    }
+    if (len > UINT32_MAX - 1) {
+        allocation_failed();
+    }
+    if (pool->len == pool->cap || 2 * ((uint64_t) pool->len + 1) > (uint64_t) pool->index_mask + 1) {
+        reserve_pool(pool, pool->len > 0 ? pool->len : 1);
+        slot = find_slot(pool, str, len, hash);
+    }
+
+    uint32_t id = pool->len++;
+    pool->strings[id].str = store(pool, str, len);
+    pool->strings[id].len = len;
+    pool->strings[id].hash = hash;
+    pool->index[slot] = id + 1;
+    return id;
+}
+
+uint32_t pool_find(const StringPool* pool, const char* str, size_t len) {
+    uint32_t slot = find_slot(pool, str, len, hash_name(str, len));
+    return pool->index[slot] != EMPTY ? pool->index[slot] - 1 : NO_STRING;
+}
+
+const char* pool_str(const StringPool* pool, uint32_t id) {
+    return pool->strings[id].str;
+}
+
+uint32_t pool_len(const StringPool* pool, uint32_t id) {
+    return pool->strings[id].len;
+}
+
+uint32_t pool_hash(const StringPool* pool, uint32_t id) {
+    return pool->strings[id].hash;
+}
@@ -0,0 +1,64 @@
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NO_STRING UINT32_MAX
+
+typedef struct {
+    const char* str;        // null-terminated, in one of the chunks
+    uint32_t len;
+    uint32_t hash;          // hash_name() of the string
+} PoolString;
+
+/* A set of interned strings. Each distinct string is stored once, in large
+   chunks that never move, and is named by a 32-bit id: ids count up from 0
+   in the order the strings were first added, so they can index arrays, and
+   two ids of the same pool are equal exactly when their strings are. The
+   hash index holds id + 1, or 0 if empty, and is kept at most half full.
+ */
+typedef struct {
+    char** chunks;
+    uint32_t num_chunks;
+    uint32_t chunks_cap;
+    char* free;             // unused space in the last chunk
+    size_t free_len;
+    size_t first_chunk_len;
+
+    PoolString* strings;    // by id
+    uint32_t len;
+    uint32_t cap;
+    uint32_t* index;
+    uint32_t index_mask;    // number of slots - 1
+} StringPool;
+
+/* Creates POOL with room for CAP_HINT strings before it has to grow. */
+void init_pool(StringPool* pool, uint32_t cap_hint);
+
+void free_pool(StringPool* pool);
+
+/* Removes all strings from POOL but keeps its first chunk and its arrays. */
+void clear_pool(StringPool* pool);
+
+/* Makes room in POOL for COUNT more strings. */
+void reserve_pool(StringPool* pool, uint32_t count);
+
+/* Returns the id of the LEN bytes at STR, adding them if they are new. */
+uint32_t pool_intern(StringPool* pool, const char* str, size_t len);
+
+/* Same as pool_intern(), but HASH is the hash_name() of the string. */
+uint32_t pool_intern_hashed(StringPool* pool, const char* str, size_t len, uint32_t hash);
+
+/* Returns the id of the LEN bytes at STR, or NO_STRING if they were never
+   added.
+ */
+uint32_t pool_find(const StringPool* pool, const char* str, size_t len);
+
+const char* pool_str(const StringPool* pool, uint32_t id);
+
+uint32_t pool_len(const StringPool* pool, uint32_t id);
+
+uint32_t pool_hash(const StringPool* pool, uint32_t id);
+
+#endif
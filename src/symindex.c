@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "writer.h"
+#include "symindex.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "symbol index files are only supported on little-endian hosts"
+#endif
+
+#define INDEX_ALIGN 8
+
+static uint32_t align_up(uint32_t n) {
+    return (n + INDEX_ALIGN - 1) & ~(uint32_t) (INDEX_ALIGN - 1);
+}
+
+char* symbol_index_name(const char* int_name) {
+    size_t len = strlen(int_name);
+    char* name = malloc(len + sizeof(SYMBOL_INDEX_SUFFIX));
+    if (!name) {
+        allocation_failed();
+    }
+    memcpy(name, int_name, len);
+    memcpy(name + len, SYMBOL_INDEX_SUFFIX, sizeof(SYMBOL_INDEX_SUFFIX));
+    return name;
+}
+
+/* Used to sort entry numbers by name. */
+typedef struct {
+    const char* name;
+    uint32_t entry;
+} SortKey;
+
+static int compare_keys(const void* a, const void* b) {
+    return strcmp(((const SortKey*) a)->name, ((const SortKey*) b)->name);
+}
+
+static void put_padding(Writer* output, uint32_t n) {
+    char* p = reserve_output(output, n);
+    memset(p, 0, n);
+    output->len += n;
+}
+
+int write_symbol_index(const char* filename, SymbolTable* table, uint32_t source_size,
+    uint32_t source_hash) {
+    uint32_t count = table->len;
+    uint32_t hash_cap = 0;
+    if (count > 0) {
+        // keep the hash table at most half full
+        hash_cap = 1;
+        while (hash_cap < 2 * count) {
+            hash_cap *= 2;
+        }
+    }
+
+    SymbolIndexEntry* entries = malloc((count + 1) * sizeof(SymbolIndexEntry));
+    SortKey* keys = malloc((count + 1) * sizeof(SortKey));
+    uint32_t* sorted = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t* slots = calloc(hash_cap + 1, sizeof(uint32_t));
+    if (!entries || !keys || !sorted || !slots) {
+        allocation_failed();
+    }
+
+    uint32_t strings_size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const char* name = symbol_name(table, i);
+        entries[i].name = strings_size;
+        entries[i].len = symbol_name_len(table, i);
+        entries[i].addr = table->tbl[i].addr;
+        entries[i].hash = pool_hash(&table->names, table->tbl[i].name);
+        strings_size += entries[i].len + 1;
+
+        keys[i].name = name;
+        keys[i].entry = i;
+
+        uint32_t slot = entries[i].hash & (hash_cap - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (hash_cap - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    qsort(keys, count, sizeof(SortKey), compare_keys);
+    for (uint32_t i = 0; i < count; i++) {
+        sorted[i] = keys[i].entry;
+    }
+
+    SymbolIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYMBOL_INDEX_MAGIC, sizeof(header.magic));
+    header.version = SYMBOL_INDEX_VERSION;
+    header.count = count;
+    header.entries_offset = align_up(sizeof(header));
+    header.sorted_offset = header.entries_offset + count * sizeof(SymbolIndexEntry);
+    header.hash_offset = align_up(header.sorted_offset + count * sizeof(uint32_t));
+    header.hash_cap = hash_cap;
+    header.strings_offset = align_up(header.hash_offset + hash_cap * sizeof(uint32_t));
+    header.strings_size = align_up(strings_size);
+    header.source_size = source_size;
+    header.source_hash = source_hash;
+
+    Writer output;
+    int err = open_writer(&output, filename, header.strings_offset + header.strings_size);
+    if (err == 0) {
+        put_bytes(&output, (const char*) &header, sizeof(header));
+        put_padding(&output, header.entries_offset - sizeof(header));
+        put_bytes(&output, (const char*) entries, count * sizeof(SymbolIndexEntry));
+        put_bytes(&output, (const char*) sorted, count * sizeof(uint32_t));
+        put_padding(&output, header.hash_offset - header.sorted_offset - count * sizeof(uint32_t));
+        put_bytes(&output, (const char*) slots, hash_cap * sizeof(uint32_t));
+        put_padding(&output, header.strings_offset - header.hash_offset - hash_cap * sizeof(uint32_t));
+        for (uint32_t i = 0; i < count; i++) {
+            put_bytes(&output, symbol_name(table, i), entries[i].len + 1);
+        }
+        put_padding(&output, header.strings_size - strings_size);
+        err = close_writer(&output);
+    }
+
+    free(entries);
+    free(keys);
+    free(sorted);
+    free(slots);
+    return err;
+}
+
+/* Returns 1 if the COUNT items of SIZE bytes at OFFSET lie within the first
+   LIMIT bytes and start at an aligned offset.
+ */
+static int section_fits(uint32_t offset, uint32_t count, size_t size, size_t limit) {
+    return offset % sizeof(uint32_t) == 0 && offset <= limit
+        && (uint64_t) count * size <= limit - offset;
+}
+
+/* Checks everything that lookups rely on, so that they never need to. */
+static int index_valid(const SymbolIndex* index, size_t size) {
+    const SymbolIndexHeader* header = index->header;
+    uint32_t count = header->count;
+    if (!section_fits(header->entries_offset, count, sizeof(SymbolIndexEntry), size)
+        || !section_fits(header->sorted_offset, count, sizeof(uint32_t), size)
+        || !section_fits(header->hash_offset, header->hash_cap, sizeof(uint32_t), size)
+        || !section_fits(header->strings_offset, header->strings_size, 1, size)
+        || (header->hash_cap & (header->hash_cap - 1)) != 0
+        || header->hash_cap < (uint64_t) count + (count > 0)) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const SymbolIndexEntry* entry = &index->entries[i];
+        if ((uint64_t) entry->name + entry->len >= header->strings_size
+            || index->strings[entry->name + entry->len] != '\0'
+            || index->sorted[i] >= count) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->hash_cap; i++) {
+        if (index->slots[i] > count) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int open_symbol_index(SymbolIndex* index, const char* filename) {
+    if (open_reader(&index->file, filename) != 0) {
+        return -1;
+    }
+    const char* data = index->file.data;
+    size_t size = index->file.size;
+    index->header = (const SymbolIndexHeader*) data;
+    if (size < sizeof(SymbolIndexHeader) || (uintptr_t) data % INDEX_ALIGN != 0
+        || memcmp(index->header->magic, SYMBOL_INDEX_MAGIC, sizeof(index->header->magic)) != 0
+        || index->header->version != SYMBOL_INDEX_VERSION) {
+        close_reader(&index->file);
+        return -1;
+    }
+
+    index->entries = (const SymbolIndexEntry*) (data + index->header->entries_offset);
+    index->sorted = (const uint32_t*) (data + index->header->sorted_offset);
+    index->slots = (const uint32_t*) (data + index->header->hash_offset);
+    index->strings = data + index->header->strings_offset;
+    if (!index_valid(index, size)) {
+        close_reader(&index->file);
+        return -1;
+    }
+    return 0;
+}
+
+void close_symbol_index(SymbolIndex* index) {
+    close_reader(&index->file);
+    memset(index, 0, sizeof(SymbolIndex));
+}
+
+int symbol_index_matches(const SymbolIndex* index, const char* data, size_t size) {
+    return index->header->source_size == size
+        && index->header->source_hash == hash_name(data, size);
+}
+
+static int entry_equals(const SymbolIndex* index, const SymbolIndexEntry* entry,
+    const char* name, size_t len) {
+    return entry->len == len && memcmp(index->strings + entry->name, name, len) == 0;
+}
+
+int64_t find_symbol(const SymbolIndex* index, const char* name, size_t len) {
+    uint32_t cap = index->header->hash_cap;
+    if (cap == 0) {
+        return -1;
+    }
+    uint32_t hash = hash_name(name, len);
+    for (uint32_t slot = hash & (cap - 1); index->slots[slot]; slot = (slot + 1) & (cap - 1)) {
+        const SymbolIndexEntry* entry = &index->entries[index->slots[slot] - 1];
+        if (entry->hash == hash && entry_equals(index, entry, name, len)) {
+            return entry->addr;
+        }
+    }
+    return -1;
+}
+
+int64_t find_symbol_sorted(const SymbolIndex* index, const char* name, size_t len) {
+    uint32_t low = 0, high = index->header->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        const SymbolIndexEntry* entry = &index->entries[index->sorted[mid]];
+        const char* entry_name = index->strings + entry->name;
+
+        // compare as strcmp() would, with NAME ending after LEN bytes
+        size_t n = entry->len < len ? entry->len : len;
+        int cmp = memcmp(entry_name, name, n);
+        if (cmp == 0) {
+            cmp = (entry->len > len) - (entry->len < len);
+        }
+        if (cmp == 0) {
+            return entry->addr;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -1;
+}
+
+void load_symbol_index(const SymbolIndex* index, SymbolTable* table) {
+    // names in an index are already unique, so skip the duplicate checks
+    int mode = table->mode;
+    table->mode = SYMTBL_NON_UNIQUE;
+    reserve_table(table, index->header->count);
+    for (uint32_t i = 0; i < index->header->count; i++) {
+        const SymbolIndexEntry* entry = &index->entries[i];
+        add_to_table_span(table, index->strings + entry->name, entry->len, entry->addr);
+    }
+    table->mode = mode;
+}
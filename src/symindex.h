@@ -0,0 +1,90 @@
+#ifndef SYMINDEX_H
+#define SYMINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tables.h"
+#include "reader.h"
+
+#define SYMBOL_INDEX_MAGIC "MSYM"
+#define SYMBOL_INDEX_VERSION 1
+
+/* Appended to the name of an intermediate file to get its symbol index. */
+#define SYMBOL_INDEX_SUFFIX ".sym"
+
+/* A symbol index file holds the symbol table of pass one so that pass two
+   can run on its own. It contains the header, the entries in table order,
+   the entry numbers sorted by name, a hash table of entry numbers, and a
+   string pool, each starting at a multiple of 8 bytes. Like binary objects,
+   it is little-endian and meant to be mapped and used in place.
+ */
+typedef struct {
+    char magic[4];          // SYMBOL_INDEX_MAGIC, not null-terminated
+    uint32_t version;
+    uint32_t count;
+    uint32_t entries_offset;
+    uint32_t sorted_offset;
+    uint32_t hash_offset;
+    uint32_t hash_cap;      // a power of two, or 0 if COUNT is 0
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    uint32_t source_size;   // size of the intermediate file it belongs to
+    uint32_t source_hash;   // hash_name() of the intermediate file
+    uint32_t reserved;
+} SymbolIndexHeader;
+
+typedef struct {
+    uint32_t name;          // offset of the null-terminated name in the pool
+    uint32_t len;
+    uint32_t addr;
+    uint32_t hash;          // hash_name() of the name
+} SymbolIndexEntry;
+
+/* A mapped symbol index file. Slots of the hash table hold an entry number
+   plus one, or 0 if empty, and are probed linearly.
+ */
+typedef struct {
+    Reader file;
+    const SymbolIndexHeader* header;
+    const SymbolIndexEntry* entries;
+    const uint32_t* sorted;
+    const uint32_t* slots;
+    const char* strings;
+} SymbolIndex;
+
+/* Returns the name of the symbol index of the intermediate file INT_NAME. The
+   caller must free it.
+ */
+char* symbol_index_name(const char* int_name);
+
+/* Writes TABLE to the symbol index file FILENAME, recording SOURCE_SIZE and
+   SOURCE_HASH of its intermediate file. Returns 0 on success and -1 on error.
+ */
+int write_symbol_index(const char* filename, SymbolTable* table, uint32_t source_size,
+    uint32_t source_hash);
+
+/* Maps and checks the symbol index file FILENAME. Returns 0 on success and -1
+   if it cannot be read or is not a valid index.
+ */
+int open_symbol_index(SymbolIndex* index, const char* filename);
+
+void close_symbol_index(SymbolIndex* index);
+
+/* Returns 1 if INDEX was written for the SIZE bytes of intermediate file at
+   DATA.
+ */
+int symbol_index_matches(const SymbolIndex* index, const char* data, size_t size);
+
+/* Returns the address of the LEN bytes at NAME, or -1 if it is not in INDEX.
+   Uses the hash table.
+ */
+int64_t find_symbol(const SymbolIndex* index, const char* name, size_t len);
+
+/* Same as find_symbol(), but uses binary search over the sorted entries. */
+int64_t find_symbol_sorted(const SymbolIndex* index, const char* name, size_t len);
+
+/* Adds every symbol in INDEX to TABLE, in the order of the original table. */
+void load_symbol_index(const SymbolIndex* index, SymbolTable* table);
+
+#endif
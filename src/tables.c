@@ -2,9 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <setjmp.h>
 
 #include "utils.h"
 #include "tables.h"
+#include "arena.h"
 
 const int SYMTBL_NON_UNIQUE = 0;
 const int SYMTBL_UNIQUE_NAME = 1;
@@ -12,11 +14,26 @@ const int SYMTBL_UNIQUE_NAME = 1;
 #define INITIAL_SIZE 5
 #define SCALING_FACTOR 2
 
+/* Where allocation_failed() jumps to on the calling thread, if set. */
+static __thread jmp_buf* allocation_handler = NULL;
+
 /*******************************
  * Helper Functions
  *******************************/
 
+jmp_buf* on_allocation_failure(jmp_buf* handler) {
+    jmp_buf* previous = allocation_handler;
+    allocation_handler = handler;
+    return previous;
+}
+
 void allocation_failed() {
+    jmp_buf* handler = allocation_handler;
+    if (handler) {
+        // logging could need memory as well, so leave that to the handler
+        allocation_handler = NULL;
+        longjmp(*handler, 1);
+    }
     write_to_log("Error: allocation failed\n");
     exit(1);
 }
@@ -29,14 +46,41 @@ void name_already_exists(const char* name) {
     write_to_log("Error: name '%s' already exists in table.\n", name);
 }
 
-void write_symbol(FILE* output, uint32_t addr, const char* name) {
-    fprintf(output, "%u\t%s\n", addr, name);
+void write_symbol(Writer* output, uint32_t addr, const char* name) {
+    put_dec32(output, addr);
+    put_char(output, '\t');
+    put_str(output, name);
+    put_char(output, '\n');
+}
+
+const char* symbol_name(const SymbolTable* table, uint32_t i) {
+    return pool_str(&table->names, table->tbl[i].name);
+}
+
+uint32_t symbol_name_len(const SymbolTable* table, uint32_t i) {
+    return pool_len(&table->names, table->tbl[i].name);
 }
 
 /*******************************
  * Symbol Table Functions
  *******************************/
 
+/* Gives TABLE room for CAP symbols. Names are held separately, so that a
+   relocation table with many symbols of few names costs 8 bytes a symbol.
+ */
+static void grow_table(SymbolTable* table, uint32_t cap) {
+    table->tbl = mem_realloc(table->tbl, sizeof(Symbol) * cap);
+    table->cap = cap;
+}
+
+/* Gives the first symbols of TABLE room for every name its pool can hold. */
+static void grow_first(SymbolTable* table) {
+    if (table->first_cap < table->names.cap) {
+        table->first = mem_realloc(table->first, sizeof(uint32_t) * table->names.cap);
+        table->first_cap = table->names.cap;
+    }
+}
+
 /* Creates a new SymbolTable containg 0 elements and returns a pointer to that
    table. Multiple SymbolTables may exist at the same time. 
    If memory allocation fails, you should call allocation_failed(). 
@@ -44,53 +88,80 @@ void write_symbol(FILE* output, uint32_t addr, const char* name) {
    to store this value for use during add_to_table().
  */
 SymbolTable* create_table(int mode) {
+    return create_table_sized(mode, INITIAL_SIZE);
+}
+
+SymbolTable* create_table_sized(int mode, uint32_t cap_hint) {
     // Allocate memory for table
-    SymbolTable * table = malloc(sizeof(SymbolTable));
-    if (!table) {
-       allocation_failed();
-    }
+    SymbolTable * table = mem_alloc(sizeof(SymbolTable));
 
     // Initialize table attributes
     table->len = 0; // how many symbols the table contains
-    table->cap = INITIAL_SIZE; // max number of symbols that can be stored using the allocated memory
     table->mode = mode;
+    table->tbl = NULL;
+    table->first = NULL;
+    table->first_cap = 0;
+    table->sites = NULL;
+    table->site_start = NULL;
+    table->sites_valid = 0;
+    uint32_t cap = cap_hint > INITIAL_SIZE ? cap_hint : INITIAL_SIZE;
+    init_pool(&table->names, cap);
 
-    // Add symbols to table
     // Allocate memory for symbols
-    Symbol * symbols = malloc(sizeof(Symbol) * INITIAL_SIZE);
-    if (!symbols) {
-       allocation_failed();
-    }
-
-    // Set table pointer to symbols
-    table->tbl = symbols;
+    grow_table(table, cap);
+    grow_first(table);
 
     return table;
 }
 
-/* Frees the given SymbolTable and all associated memory. */
-void free_table(SymbolTable* table) {
-    Symbol * symbols = table->tbl;
-    int len = table->len;
-
-    for (int i = 0; i < len; i++) {
-      free(symbols->name);
-      symbols++;
+void reserve_table(SymbolTable* table, uint32_t count) {
+    if (table->cap - table->len < count) {
+        uint64_t cap = (uint64_t) table->len + count;
+        if (cap > UINT32_MAX / 2) {
+            allocation_failed();
+        }
+        grow_table(table, cap);
     }
+    reserve_pool(&table->names, count);
+    grow_first(table);
+}
 
-    free(table->tbl);
-    free(table);
+/* Frees the given SymbolTable and all associated memory. The names all live
+   in its string pool, so they go in a few frees rather than one per symbol.
+ */
+void free_table(SymbolTable* table) {
+    free_pool(&table->names);
+    mem_free(table->tbl);
+    mem_free(table->first);
+    mem_free(table->sites);
+    mem_free(table->site_start);
+    mem_free(table);
+}
+
+void clear_table(SymbolTable* table) {
+    clear_pool(&table->names);
+    table->len = 0;
+    table->sites_valid = 0;
 }
 
-/* A suggested helper function for copying the contents of a string. */
-static char* create_copy_of_str(const char* str) {
-    size_t len = strlen(str) + 1;
-    char *buf = (char *) malloc(len);
-    if (!buf) {
-       allocation_failed();
+/* Adds a symbol at ADDR whose name is the string NAME of the table's pool.
+   IS_NEW is set if the name was not in the pool, and so not in the table,
+   before. Returns -1 if the name is taken and must be unique.
+ */
+static int add_symbol(SymbolTable* table, uint32_t name, int is_new, uint32_t addr) {
+    if (!is_new && table->mode == SYMTBL_UNIQUE_NAME) {
+      name_already_exists(pool_str(&table->names, name));
+      return -1;
     }
-    strncpy(buf, str, len); 
-    return buf;
+    if (is_new) {
+      grow_first(table);
+      table->first[name] = table->len;
+    }
+    table->tbl[table->len].name = name;
+    table->tbl[table->len].addr = addr;
+    table->len += 1;
+    table->sites_valid = 0;
+    return 0;
 }
 
 /* Adds a new symbol and its address to the SymbolTable pointed to by TABLE. 
@@ -108,82 +179,275 @@ static char* create_copy_of_str(const char* str) {
    Otherwise, you should store the symbol name and address and return 0.
  */
 int add_to_table(SymbolTable* table, const char* name, uint32_t addr) {
+    return add_to_table_span(table, name, strlen(name), addr);
+}
+
+int add_to_table_span(SymbolTable* table, const char* name, size_t name_len, uint32_t addr) {
     // Check if address is word aligned
     if (addr % 4 != 0)  { 
       addr_alignment_incorrect();
       return -1;
     }
 
-    // Get table attributes
-    Symbol * symbols = table->tbl; // pointer to symbol list
-    int len = table->len; // get length of list
-    int cap = table->cap; // get max capacity of list
-    int mode = table->mode; // mode == SYMTBL_UNIQUE_NAME or SYMTBL_NON_UNIQUE
-
-    // Copy name pointer to allocated memory
-    char * name_copy = create_copy_of_str(name);
-
     // Check if table is full
-    if (len == cap) {
-      //printf("%s", "Resizing");
-      // Allocate more memory
-      table->tbl = (Symbol *) realloc(table->tbl, (sizeof(Symbol) * (cap * SCALING_FACTOR)));
-      if (!table->tbl) {
+    if (table->len == table->cap) {
+      if (table->cap > UINT32_MAX / 2 / SCALING_FACTOR) {
         allocation_failed();
       }
-      table->cap = cap * SCALING_FACTOR;
-      symbols = table->tbl;
+      grow_table(table, table->cap * SCALING_FACTOR);
     }
 
-    // Iterate over symbols array 
-    for (int i = 0; i < len; i++) {
-        char * current_name = symbols->name;
-        // check if entry with same name already exists
-        if (mode == SYMTBL_UNIQUE_NAME && strcmp(current_name, name) == 0)  { 
-          name_already_exists(current_name);
-          return -1;
+    // the copy of the name is kept in the pool, once however often it is added
+    uint32_t num_names = table->names.len;
+    uint32_t id = pool_intern(&table->names, name, name_len);
+    return add_symbol(table, id, id == num_names, addr);
+}
+
+/* Returns the address (byte offset) of the given symbol. If a symbol with name
+   NAME is not present in TABLE, return -1.
+ */
+int64_t get_addr_for_symbol(SymbolTable* table, const char* name) {
+    return get_addr_for_symbol_span(table, name, strlen(name));
+}
+
+int64_t get_addr_for_symbol_span(SymbolTable* table, const char* name, size_t name_len) {
+    uint32_t id = pool_find(&table->names, name, name_len);
+    if (id == NO_STRING) {
+      return -1;
+    }
+    return table->tbl[table->first[id]].addr;
+}
+
+/* Groups the symbols of TABLE by name: a counting sort on the name ids,
+   which keeps the symbols of each name in the order they were added.
+ */
+static void build_sites(SymbolTable* table) {
+    uint32_t num_names = table->names.len;
+    mem_free(table->sites);
+    mem_free(table->site_start);
+    table->sites = mem_alloc((table->len + 1) * sizeof(uint32_t));
+    table->site_start = mem_calloc(num_names + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < table->len; i++) {
+        table->site_start[table->tbl[i].name + 1]++;
+    }
+    for (uint32_t id = 0; id < num_names; id++) {
+        table->site_start[id + 1] += table->site_start[id];
+    }
+    // each group fills up from its start, leaving site_start[id] at its end,
+    // which is where the next group starts, so shift them back one after
+    for (uint32_t i = 0; i < table->len; i++) {
+        table->sites[table->site_start[table->tbl[i].name]++] = i;
+    }
+    for (uint32_t id = num_names; id > 0; id--) {
+        table->site_start[id] = table->site_start[id - 1];
+    }
+    table->site_start[0] = 0;
+    table->sites_valid = 1;
+}
+
+const uint32_t* find_sites(SymbolTable* table, const char* name, size_t len, uint32_t* count) {
+    uint32_t id = pool_find(&table->names, name, len);
+    if (id == NO_STRING) {
+        *count = 0;
+        return NULL;
+    }
+    if (!table->sites_valid) {
+        build_sites(table);
+    }
+    *count = table->site_start[id + 1] - table->site_start[id];
+    return table->sites + table->site_start[id];
+}
+
+void append_table(SymbolTable* dst, SymbolTable* src, uint32_t offset) {
+    if (dst->cap - dst->len < src->len) {
+        uint32_t cap = dst->cap;
+        while (cap - dst->len < src->len) {
+            if (cap > UINT32_MAX / 2 / SCALING_FACTOR) {
+                allocation_failed();
+            }
+            cap *= SCALING_FACTOR;
+        }
+        grow_table(dst, cap);
+    }
+    for (uint32_t i = 0; i < src->len; i++) {
+        uint32_t name = src->tbl[i].name;
+        uint32_t num_names = dst->names.len;
+        uint32_t id = pool_intern_hashed(&dst->names, pool_str(&src->names, name),
+            pool_len(&src->names, name), pool_hash(&src->names, name));
+        if (id == num_names) {
+            grow_first(dst);
+            dst->first[id] = dst->len;
         }
-        symbols++; // point to next symbol 
+        dst->tbl[dst->len].name = id;
+        dst->tbl[dst->len].addr = src->tbl[i].addr + offset;
+        dst->len += 1;
     }
+    dst->sites_valid = 0;
+    clear_table(src);
+}
 
-    Symbol newSymbol;
-    newSymbol.name = name_copy;
-    newSymbol.addr = addr;
+/* An address and the number of the symbol at it, for sorting. */
+typedef struct {
+    uint32_t addr;
+    uint32_t symbol;
+} AddrEntry;
+
+static int compare_addr_entries(const void* a, const void* b) {
+    const AddrEntry* x = a;
+    const AddrEntry* y = b;
+    if (x->addr != y->addr) {
+        return (x->addr > y->addr) - (x->addr < y->addr);
+    }
+    return (x->symbol > y->symbol) - (x->symbol < y->symbol);
+}
 
-    *symbols = newSymbol;
-    table->len += 1;
+void build_addr_index(AddrIndex* index, const SymbolTable* table) {
+    index->len = table->len;
+    index->addrs = mem_alloc((table->len + 1) * sizeof(uint32_t));
+    index->symbols = mem_alloc((table->len + 1) * sizeof(uint32_t));
+
+    int sorted = 1;
+    for (uint32_t i = 0; i < table->len; i++) {
+        index->addrs[i] = table->tbl[i].addr;
+        index->symbols[i] = i;
+        if (i > 0 && index->addrs[i] < index->addrs[i - 1]) {
+            sorted = 0;
+        }
+    }
+    if (sorted) {
+        return;
+    }
 
-    return 0;
+    AddrEntry* entries = mem_alloc((table->len + 1) * sizeof(AddrEntry));
+    for (uint32_t i = 0; i < table->len; i++) {
+        entries[i].addr = table->tbl[i].addr;
+        entries[i].symbol = i;
+    }
+    qsort(entries, table->len, sizeof(AddrEntry), compare_addr_entries);
+    for (uint32_t i = 0; i < table->len; i++) {
+        index->addrs[i] = entries[i].addr;
+        index->symbols[i] = entries[i].symbol;
+    }
+    mem_free(entries);
 }
 
-/* Returns the address (byte offset) of the given symbol. If a symbol with name
-   NAME is not present in TABLE, return -1.
+void free_addr_index(AddrIndex* index) {
+    mem_free(index->addrs);
+    mem_free(index->symbols);
+    index->addrs = NULL;
+    index->symbols = NULL;
+    index->len = 0;
+}
+
+/* Returns the symbol of INDEX at position I, which has the highest address
+   not above the one looked up, going back to the first symbol there.
  */
-int64_t get_addr_for_symbol(SymbolTable* table, const char* name) {
-    Symbol * symbols = table->tbl; // pointer to symbol list
-    int len = table->len; // get length of list
+static int64_t first_at(const AddrIndex* index, uint32_t i) {
+    while (i > 0 && index->addrs[i - 1] == index->addrs[i]) {
+        i--;
+    }
+    return index->symbols[i];
+}
 
-    for (int i = 0; i < len; i++) {
-      char * current = symbols->name;  
-      if (strcmp(current, name) == 0)  { // compare each entry to name
-        return symbols->addr;
-      }
-      symbols++;  // point to the next element in the list
+int64_t find_symbol_at(const AddrIndex* index, uint32_t addr) {
+    if (index->len == 0 || addr < index->addrs[0]) {
+        return -1;
+    }
+    uint32_t lo = 0;
+    uint32_t hi = index->len - 1;
+    if (addr >= index->addrs[hi]) {
+        return first_at(index, hi);
+    }
+
+    // addrs[lo] <= addr < addrs[hi] throughout. A probe by interpolation
+    // usually lands within a few symbols, so it is bracketed with a second
+    // probe GUARD symbols away; if that fails to halve the range, bisect.
+    const uint32_t guard = 8;
+    while (hi - lo > 1) {
+        uint32_t before = hi - lo;
+        uint32_t probe = lo + (uint64_t) (addr - index->addrs[lo]) * (hi - lo)
+            / (index->addrs[hi] - index->addrs[lo]);
+        probe = probe > lo ? probe : lo + 1;
+        probe = probe < hi ? probe : hi - 1;
+        if (index->addrs[probe] <= addr) {
+            lo = probe;
+            uint32_t next = hi - lo > guard ? lo + guard : hi;
+            if (index->addrs[next] > addr) {
+                hi = next;
+            } else {
+                lo = next;
+            }
+        } else {
+            hi = probe;
+            uint32_t next = hi - lo > guard ? hi - guard : lo;
+            if (index->addrs[next] <= addr) {
+                lo = next;
+            } else {
+                hi = next;
+            }
+        }
+        if (hi - lo > 1 && 2 * (hi - lo) > before) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (index->addrs[mid] <= addr) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+    return first_at(index, lo);
+}
+
+int64_t find_symbol_at_binary(const AddrIndex* index, uint32_t addr) {
+    // the first position with a higher address
+    uint32_t lo = 0;
+    uint32_t hi = index->len;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->addrs[mid] <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    return lo > 0 ? first_at(index, lo - 1) : -1;
+}
 
-    return -1;   
+void write_symbol_map(const AddrIndex* index, const SymbolTable* table, uint32_t end,
+    Writer* output) {
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < index->len; i++) {
+        uint32_t addr = index->addrs[i];
+        if (next <= i) {
+            next = i + 1;
+            while (next < index->len && index->addrs[next] == addr) {
+                next++;
+            }
+        }
+        uint32_t until = next < index->len ? index->addrs[next] : end;
+        put_dec32(output, addr);
+        put_char(output, '\t');
+        put_dec32(output, until > addr ? until - addr : 0);
+        put_char(output, '\t');
+        put_str(output, symbol_name(table, index->symbols[i]));
+        put_char(output, '\n');
+    }
 }
 
 /* Writes the SymbolTable TABLE to OUTPUT. You should use write_symbol() to
    perform the write. Do not print any additional whitespace or characters.
  */
 void write_table(SymbolTable* table, FILE* output) {
+    Writer writer;
+    open_writer_file(&writer, output);
+    write_table_to(table, &writer);
+    close_writer(&writer);
+}
+
+void write_table_to(SymbolTable* table, Writer* output) {
     int len = table->len;
-    Symbol * symbols = table->tbl;
 
     for (int i = 0; i < len; i++) {
-      //printf("%s\n", "made it this far");
-      write_symbol(output, table->tbl[i].addr, table->tbl[i].name);
-      //symbols++;
+      write_symbol(output, table->tbl[i].addr, symbol_name(table, i));
     }
 }
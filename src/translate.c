@@ -4,13 +4,63 @@
 #include <stdint.h>
 
 #include "tables.h"
+#include "arena.h"
 #include "translate_utils.h"
 #include "translate.h"
 
 /* SOLUTION CODE BELOW */
 const int TWO_POW_SEVENTEEN = 131072;    // 2^17
 
-/* Writes instructions during the assembler's first pass to OUTPUT. The case
+/* How the arguments of an instruction are laid out, and so which write_*()
+   function encodes it.
+ */
+typedef enum {
+    FMT_RTYPE, FMT_SHIFT, FMT_JR, FMT_ADDIU, FMT_ORI, FMT_LUI, FMT_MEM,
+    FMT_BRANCH, FMT_JUMP
+} Format;
+
+typedef struct {
+    const char* name;
+    Format format;
+    uint8_t bits;       // funct for R-type instructions, opcode otherwise
+} InstInfo;
+
+static const InstInfo INSTRUCTIONS[NUM_OPS] = {
+    [OP_ADDU]  = { "addu",  FMT_RTYPE,  0x21 },
+    [OP_OR]    = { "or",    FMT_RTYPE,  0x25 },
+    [OP_SLT]   = { "slt",   FMT_RTYPE,  0x2a },
+    [OP_SLTU]  = { "sltu",  FMT_RTYPE,  0x2b },
+    [OP_SLL]   = { "sll",   FMT_SHIFT,  0x00 },
+    [OP_JR]    = { "jr",    FMT_JR,     0x08 },
+    [OP_ADDIU] = { "addiu", FMT_ADDIU,  0x09 },
+    [OP_ORI]   = { "ori",   FMT_ORI,    0x0d },
+    [OP_LUI]   = { "lui",   FMT_LUI,    0x0f },
+    [OP_LB]    = { "lb",    FMT_MEM,    0x20 },
+    [OP_LBU]   = { "lbu",   FMT_MEM,    0x24 },
+    [OP_LW]    = { "lw",    FMT_MEM,    0x23 },
+    [OP_SB]    = { "sb",    FMT_MEM,    0x28 },
+    [OP_SW]    = { "sw",    FMT_MEM,    0x2b },
+    [OP_BEQ]   = { "beq",   FMT_BRANCH, 0x04 },
+    [OP_BNE]   = { "bne",   FMT_BRANCH, 0x05 },
+    [OP_J]     = { "j",     FMT_JUMP,   0x02 },
+    [OP_JAL]   = { "jal",   FMT_JUMP,   0x03 },
+    [OP_MULT]  = { "mult",  FMT_RTYPE,  0x18 },
+    [OP_DIV]   = { "div",   FMT_RTYPE,  0x1a },
+    [OP_MFHI]  = { "mfhi",  FMT_RTYPE,  0x10 },
+    [OP_MFLO]  = { "mflo",  FMT_RTYPE,  0x12 },
+};
+
+/* Returns the opcode named NAME, or OP_INVALID if there is none. */
+static Opcode find_opcode(const Token* name) {
+    for (int op = OP_ADDU; op < NUM_OPS; op++) {
+        if (token_equals(name, INSTRUCTIONS[op].name)) {
+            return op;
+        }
+    }
+    return OP_INVALID;
+}
+
+/* Adds instructions during the assembler's first pass to OUTPUT. The case
    for general instructions has already been completed, but you need to write
    code to translate the li and other pseudoinstructions. Your pseudoinstruction 
    expansions should not have any side effects.
@@ -36,80 +86,220 @@ const int TWO_POW_SEVENTEEN = 131072;    // 2^17
    larger than the largest 32 bit number to be loaded with li. You should follow
    the above rules if MARS behaves differently.
 
-   Use fprintf() to write. If writing multiple instructions, make sure that 
-   each instruction is on a different line.
+   Each instruction is added with emit_inst(), which parses it into an Inst.
 
    Returns the number of instructions written (so 0 if there were any errors).
  */
 unsigned write_pass_one(FILE* output, const char* name, char** args, int num_args) {
-    if (strcmp(name, "li") == 0) {
-        char * immStr = args[1];
-        char *endc = "";
-        long int imm = strtol(immStr, &endc, 0);
+    Token name_tok = token_from_str(name, TOK_MNEMONIC);
+    Token arg_toks[num_args > 0 ? num_args : 1];
+    for (int i = 0; i < num_args; i++) {
+        arg_toks[i] = operand_from_str(args[i]);
+    }
 
-        if (num_args != 2 || INT32_MIN >= imm || imm >= UINT32_MAX || !output || !(*args))  {
+    Program prog;
+    Writer writer;
+    init_program(&prog, 1);
+    unsigned written = write_pass_one_tokens(&prog, &name_tok, arg_toks, num_args);
+    open_writer_file(&writer, output);
+    write_program_text(&prog, &writer);
+    close_writer(&writer);
+    free_program(&prog);
+    return written;
+}
+
+/* Same as write_pass_one(), but for an instruction given as tokens. */
+unsigned write_pass_one_tokens(Program* output, const Token* name, const Token* args, int num_args) {
+    Token zero = token_from_str("$0", TOK_REGISTER);
+    Token at = token_from_str("$at", TOK_REGISTER);
+
+    if (token_equals(name, "li")) {
+        if (num_args != 2 || !output)  {
+          return 0;  
+        }
+
+        long int imm = 0;
+        parse_num_span(&imm, args[1].start, args[1].len);
+        if (INT32_MIN >= imm || imm >= UINT32_MAX)  {
           return 0;  
         } else  {
           // create instruction for li
 
           if (imm >= INT16_MIN && imm <= INT16_MAX) { // imm is 16 bits
-            fprintf(output, "%s %s %s %s\n", "addiu", args[0], "$0", args[1]);
+            Token addiu = token_from_str("addiu", TOK_MNEMONIC);
+            Token addiu_args[3] = { args[0], zero, args[1] };
+            emit_inst(output, &addiu, addiu_args, 3);
             return 1;
           } else  { // imm is 32 bits
             // split imm  into upper and lower halfs
-            
+            char upper_buf[16], lower_buf[16];
             uint32_t upperImm = imm >> 16;
             uint32_t lowerImm = imm & 0x0000FFFF;
-            fprintf(output, "%s %s %u\n", "lui", "$at", upperImm);
-            fprintf(output, "%s %s %s %u\n", "ori", args[0], "$at", lowerImm);
-            //printf("%s\n", "made it this far");
+            snprintf(upper_buf, sizeof(upper_buf), "%u", upperImm);
+            snprintf(lower_buf, sizeof(lower_buf), "%u", lowerImm);
+
+            Token lui = token_from_str("lui", TOK_MNEMONIC);
+            Token lui_args[2] = { at, token_from_str(upper_buf, TOK_IMMEDIATE) };
+            emit_inst(output, &lui, lui_args, 2);
+
+            Token ori = token_from_str("ori", TOK_MNEMONIC);
+            Token ori_args[3] = { args[0], at, token_from_str(lower_buf, TOK_IMMEDIATE) };
+            emit_inst(output, &ori, ori_args, 3);
           }
 
           return 2;
         }
-    } else if (strcmp(name, "move") == 0) {
+    } else if (token_equals(name, "move")) {
         if (num_args != 2)  {
           return 0;  
         } else  {
           // convert:
           // move $rt,$rs to addu $rt,$rs,$zero;
-          fprintf(output, "%s %s %s %s\n", "addu", args[0], args[1], "$0");
+          Token addu = token_from_str("addu", TOK_MNEMONIC);
+          Token addu_args[3] = { args[0], args[1], zero };
+          emit_inst(output, &addu, addu_args, 3);
           return 1;
         }
-    } else if (strcmp(name, "rem") == 0) {
+    } else if (token_equals(name, "rem")) {
         if (num_args != 3)  {
           return 0;  
         }  else {
           // convert rem $rd, $rs, $rt to div $rs, $rt; mfhi $rd;
-          fprintf(output, "%s %s %s\n", "div", args[1], args[2]);
-          fprintf(output, "%s \n", "mfhi", args[0]);
+          Token div = token_from_str("div", TOK_MNEMONIC);
+          emit_inst(output, &div, args + 1, 2);
+          Token mfhi = token_from_str("mfhi", TOK_MNEMONIC);
+          emit_inst(output, &mfhi, args, 1);
           return 2;
         }
-    } else if (strcmp(name, "bge") == 0) {
+    } else if (token_equals(name, "bge")) {
         if (num_args != 3)  {
           return 0;  
         } else  {
           // convert:
           // bge $rs,$rt,Label to slt $at,$rs,$rt; beq $at,$zero, Label;
-          fprintf(output, "%s %s %s %s\n", "slt", "$at", args[0], args[1]);
-          fprintf(output, "%s %s %s %s\n", "beq", "$at", "$0", args[2]);
+          Token slt = token_from_str("slt", TOK_MNEMONIC);
+          Token slt_args[3] = { at, args[0], args[1] };
+          emit_inst(output, &slt, slt_args, 3);
+          Token beq = token_from_str("beq", TOK_MNEMONIC);
+          Token beq_args[3] = { at, zero, args[2] };
+          emit_inst(output, &beq, beq_args, 3);
           return 2;
         }
-    } else if (strcmp(name, "bnez") == 0) {
+    } else if (token_equals(name, "bnez")) {
         if (num_args != 2)  {
           return 0;  
         } else  {
           // convert: 
           // bnez $rs,Label to bne $rs,$zero,Label;
-          fprintf(output, "%s %s %s %s\n", "bne", args[0], "$0", args[1]);
+          Token bne = token_from_str("bne", TOK_MNEMONIC);
+          Token bne_args[3] = { args[0], zero, args[1] };
+          emit_inst(output, &bne, bne_args, 3);
           return 1;
         }
     }
-    write_inst_string(output, name, args, num_args);
+    emit_inst(output, name, args, num_args);
     return 1;
 
 }
 
+/* Helpers for parse_inst(). Each stores the value of TOK in FIELD and returns
+   0, or returns -1 if TOK is not valid.
+ */
+static int parse_reg(uint8_t* field, const Token* tok) {
+    int reg = translate_reg_token(tok);
+    if (reg == -1) {
+        return -1;
+    }
+    *field = reg;
+    return 0;
+}
+
+static int parse_imm(int32_t* field, const Token* tok, long int lower_bound,
+    long int upper_bound) {
+
+    long int imm;
+    if (translate_num_token(&imm, tok, lower_bound, upper_bound) == -1) {
+        return -1;
+    }
+    *field = imm;
+    return 0;
+}
+
+/* Parses the instruction NAME with arguments ARGS into INST, checking that
+   the arguments are valid for it. Names of branch and jump targets are added
+   to PROG. Branch targets are not checked against the symbol table yet, since
+   it may not be complete.
+
+   Returns 0 on success. If the instruction is invalid, sets INST->op to
+   OP_INVALID and returns -1.
+ */
+int parse_inst(Program* prog, const Token* name, const Token* args, size_t num_args,
+    Inst* inst) {
+
+    Opcode op = find_opcode(name);
+    int err = -1;
+
+    switch (op == OP_INVALID ? -1 : (int) INSTRUCTIONS[op].format) {
+        case FMT_RTYPE:
+            err = num_args != 3 || parse_reg(&inst->rd, &args[0])
+                || parse_reg(&inst->rs, &args[1]) || parse_reg(&inst->rt, &args[2]);
+            break;
+        case FMT_SHIFT:
+            err = num_args != 3 || parse_reg(&inst->rd, &args[0])
+                || parse_reg(&inst->rt, &args[1]) || parse_imm(&inst->imm, &args[2], 0, 31);
+            break;
+        case FMT_JR:
+            err = num_args != 1 || parse_reg(&inst->rs, &args[0]);
+            break;
+        case FMT_ADDIU:
+            err = num_args != 3 || parse_reg(&inst->rt, &args[0])
+                || parse_reg(&inst->rs, &args[1])
+                || parse_imm(&inst->imm, &args[2], INT16_MIN, INT16_MAX);
+            break;
+        case FMT_ORI:
+            err = num_args != 3 || parse_reg(&inst->rt, &args[0])
+                || parse_reg(&inst->rs, &args[1])
+                || parse_imm(&inst->imm, &args[2], 0, UINT16_MAX);
+            break;
+        case FMT_LUI:
+            err = num_args != 2 || parse_reg(&inst->rt, &args[0])
+                || parse_imm(&inst->imm, &args[1], 0, UINT16_MAX);
+            break;
+        case FMT_MEM:
+            err = num_args != 3 || parse_reg(&inst->rt, &args[0])
+                || parse_imm(&inst->imm, &args[1], INT16_MIN, INT16_MAX)
+                || parse_reg(&inst->rs, &args[2]);
+            break;
+        case FMT_BRANCH:
+            err = num_args != 3 || parse_reg(&inst->rs, &args[0])
+                || parse_reg(&inst->rt, &args[1]);
+            if (!err) {
+                inst->sym = intern_name(prog, args[2].start, args[2].len);
+            }
+            break;
+        case FMT_JUMP:
+            err = num_args != 1;
+            if (!err) {
+                inst->sym = intern_name(prog, args[0].start, args[0].len);
+            }
+            break;
+    }
+
+    inst->op = err ? OP_INVALID : op;
+    return err ? -1 : 0;
+}
+
+void emit_inst(Program* prog, const Token* name, const Token* args, int num_args) {
+    Inst* inst = add_inst(prog);
+    parse_inst(prog, name, args, num_args, inst);
+
+    // pass two needs the text of anything it may reject
+    if (prog->keep_text || inst->op == OP_INVALID || inst->op == OP_BEQ
+        || inst->op == OP_BNE) {
+        inst->text = add_text(prog, name, args, num_args);
+    }
+}
+
 /* Writes the instruction in hexadecimal format to OUTPUT during pass #2.
    
    NAME is the name of the instruction, ARGS is an array of the arguments, and
@@ -120,203 +310,172 @@ unsigned write_pass_one(FILE* output, const char* name, char** args, int num_arg
    relocation table (RELTBL), and the fields for that symbol should be set to
    all zeros. 
 
-   You must perform error checking on all instructions and make sure that their
-   arguments are valid. If an instruction is invalid, you should not write 
-   anything to OUTPUT but simply return -1. MARS may be a useful resource for
-   this step.
-
-   Some function declarations for the write_*() functions are provided in translate.h, and you MUST implement these
-   and use these as function headers. You may use helper functions, but you still must implement
-   the provided write_* functions declared in translate.h.
+   If an instruction is invalid, nothing is written to OUTPUT.
 
    Returns 0 on success and -1 on error. 
  */
 int translate_inst(FILE* output, const char* name, char** args, size_t num_args, uint32_t addr,
     SymbolTable* symtbl, SymbolTable* reltbl) {
-    if (strcmp(name, "addu") == 0)       return write_rtype (0x21, output, args, num_args);
-    else if (strcmp(name, "or") == 0)    return write_rtype (0x25, output, args, num_args);
-    else if (strcmp(name, "slt") == 0)   return write_rtype (0x2a, output, args, num_args);
-    else if (strcmp(name, "sltu") == 0)  return write_rtype (0x2b, output, args, num_args);
-    else if (strcmp(name, "sll") == 0)   return write_shift (0x00, output, args, num_args);
-    else if (strcmp(name, "jr") == 0)    return write_jr    (0x08, output, args, num_args);
-    else if (strcmp(name, "addiu") == 0) return write_addiu (0x09, output, args, num_args);
-    else if (strcmp(name, "ori") == 0)   return write_ori   (0x0d, output, args, num_args);
-    else if (strcmp(name, "lui") == 0)   return write_lui   (0x0f, output, args, num_args);
-    else if (strcmp(name, "lb") == 0)    return write_mem   (0x20, output, args, num_args);
-    // make sure write_mem diffrentiates between lb and lbu
-    else if (strcmp(name, "lbu") == 0)   return write_mem   (0x24, output, args, num_args); 
-    else if (strcmp(name, "lw") == 0)    return write_mem   (0x23, output, args, num_args);
-    else if (strcmp(name, "sb") == 0)    return write_mem   (0x28, output, args, num_args);
-    else if (strcmp(name, "sw") == 0)    return write_mem   (0x2b, output, args, num_args);
-    else if (strcmp(name, "beq") == 0)   return write_branch(0x04, output, args, num_args, addr, symtbl);
-    else if (strcmp(name, "bne") == 0)   return write_branch(0x05, output, args, num_args, addr, symtbl);
-    else if (strcmp(name, "j") == 0)     return write_jump  (0x02, output, args, num_args, addr, reltbl);
-    else if (strcmp(name, "jal") == 0)   return write_jump  (0x03, output, args, num_args, addr, reltbl);
-    else if (strcmp(name, "mult") == 0)  return write_rtype (0x18, output, args, num_args);
-    else if (strcmp(name, "div") == 0)   return write_rtype (0x1a, output, args, num_args);
-    else if (strcmp(name, "mfhi") == 0)  return write_rtype (0x10, output, args, num_args);
-    else if (strcmp(name, "mflo") == 0)  return write_rtype (0x12, output, args, num_args);
-    return -1;
-}
+    Token name_tok = token_from_str(name, TOK_MNEMONIC);
+    Token arg_toks[num_args > 0 ? num_args : 1];
+    for (size_t i = 0; i < num_args; i++) {
+        arg_toks[i] = operand_from_str(args[i]);
+    }
 
-/* A helper function for writing most R-type instructions. You should use
-   translate_reg() to parse registers and write_inst_hex() to write to 
-   OUTPUT. Both are defined in translate_utils.h.
+    Program prog;
+    Inst inst;
+    init_program(&prog, 0);
+    memset(&inst, 0, sizeof(Inst));
+    int ret = parse_inst(&prog, &name_tok, arg_toks, num_args, &inst);
+    if (ret == 0) {
+        Writer writer;
+        open_writer_file(&writer, output);
+        ret = translate_inst_ir(&writer, &prog, &inst, addr, symtbl, reltbl);
+        close_writer(&writer);
+    }
+    free_program(&prog);
+    return ret;
+}
 
-   This function is INCOMPLETE. Complete the implementation below. You will
-   find bitwise operations to be the cleanest way to complete this function.
+/* Same as translate_inst(), but for an instruction that has already been
+   parsed by parse_inst(). Only branch targets can still be invalid.
  */
-int write_rtype(uint8_t funct, FILE* output, char** args, size_t num_args) {
-    // Perhaps perform some error checking?
+int translate_inst_ir(Writer* output, const Program* prog, const Inst* inst, uint32_t addr,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
+    if (inst->op == OP_BEQ || inst->op == OP_BNE) {
+        return write_branch(INSTRUCTIONS[inst->op].bits, output, inst, addr, prog, symtbl);
+    }
+    uint32_t instruction;
+    if (encode_inst(prog, inst, addr, NULL, reltbl, &instruction) != 0) {
+        return -1;
+    }
+    write_inst_hex(output, instruction);
+    return 0;
+}
 
-    int rd = translate_reg(args[0]);
-    int rs = translate_reg(args[1]);
-    int rt = translate_reg(args[2]);
+/* The *_word() functions below encode one already validated instruction
+   each. The write_*() functions write that encoding to OUTPUT with
+   write_inst_hex().
+ */
 
-    if (rd == -1 || rs == -1 || rt == -1)  {
-      return -1;
-    }
+/* Encodes an I-type instruction. */
+static uint32_t itype(uint8_t opcode, const Inst* inst) {
+    return ((uint32_t) opcode << 26) | (inst->rs << 21) | (inst->rt << 16)
+        | (inst->imm & 0x0000FFFF);
+}
 
+static uint32_t rtype_word(uint8_t funct, const Inst* inst) {
     // rs rt rd func
-    uint32_t instruction = 0;
-    // Our original shift method
-    instruction = ((((((instruction + rs) << 5) + rt) << 5)  + rd) << 11) + funct;
-    
-    // Below is one option to fix it
-    // instruction = funct + (rs << 21) + (rt << 16) + (rd << 11);
-
-    //instruction = 
-    
-    // Below is the second option to fix it
-    // instruction += funct;
-    // instruction += (rd << 11);
-    // instruction += (rt << 16);
-    // instruction += (rs << 21);
-    
-    write_inst_hex(output, instruction);
-    return 0;
+    return (inst->rs << 21) | (inst->rt << 16) | (inst->rd << 11) | funct;
 }
 
-/* A helper function for writing shift instructions. You should use 
-   translate_num() to parse numerical arguments. translate_num() is defined
-   in translate_utils.h.
+static uint32_t shift_word(uint8_t funct, const Inst* inst) {
+    return (inst->rt << 16) | (inst->rd << 11) | (inst->imm << 6) | funct;
+}
 
-   This function is INCOMPLETE. Complete the implementation below. You will
-   find bitwise operations to be the cleanest way to complete this function.
- */
-int write_shift(uint8_t funct, FILE* output, char** args, size_t num_args) {
-	// Perhaps perform some error checking?
+static uint32_t jr_word(uint8_t funct, const Inst* inst) {
+    return (inst->rs << 21) | funct;
+}
 
-    long int shamt;
-    int rd = translate_reg(args[0]);
-    int rt = translate_reg(args[1]);
-    int err = translate_num(&shamt, args[2], 0, 31);
+uint32_t encode_branch(const Inst* inst, uint32_t addr, uint32_t label_addr) {
+    //Please compute the branch offset using the MIPS rules.
+    int32_t offset = ((int32_t) label_addr - (int32_t) (addr + 4)) >> 2;
+    return ((uint32_t) INSTRUCTIONS[inst->op].bits << 26) | (inst->rs << 21)
+        | (inst->rt << 16) | (offset & 0x0000FFFF);
+}
 
-    if (rd == -1 || rt == -1 || err == -1) {
-      return -1;
+uint32_t rebase_word(uint32_t word, uint32_t offset) {
+    uint32_t opcode = word >> 26;
+    if (opcode != INSTRUCTIONS[OP_BEQ].bits && opcode != INSTRUCTIONS[OP_BNE].bits) {
+        return word;
     }
+    // the label stays put, so the offset shrinks by OFFSET / 4
+    return (word & 0xFFFF0000) | ((word - (offset >> 2)) & 0x0000FFFF);
+}
 
-    uint32_t instruction = 0;
-    instruction = ((((((instruction + rt) << 5) + rd) << 5) + shamt) << 6) + funct;
-    write_inst_hex(output, instruction);
+static int branch_word(const Inst* inst, uint32_t addr, int64_t label_addr,
+    uint32_t* instruction) {
+    if (label_addr == -1) {
+      return -1;
+    }
+    *instruction = encode_branch(inst, addr, label_addr);
     return 0;
 }
 
-/* The rest of your write_*() functions below */
-
-int write_jr(uint8_t funct, FILE* output, char** args, size_t num_args) {
-    // Perhaps perform some error checking?
-    int rs = translate_reg(args[0]);
-    if (rs == -1) {
+static int jump_word(uint8_t opcode, const Inst* inst, uint32_t addr,
+    const Program* prog, SymbolTable* reltbl, uint32_t* instruction) {
+    int err = add_to_table(reltbl, get_name(prog, inst->sym), addr);
+    if (err == -1)  {
       return -1;
     }
 
-    uint32_t instruction = 0;
-    instruction = ((instruction + rs) << 21) + funct;
-    write_inst_hex(output, instruction);
+    *instruction = (uint32_t) opcode << 26;
     return 0;
 }
 
-int write_addiu(uint8_t opcode, FILE* output, char** args, size_t num_args) {
-    // Perhaps perform some error checking?
-    
-    long int imm;
-    int rt = translate_reg(args[0]);
-    int rs = translate_reg(args[1]);
-    int err = translate_num(&imm, args[2], INT16_MIN, INT16_MAX);
+int64_t* resolve_targets(const Program* prog, SymbolTable* symtbl) {
+    int64_t* targets = mem_alloc((prog->names.len + 1) * sizeof(int64_t));
+    for (uint32_t id = 0; id < prog->names.len; id++) {
+        targets[id] = get_addr_for_symbol_span(symtbl, pool_str(&prog->names, id),
+            pool_len(&prog->names, id));
+    }
+    return targets;
+}
 
-    if (rt == -1 || rs == -1 || err == -1)  {
-      return -1;
+int encode_inst(const Program* prog, const Inst* inst, uint32_t addr,
+    const int64_t* targets, SymbolTable* reltbl, uint32_t* instruction) {
+    if (inst->op == OP_INVALID || inst->op == OP_NONE) {
+        return -1;
     }
 
-    // opcode rs rt imm
-    uint32_t instruction = 0;
-    instruction = (instruction + opcode) << 5;
-    instruction = (instruction + rs) << 5;
-    instruction = (instruction + rt) << 16;
-    instruction = (instruction + imm);
-    write_inst_hex(output, instruction);
-    return 0;
+    const InstInfo* info = &INSTRUCTIONS[inst->op];
+    switch (info->format) {
+        case FMT_RTYPE:  *instruction = rtype_word(info->bits, inst); return 0;
+        case FMT_SHIFT:  *instruction = shift_word(info->bits, inst); return 0;
+        case FMT_JR:     *instruction = jr_word   (info->bits, inst); return 0;
+        case FMT_ADDIU:
+        case FMT_ORI:
+        case FMT_LUI:
+        case FMT_MEM:    *instruction = itype     (info->bits, inst); return 0;
+        case FMT_BRANCH: return branch_word(inst, addr, targets ? targets[inst->sym] : -1,
+                             instruction);
+        case FMT_JUMP:   return jump_word  (info->bits, inst, addr, prog, reltbl, instruction);
+    }
+    return -1;
 }
 
-int write_ori(uint8_t opcode, FILE* output, char** args, size_t num_args) {
-    // Perhaps perform some error checking?
-    
-    long int imm;
-    int rt = translate_reg(args[0]);
-    int rs = translate_reg(args[1]);
-    int err = translate_num(&imm, args[2], 0, UINT16_MAX);
+int write_rtype(uint8_t funct, Writer* output, const Inst* inst) {
+    write_inst_hex(output, rtype_word(funct, inst));
+    return 0;
+}
 
-    if (rt == -1 || rs == -1 || err == -1)  {
-      return -1;
-    }
+int write_shift(uint8_t funct, Writer* output, const Inst* inst) {
+    write_inst_hex(output, shift_word(funct, inst));
+    return 0;
+}
 
-    // opcode rs rt imm
-    uint32_t instruction = 0;
-    instruction = (instruction + opcode) << 5;
-    instruction = (instruction + rs) << 5;
-    instruction = (instruction + rt) << 16;
-    instruction += imm;
+int write_jr(uint8_t funct, Writer* output, const Inst* inst) {
+    write_inst_hex(output, jr_word(funct, inst));
+    return 0;
+}
 
-    write_inst_hex(output, instruction);
+int write_addiu(uint8_t opcode, Writer* output, const Inst* inst) {
+    write_inst_hex(output, itype(opcode, inst));
     return 0;
 }
 
-int write_lui(uint8_t opcode, FILE* output, char** args, size_t num_args) {
-    // Perhaps perform some error checking?
-    
-    long int imm;
-    int rt = translate_reg(args[0]);
-    int err = translate_num(&imm, args[1], 0, UINT16_MAX);
-    if (rt == -1 || err == -1)  {
-      return -1;
-    }
-    uint32_t instruction = 0;
-    instruction = (instruction + opcode) << 10;
-    instruction = (instruction + rt) << 16;
-    instruction += imm;
-    write_inst_hex(output, instruction);
+int write_ori(uint8_t opcode, Writer* output, const Inst* inst) {
+    write_inst_hex(output, itype(opcode, inst));
     return 0;
 }
 
-int write_mem(uint8_t opcode, FILE* output, char** args, size_t num_args) {
-    // Perhaps perform some error checking?
-    
-    long int imm;
-    int rt = translate_reg(args[0]);
-    int rs = translate_reg(args[2]);
-    int err = translate_num(&imm, args[1], INT16_MIN, INT16_MAX);
-    if (rt == -1 || rs == -1 || err == -1)  {
-      return -1;
-    }
+int write_lui(uint8_t opcode, Writer* output, const Inst* inst) {
+    write_inst_hex(output, itype(opcode, inst));
+    return 0;
+}
 
-    // opcode, rs, rt, imm
-    uint32_t instruction = 0;
-    instruction = (instruction + opcode) << 5;
-    instruction = (instruction + rs) << 5;
-    instruction = (instruction + rt) << 16;
-    instruction += imm & 0x0000FFFF;
-    write_inst_hex(output, instruction);
+int write_mem(uint8_t opcode, Writer* output, const Inst* inst) {
+    write_inst_hex(output, itype(opcode, inst));
     return 0;
 }
 
@@ -329,37 +488,23 @@ static int can_branch_to(uint32_t src_addr, uint32_t dest_addr) {
 }
 
 
-int write_branch(uint8_t opcode, FILE* output, char** args, size_t num_args, uint32_t addr, SymbolTable* symtbl) {
-    // Perhaps perform some error checking?
-    
-    int rs = translate_reg(args[0]);
-    int rt = translate_reg(args[1]);
-    int label_addr = get_addr_for_symbol(symtbl, args[2]);
-    if (rs == -1 || rt == -1 || label_addr == -1) {
-      return -1;
+int write_branch(uint8_t opcode, Writer* output, const Inst* inst, uint32_t addr,
+    const Program* prog, SymbolTable* symtbl) {
+    uint32_t instruction;
+    int64_t label_addr = get_addr_for_symbol(symtbl, get_name(prog, inst->sym));
+    if (branch_word(inst, addr, label_addr, &instruction) != 0) {
+        return -1;
     }
-    //Please compute the branch offset using the MIPS rules.
-    int32_t offset = (label_addr - (addr + 4)) >> 2; // take out plus 4 if buggy
-    uint32_t instruction = 0;
-    instruction = (instruction + opcode) << 5;
-    instruction = (instruction + rs) << 5;
-    instruction = (instruction + rt) << 16;
-    instruction += offset & 0x0000FFFF;
     write_inst_hex(output, instruction);
     return 0;
 }
 
-int write_jump(uint8_t opcode, FILE* output, char** args, size_t num_args, uint32_t addr, SymbolTable* reltbl) {
-    if (num_args != 1)  {
-      return -1;
-    }
-    char * label = args[0];
-    int err = add_to_table(reltbl, label, addr);
-    if (err == -1)  {
-      return -1;
+int write_jump(uint8_t opcode, Writer* output, const Inst* inst, uint32_t addr,
+    const Program* prog, SymbolTable* reltbl) {
+    uint32_t instruction;
+    if (jump_word(opcode, inst, addr, prog, reltbl, &instruction) != 0) {
+        return -1;
     }
-
-    uint32_t instruction = (instruction + opcode) << 26;
     write_inst_hex(output, instruction);
     return 0;
 }
@@ -3,34 +3,68 @@
 
 #include <stdint.h>
 
-/* IMPLEMENT ME - see documentation in translate.c */
+#include "lexer.h"
+#include "ir.h"
+
+/* See the documentation in translate.c. */
 unsigned write_pass_one(FILE* output, const char* name, char** args, int num_args);
 
-/* IMPLEMENT ME - see documentation in translate.c */
+unsigned write_pass_one_tokens(Program* output, const Token* name, const Token* args, int num_args);
+
+/* See the documentation in translate.c. */
 int translate_inst(FILE* output, const char* name, char** args, size_t num_args, 
     uint32_t addr, SymbolTable* symtbl, SymbolTable* reltbl);
 
-/* Declaring helper functions: */
-int write_rtype(uint8_t funct, FILE* output, char** args, size_t num_args);
+int translate_inst_ir(Writer* output, const Program* prog, const Inst* inst, uint32_t addr,
+    SymbolTable* symtbl, SymbolTable* reltbl);
+
+/* Looks up every name of PROG in SYMTBL and returns their addresses by name
+   id, -1 for the ones it does not have, so that each name is hashed once
+   however many branches go to it. The array is from mem_alloc().
+ */
+int64_t* resolve_targets(const Program* prog, SymbolTable* symtbl);
+
+/* Encodes the parsed instruction INST at address ADDR into INSTRUCTION,
+   taking branch targets from TARGETS, as returned by resolve_targets(), and
+   adding jumps to RELTBL. TARGETS may be NULL if INST is not a branch.
+   Returns 0 on success and -1 on error, in which case nothing is stored.
+ */
+int encode_inst(const Program* prog, const Inst* inst, uint32_t addr,
+    const int64_t* targets, SymbolTable* reltbl, uint32_t* instruction);
 
-int write_shift(uint8_t funct, FILE* output, char** args, size_t num_args);
+/* Encodes the branch INST at address ADDR to a label at LABEL_ADDR. */
+uint32_t encode_branch(const Inst* inst, uint32_t addr, uint32_t label_addr);
+
+/* Returns WORD, an instruction encoded for some address, as it would be
+   encoded for an address OFFSET bytes later. Only branches change.
+ */
+uint32_t rebase_word(uint32_t word, uint32_t offset);
+
+int parse_inst(Program* prog, const Token* name, const Token* args, size_t num_args,
+    Inst* inst);
+
+/* Parses the instruction NAME with arguments ARGS and appends it to PROG. */
+void emit_inst(Program* prog, const Token* name, const Token* args, int num_args);
+
+/* Declaring helper functions: */
+int write_rtype(uint8_t funct, Writer* output, const Inst* inst);
 
-/* IMPLEMENT ME ~ write*_ functions*/
+int write_shift(uint8_t funct, Writer* output, const Inst* inst);
 
-int write_jr(uint8_t funct, FILE* output, char** args, size_t num_args);
+int write_jr(uint8_t funct, Writer* output, const Inst* inst);
 
-int write_addiu(uint8_t opcode, FILE* output, char** args, size_t num_args);
+int write_addiu(uint8_t opcode, Writer* output, const Inst* inst);
 
-int write_ori(uint8_t opcode, FILE* output, char** args, size_t num_args);
+int write_ori(uint8_t opcode, Writer* output, const Inst* inst);
 
-int write_lui(uint8_t opcode, FILE* output, char** args, size_t num_args);
+int write_lui(uint8_t opcode, Writer* output, const Inst* inst);
 
-int write_mem(uint8_t opcode, FILE* output, char** args, size_t num_args);
+int write_mem(uint8_t opcode, Writer* output, const Inst* inst);
 
-int write_branch(uint8_t opcode, FILE* output, char** args, size_t num_args, 
-    uint32_t addr, SymbolTable* symtbl);
+int write_branch(uint8_t opcode, Writer* output, const Inst* inst, uint32_t addr,
+    const Program* prog, SymbolTable* symtbl);
 
-int write_jump(uint8_t opcode, FILE* output, char** args, size_t num_args, 
-    uint32_t addr, SymbolTable* reltbl);
+int write_jump(uint8_t opcode, Writer* output, const Inst* inst, uint32_t addr,
+    const Program* prog, SymbolTable* reltbl);
 
 #endif
@@ -2,9 +2,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "translate_utils.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 /* A helper function used in translate.c */
 void write_inst_string(FILE* output, const char* name, char** args, int num_args) {
     fprintf(output, "%s", name);
@@ -15,8 +21,158 @@ void write_inst_string(FILE* output, const char* name, char** args, int num_args
 }
 
 /* A helper function used in translate.c */
-void write_inst_hex(FILE *output, uint32_t instruction) {
-    fprintf(output, "%08x\n", instruction);
+void write_inst_tokens(FILE* output, const Token* name, const Token* args, int num_args) {
+    fprintf(output, "%.*s", (int) name->len, name->start);
+    for (int i = 0; i < num_args; i++) {
+        fprintf(output, " %.*s", (int) args[i].len, args[i].start);
+    }
+    fprintf(output, "\n");
+}
+
+/* A helper function used in translate.c */
+void write_inst_hex(Writer* output, uint32_t instruction) {
+    put_hex32(output, instruction);
+    put_char(output, '\n');
+}
+
+size_t write_inst_hex_batch_scalar(char* output, const uint32_t* instructions, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        format_hex32(output + i * HEX_LINE_SIZE, instructions[i]);
+        output[i * HEX_LINE_SIZE + 8] = '\n';
+    }
+    return n * HEX_LINE_SIZE;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* Stores the 16 hex digits in DIGITS as two lines. */
+__attribute__((target("ssse3")))
+static inline void store_hex_lines(char* output, __m128i digits) {
+    _mm_storel_epi64((__m128i*) output, digits);
+    output[8] = '\n';
+    _mm_storel_epi64((__m128i*) (output + HEX_LINE_SIZE), _mm_unpackhi_epi64(digits, digits));
+    output[HEX_LINE_SIZE + 8] = '\n';
+}
+
+/* Byte swaps each word so that its most significant byte comes first, splits
+   every byte into its two nibbles, and looks each nibble up in a 16 entry
+   table of digits with one shuffle. Does 8 lines per iteration.
+ */
+__attribute__((target("ssse3")))
+static size_t write_inst_hex_batch_ssse3(char* output, const uint32_t* instructions, size_t n) {
+    const __m128i table = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i low = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        char* p = output + i * HEX_LINE_SIZE;
+        for (int half = 0; half < 2; half++) {
+            __m128i words = _mm_loadu_si128((const __m128i*) (instructions + i + half * 4));
+            words = _mm_shuffle_epi8(words, bswap);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(words, 4), low);
+            __m128i lo = _mm_and_si128(words, low);
+            store_hex_lines(p, _mm_shuffle_epi8(table, _mm_unpacklo_epi8(hi, lo)));
+            store_hex_lines(p + 2 * HEX_LINE_SIZE, _mm_shuffle_epi8(table, _mm_unpackhi_epi8(hi, lo)));
+            p += 4 * HEX_LINE_SIZE;
+        }
+    }
+    write_inst_hex_batch_scalar(output + i * HEX_LINE_SIZE, instructions + i, n - i);
+    return n * HEX_LINE_SIZE;
+}
+
+/* Same as the SSSE3 version, with 8 words per register and 16 lines per
+   iteration. The shuffles work within each 128 bit lane, so each lane holds
+   4 consecutive words.
+ */
+__attribute__((target("avx2")))
+static size_t write_inst_hex_batch_avx2(char* output, const uint32_t* instructions, size_t n) {
+    const __m256i table = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+        '0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        char* p = output + i * HEX_LINE_SIZE;
+        for (int half = 0; half < 2; half++) {
+            __m256i words = _mm256_loadu_si256((const __m256i*) (instructions + i + half * 8));
+            words = _mm256_shuffle_epi8(words, bswap);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(words, 4), low);
+            __m256i lo = _mm256_and_si256(words, low);
+            __m256i first = _mm256_shuffle_epi8(table, _mm256_unpacklo_epi8(hi, lo));
+            __m256i second = _mm256_shuffle_epi8(table, _mm256_unpackhi_epi8(hi, lo));
+            store_hex_lines(p, _mm256_castsi256_si128(first));
+            store_hex_lines(p + 2 * HEX_LINE_SIZE, _mm256_castsi256_si128(second));
+            store_hex_lines(p + 4 * HEX_LINE_SIZE, _mm256_extracti128_si256(first, 1));
+            store_hex_lines(p + 6 * HEX_LINE_SIZE, _mm256_extracti128_si256(second, 1));
+            p += 8 * HEX_LINE_SIZE;
+        }
+    }
+    write_inst_hex_batch_ssse3(output + i * HEX_LINE_SIZE, instructions + i, n - i);
+    return n * HEX_LINE_SIZE;
+}
+
+#endif
+
+typedef size_t (*HexBatchFn)(char*, const uint32_t*, size_t);
+
+static HexBatchFn hex_batch_impl = write_inst_hex_batch_scalar;
+static HexLevel hex_level = HEX_SCALAR;
+
+/* Picks the best implementation once, before main() runs. */
+__attribute__((constructor))
+static void init_hex_batch() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (set_hex_level(HEX_AVX2) == 0) {
+        return;
+    }
+    set_hex_level(HEX_SSSE3);
+#endif
+}
+
+size_t write_inst_hex_batch(char* output, const uint32_t* instructions, size_t n) {
+    return hex_batch_impl(output, instructions, n);
+}
+
+void write_insts_hex(Writer* output, const uint32_t* instructions, size_t n) {
+    char* p = reserve_output(output, n * HEX_LINE_SIZE);
+    output->len += write_inst_hex_batch(p, instructions, n);
+}
+
+HexLevel get_hex_level() {
+    return hex_level;
+}
+
+int set_hex_level(HexLevel level) {
+    switch (level) {
+        case HEX_SCALAR:
+            hex_batch_impl = write_inst_hex_batch_scalar;
+            break;
+#ifdef HAVE_X86_SIMD
+        case HEX_SSSE3:
+            if (!__builtin_cpu_supports("ssse3")) {
+                return -1;
+            }
+            hex_batch_impl = write_inst_hex_batch_ssse3;
+            break;
+        case HEX_AVX2:
+            if (!__builtin_cpu_supports("avx2")) {
+                return -1;
+            }
+            hex_batch_impl = write_inst_hex_batch_avx2;
+            break;
+#endif
+        default:
+            return -1;
+    }
+    hex_level = level;
+    return 0;
 }
 
 /* A helper function used in assembler.c */
@@ -24,21 +180,77 @@ int is_valid_label(const char* str) {
     if (!str) {
         return 0;
     }
+    return is_valid_label_span(str, strlen(str));
+}
 
-    int first = 1;
-    while (*str) {
-        if (first) {
-            if (!isalpha((int) *str) && *str != '_') {
-                return 0;   // does not start with letter or underscore
-            } else {
-                first = 0;
-            }
-        } else if (!isalnum((int) *str) && *str != '_') {
+int is_valid_label_span(const char* str, size_t len) {
+    if (len == 0) {
+        return 0;           // empty string is invalid
+    }
+    if (!isalpha((int) str[0]) && str[0] != '_') {
+        return 0;           // does not start with letter or underscore
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!isalnum((int) str[i]) && str[i] != '_') {
             return 0;       // subsequent characters not alphanumeric
         }
-        str++;
     }
-    return first ? 0 : 1;   // empty string is invalid
+    return 1;
+}
+
+/* Returns the value of the digit C, or -1 if C is not a digit in any base. */
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+size_t parse_num_span(long int* output, const char* str, size_t len) {
+    size_t i = 0;
+    int negative = 0;
+    if (i < len && (str[i] == '+' || str[i] == '-')) {
+        negative = str[i] == '-';
+        i++;
+    }
+
+    // Detect the base like strtol() does: 0x for hex, a leading 0 for octal
+    int base = 10;
+    if (i < len && str[i] == '0') {
+        if (i + 2 < len && (str[i + 1] == 'x' || str[i + 1] == 'X')
+            && digit_value(str[i + 2]) >= 0) {
+            base = 16;
+            i += 2;
+        } else {
+            base = 8;
+        }
+    }
+
+    size_t digits = i;
+    unsigned long int value = 0;
+    int overflow = 0;
+    for (; i < len; i++) {
+        int d = digit_value(str[i]);
+        if (d < 0 || d >= base) {
+            break;
+        }
+        if (value > (ULONG_MAX - d) / base) {
+            overflow = 1;
+        } else {
+            value = value * base + d;
+        }
+    }
+    if (i == digits) {
+        return 0;
+    }
+
+    // Out of range values saturate, again like strtol()
+    if (negative) {
+        *output = (overflow || value > (unsigned long) LONG_MAX) ? LONG_MIN : -(long int) value;
+    } else {
+        *output = (overflow || value > (unsigned long) LONG_MAX) ? LONG_MAX : (long int) value;
+    }
+    return i;
 }
 
 /* Translate the input string into a signed number. The number is then 
@@ -47,10 +259,7 @@ int is_valid_label(const char* str) {
 
    The input may be in either positive or negative, and be in either
    decimal or hexadecimal format. It is also possible that the input is not
-   a valid number. Fortunately, the library function strtol() can take 
-   care of all that (with a little bit of work from your side of course).
-   Please read the documentation for strtol() carefully. Do not use strtoul()
-   or any other variants. 
+   a valid number.
 
    You should store the result into the location that OUTPUT points to. The 
    function returns 0 if the conversion proceeded without errors, or -1 if an 
@@ -60,57 +269,73 @@ int translate_num(long int* output, const char* str, long int lower_bound, long
     if (!str || !output) {
         return -1;
     }
+    return translate_num_span(output, str, strlen(str), lower_bound, upper_bound);
+}
 
-    // convert str
-    char * endChar = ""; // stores first char in string after number (if applicable)
-    long int num = strtol(str, &endChar, 0); // 3rd parameter '0' should tell strtol to automatically detect base (needs testing)
+int translate_num_span(long int* output, const char* str, size_t len,
+    long int lower_bound, long int upper_bound) {
 
-    // check for extra characters
-    if (!endChar[0]) {
-      // check if within bounds
-      if (lower_bound <= num  && num <= upper_bound)  {
-        *output = num; // store result in output
+    long int num;
+    // the whole token has to be the number, with no extra characters
+    if (parse_num_span(&num, str, len) != len || len == 0) {
+        return -1;
+    }
+    if (lower_bound <= num && num <= upper_bound) {
+        *output = num;
         return 0;
-      }
     }
-
     return -1;
 }
 
-/* Translates the register name to the corresponding register number. Please
-   see the MIPS Green Sheet for information about register numbers.
+int translate_num_token(long int* output, const Token* tok, long int lower_bound,
+    long int upper_bound) {
 
-   Returns the register number of STR or -1 if the register name is invalid.
- */
-int translate_reg(const char* str) {
-    if (strcmp(str, "$zero") == 0)      return 0;
-    else if (strcmp(str, "$0") == 0)    return 0;
-    else if (strcmp(str, "$at") == 0)   return 1;
-    else if (strcmp(str, "$v0") == 0)   return 2;
-    else if (strcmp(str, "$a0") == 0)   return 4;
-    else if (strcmp(str, "$a1") == 0)   return 5;
-    else if (strcmp(str, "$a2") == 0)   return 6;
-    else if (strcmp(str, "$a3") == 0)   return 7;
-    else if (strcmp(str, "$t0") == 0)   return 8;
-    else if (strcmp(str, "$t1") == 0)   return 9;
-    else if (strcmp(str, "$t2") == 0)   return 10;
-    else if (strcmp(str, "$t3") == 0)   return 11;
-    else if (strcmp(str, "$s0") == 0)   return 16;
-    else if (strcmp(str, "$s1") == 0)   return 17;
-    else if (strcmp(str, "$s2") == 0)   return 18;
-    else if (strcmp(str, "$s3") == 0)   return 19;
-    else if (strcmp(str, "$sp") == 0)   return 29;
-    else if (strcmp(str, "$ra") == 0)   return 31;
-    else                                return -1;
+    if (tok->type != TOK_IMMEDIATE && tok->type != TOK_MEMORY) {
+        return -1;
+    }
+    return translate_num_span(output, tok->start, tok->len, lower_bound, upper_bound);
 }
 
+typedef struct {
+    const char* name;
+    size_t len;
+    int num;
+} RegName;
 
+#define REG(name, num) { name, sizeof(name) - 1, num }
 
+static const RegName REGISTERS[] = {
+    REG("$zero", 0), REG("$0", 0), REG("$at", 1), REG("$v0", 2),
+    REG("$a0", 4), REG("$a1", 5), REG("$a2", 6), REG("$a3", 7),
+    REG("$t0", 8), REG("$t1", 9), REG("$t2", 10), REG("$t3", 11),
+    REG("$s0", 16), REG("$s1", 17), REG("$s2", 18), REG("$s3", 19),
+    REG("$sp", 29), REG("$ra", 31)
+};
 
+/* Translates the register name to the corresponding register number. Please
+   see the MIPS Green Sheet for information about register numbers.
 
+   Returns the register number of STR or -1 if the register name is invalid.
+ */
+int translate_reg(const char* str) {
+    return translate_reg_span(str, strlen(str));
+}
 
+int translate_reg_span(const char* str, size_t len) {
+    if (len < 2 || str[0] != '$') {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(REGISTERS) / sizeof(REGISTERS[0]); i++) {
+        if (REGISTERS[i].len == len && memcmp(REGISTERS[i].name, str, len) == 0) {
+            return REGISTERS[i].num;
+        }
+    }
+    return -1;
+}
 
-
-
-
-
+int translate_reg_token(const Token* tok) {
+    if (tok->type != TOK_REGISTER && tok->type != TOK_MEMORY) {
+        return -1;
+    }
+    return translate_reg_span(tok->start, tok->len);
+}
@@ -3,14 +3,50 @@
 
 #include <stdint.h>
 
+#include "lexer.h"
+#include "writer.h"
+
 /* Writes the instruction as a string to OUTPUT. NAME is the name of the 
    instruction, and its arguments are in ARGS. NUM_ARGS is the length of
    the array.
  */
 void write_inst_string(FILE* output, const char* name, char** args, int num_args);
 
+/* Same as write_inst_string(), but for an instruction given as tokens. */
+void write_inst_tokens(FILE* output, const Token* name, const Token* args, int num_args);
+
 /* Writes the instruction to OUTPUT in hexadecimal format. */
-void write_inst_hex(FILE* output, uint32_t instruction);
+void write_inst_hex(Writer* output, uint32_t instruction);
+
+/* Bytes written by write_inst_hex() for one instruction. */
+#define HEX_LINE_SIZE 9
+
+typedef enum {
+    HEX_SCALAR,
+    HEX_SSSE3,
+    HEX_AVX2
+} HexLevel;
+
+/* Writes the N instructions in INSTRUCTIONS to OUTPUT in the same format as
+   write_inst_hex(), using the widest vector unit available on the running
+   CPU. OUTPUT must have room for N * HEX_LINE_SIZE bytes, and nothing is
+   null terminated. Returns the number of bytes written.
+ */
+size_t write_inst_hex_batch(char* output, const uint32_t* instructions, size_t n);
+
+/* The portable version of write_inst_hex_batch(). */
+size_t write_inst_hex_batch_scalar(char* output, const uint32_t* instructions, size_t n);
+
+/* Same as write_inst_hex_batch(), but appends to a Writer. */
+void write_insts_hex(Writer* output, const uint32_t* instructions, size_t n);
+
+/* Returns the implementation currently used by write_inst_hex_batch(). */
+HexLevel get_hex_level();
+
+/* Forces write_inst_hex_batch() to use LEVEL. Returns 0 on success, or -1 if
+   the CPU or compiler does not support LEVEL.
+ */
+int set_hex_level(HexLevel level);
 
 /* Returns 1 if the label is valid and 0 if it is invalid. A valid label is one
    where the first character is a character or underscore and the remaining 
@@ -18,11 +54,38 @@ void write_inst_hex(FILE* output, uint32_t instruction);
  */
 int is_valid_label(const char* str);
 
-/* IMPLEMENT ME - see documentation in translate_utils.c */
+/* Same as is_valid_label(), but for the LEN bytes of STR. */
+int is_valid_label_span(const char* str, size_t len);
+
+/* Parses the number at the start of the LEN bytes of STR the same way
+   strtol(str, &end, 0) would and stores it in OUTPUT. Returns the number
+   of bytes that were part of the number, or 0 if there was none.
+ */
+size_t parse_num_span(long int* output, const char* str, size_t len);
+
+/* See the documentation in translate_utils.c. */
 int translate_num(long int* output, const char* str, long int lower_bound, 
 	long int upper_bound);
 
-/* IMPLEMENT ME - see documentation in translate_utils.c */
+/* Same as translate_num(), but for the LEN bytes of STR. */
+int translate_num_span(long int* output, const char* str, size_t len,
+    long int lower_bound, long int upper_bound);
+
+/* Same as translate_num(), but for TOK. Only immediate and memory operands
+   are parsed; any other token is rejected by its type.
+ */
+int translate_num_token(long int* output, const Token* tok, long int lower_bound,
+    long int upper_bound);
+
+/* See the documentation in translate_utils.c. */
 int translate_reg(const char* str);
 
+/* Same as translate_reg(), but for the LEN bytes of STR. */
+int translate_reg_span(const char* str, size_t len);
+
+/* Same as translate_reg(), but for TOK. Only register and memory operands
+   are looked up; any other token is rejected by its type.
+ */
+int translate_reg_token(const Token* tok);
+
 #endif
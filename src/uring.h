@@ -0,0 +1,66 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* A minimal io_uring instance, driven through the raw system calls. SQEs are
+   filled in place and submitted in batches; completions are read straight
+   from the shared completion ring.
+ */
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned queued;        // SQEs filled in but not submitted yet
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;          // the same as SQ_RING if the kernel maps them together
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+
+/* Sets up RING with room for ENTRIES submissions. Returns 0 on success, or
+   -1 if io_uring is not available.
+ */
+int open_uring(Uring* ring, unsigned entries);
+
+void close_uring(Uring* ring);
+
+/* Returns a cleared SQE to fill in, or NULL if the submission queue is full. */
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+
+/* Submits the queued SQEs and waits until at least WAIT_NR completions are
+   available. Returns -1 on error.
+ */
+int uring_submit(Uring* ring, unsigned wait_nr);
+
+/* Waits until at least WAIT_NR completions are available, without submitting
+   anything. Unlike uring_submit(), this may run alongside other threads
+   queueing and submitting SQEs. Returns -1 on error.
+ */
+int uring_wait(Uring* ring, unsigned wait_nr);
+
+/* Takes the next completion off RING and stores it in CQE. Returns 0 if there
+   is none.
+ */
+int uring_next_cqe(Uring* ring, struct io_uring_cqe* cqe);
+
+/* Registers the NUM buffers in IOVECS for IORING_OP_READ_FIXED and
+   IORING_OP_WRITE_FIXED. Returns -1 on error.
+ */
+int uring_register_buffers(Uring* ring, const struct iovec* iovecs, unsigned num);
+
+#endif
@@ -3,8 +3,19 @@
 #include <stdarg.h>
 #include <unistd.h>
 
+#include "utils.h"
+
 static const char* output_file = NULL;
 
+/* Where write_to_log() output of the calling thread goes instead, if set. */
+static __thread Writer* log_capture = NULL;
+
+Writer* capture_log(Writer* buffer) {
+    Writer* previous = log_capture;
+    log_capture = buffer;
+    return previous;
+}
+
 int is_log_file_set() {
     return output_file != NULL;
 }
@@ -21,7 +32,18 @@ void set_log_file(const char* filename) {
 void write_to_log(char* fmt, ...) {
     va_list args;
 
-    if (output_file) {
+    if (log_capture) {
+        va_start(args, fmt);
+        int len = vsnprintf(NULL, 0, fmt, args);
+        va_end(args);
+        if (len > 0) {
+            char* p = reserve_output(log_capture, len + 1);
+            va_start(args, fmt);
+            vsnprintf(p, len + 1, fmt, args);
+            va_end(args);
+            log_capture->len += len;
+        }
+    } else if (output_file) {
         FILE* f = fopen(output_file, "a");
         if (!f) {
             return;
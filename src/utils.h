@@ -1,3 +1,7 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include "writer.h"
 
 int is_log_file_set();
 
@@ -5,4 +9,13 @@ void set_log_file(const char* filename);
 
 void write_to_log(char* fmt, ...);
 
-void log_inst(const char* name, char** args, int num_args);
\ No newline at end of file
+/* Makes write_to_log() calls on the calling thread append to BUFFER instead
+   of the log, until it is called again with NULL. This lets threads produce
+   messages that are written out in order later. Returns the buffer that was
+   in use before, so that it can be put back.
+ */
+Writer* capture_log(Writer* buffer);
+
+void log_inst(const char* name, char** args, int num_args);
+
+#endif
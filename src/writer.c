@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include "tables.h"
+#include "writer.h"
+
+#define BUFFER_SIZE 65536
+
+/* Two lowercase hex digits for every byte value. */
+static const char HEX_PAIRS[] =
+    "000102030405060708090a0b0c0d0e0f"
+    "101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f"
+    "303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f"
+    "505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f"
+    "707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f"
+    "909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* Two decimal digits for every value from 0 to 99. */
+static const char DEC_PAIRS[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static void init_writer(Writer* writer, WriterBackend backend) {
+    memset(writer, 0, sizeof(Writer));
+    writer->backend = backend;
+    writer->fd = -1;
+}
+
+/* Allocates the buffer used by the write() and FILE backends. */
+static void alloc_buffer(Writer* writer) {
+    writer->buf = malloc(BUFFER_SIZE);
+    if (!writer->buf) {
+        allocation_failed();
+    }
+    writer->cap = BUFFER_SIZE;
+}
+
+int open_writer_fd(Writer* writer, int fd) {
+    init_writer(writer, WRITER_FD);
+    writer->fd = fd;
+    alloc_buffer(writer);
+    return 0;
+}
+
+int open_writer_file(Writer* writer, FILE* file) {
+    init_writer(writer, WRITER_FILE);
+    writer->file = file;
+    alloc_buffer(writer);
+    return 0;
+}
+
+int open_writer_mmap(Writer* writer, const char* filename, size_t size) {
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (size == 0) {
+        size = BUFFER_SIZE;
+    }
+    // blocks are allocated up front, since running out of space while
+    // storing into the mapping would raise SIGBUS rather than fail a call
+    if (ftruncate(fd, size) != 0 || posix_fallocate(fd, 0, size) != 0) {
+        close(fd);
+        return -1;
+    }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    init_writer(writer, WRITER_MMAP);
+    writer->fd = fd;
+    writer->buf = data;
+    writer->cap = size;
+    return 0;
+}
+
+int mark_cached(const char* filename) {
+    return setxattr(filename, CACHED_XATTR, "", 0, 0);
+}
+
+void unlink_if_cached(const char* filename) {
+    struct stat st;
+    if (stat(filename, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1
+        && getxattr(filename, CACHED_XATTR, NULL, 0) >= 0) {
+        unlink(filename);
+    }
+}
+
+int open_writer(Writer* writer, const char* filename, size_t size_hint) {
+    if (strcmp(filename, "-") == 0) {
+        return open_writer_fd(writer, STDOUT_FILENO);
+    }
+
+    unlink_if_cached(filename);
+    struct stat st;
+    int exists = stat(filename, &st) == 0;
+
+    // only regular files can be mapped; anything else gets the write() backend
+    if (size_hint > 0 && (!exists || S_ISREG(st.st_mode))) {
+        if (open_writer_mmap(writer, filename, size_hint) == 0) {
+            return 0;
+        }
+    }
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    open_writer_fd(writer, fd);
+    writer->owns_fd = 1;
+    return 0;
+}
+
+void open_writer_mem(Writer* writer) {
+    init_writer(writer, WRITER_MEM);
+}
+
+char* detach_writer(Writer* writer, size_t* len) {
+    char* buf = writer->buf;
+    *len = writer->len;
+    writer->buf = NULL;
+    writer->len = writer->cap = 0;
+    return buf;
+}
+
+/* Grows the file and the mapping of WRITER to make room for N more bytes.
+   Returns 0 on success and -1 if the file cannot grow.
+ */
+static int grow_mapping(Writer* writer, size_t n) {
+    size_t cap = writer->cap * 2 > writer->len + n ? writer->cap * 2 : writer->len + n;
+    if (ftruncate(writer->fd, cap) != 0
+        || posix_fallocate(writer->fd, writer->cap, cap - writer->cap) != 0) {
+        return -1;
+    }
+    void* data = mremap(writer->buf, writer->cap, cap, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    writer->buf = data;
+    writer->cap = cap;
+    return 0;
+}
+
+/* Turns the mapped WRITER, whose file could not grow, into a write() writer
+   that goes on after the bytes written so far. The output counts as failed,
+   but the writer stays usable until it is closed.
+ */
+static void unmap_writer(Writer* writer) {
+    size_t written = writer->len;
+    int fd = writer->fd;
+    munmap(writer->buf, writer->cap);
+    open_writer_fd(writer, fd);
+    writer->owns_fd = 1;
+    writer->total = written;
+    writer->error = 1;
+    // the output has failed already, so errors here change nothing
+    if (ftruncate(fd, written) == 0) {
+        lseek(fd, written, SEEK_SET);
+    }
+}
+
+/* Writes out and empties the buffer of the write() and FILE backends. */
+static void flush_buffer(Writer* writer) {
+    if (writer->backend == WRITER_FILE) {
+        if (fwrite(writer->buf, 1, writer->len, writer->file) != writer->len) {
+            writer->error = 1;
+        }
+    } else {
+        size_t done = 0;
+        while (done < writer->len) {
+            ssize_t n = write(writer->fd, writer->buf + done, writer->len - done);
+            if (n <= 0) {
+                writer->error = 1;
+                break;
+            }
+            done += n;
+        }
+    }
+    writer->total += writer->len;
+    writer->len = 0;
+}
+
+char* reserve_output(Writer* writer, size_t n) {
+    if (writer->len + n <= writer->cap) {
+        return writer->buf + writer->len;
+    }
+
+    switch (writer->backend) {
+        case WRITER_FD:
+        case WRITER_FILE:
+            flush_buffer(writer);
+            if (n > writer->cap) {
+                writer->buf = realloc(writer->buf, n);
+                if (!writer->buf) {
+                    allocation_failed();
+                }
+                writer->cap = n;
+            }
+            break;
+        case WRITER_MMAP:
+            // the size hint was too small
+            if (grow_mapping(writer, n) != 0) {
+                unmap_writer(writer);
+                return reserve_output(writer, n);
+            }
+            break;
+        case WRITER_MEM: {
+            size_t cap = writer->cap ? writer->cap : BUFFER_SIZE;
+            while (cap < writer->len + n) {
+                cap *= 2;
+            }
+            writer->buf = realloc(writer->buf, cap);
+            if (!writer->buf) {
+                allocation_failed();
+            }
+            writer->cap = cap;
+            break;
+        }
+    }
+    return writer->buf + writer->len;
+}
+
+void put_bytes(Writer* writer, const char* data, size_t n) {
+    char* p = reserve_output(writer, n);
+    memcpy(p, data, n);
+    writer->len += n;
+}
+
+void put_str(Writer* writer, const char* str) {
+    put_bytes(writer, str, strlen(str));
+}
+
+void put_char(Writer* writer, char c) {
+    char* p = reserve_output(writer, 1);
+    *p = c;
+    writer->len++;
+}
+
+void format_hex32(char* dst, uint32_t value) {
+    memcpy(dst, HEX_PAIRS + 2 * (value >> 24), 2);
+    memcpy(dst + 2, HEX_PAIRS + 2 * ((value >> 16) & 0xff), 2);
+    memcpy(dst + 4, HEX_PAIRS + 2 * ((value >> 8) & 0xff), 2);
+    memcpy(dst + 6, HEX_PAIRS + 2 * (value & 0xff), 2);
+}
+
+void put_hex32(Writer* writer, uint32_t value) {
+    format_hex32(reserve_output(writer, 8), value);
+    writer->len += 8;
+}
+
+void put_dec32(Writer* writer, uint32_t value) {
+    char digits[10];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+
+    // two digits at a time, least significant first
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, DEC_PAIRS + 2 * (value % 100), 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, DEC_PAIRS + 2 * value, 2);
+    } else {
+        *--p = '0' + value;
+    }
+    put_bytes(writer, p, end - p);
+}
+
+void flush_writer(Writer* writer) {
+    if (writer->backend == WRITER_FD || writer->backend == WRITER_FILE) {
+        flush_buffer(writer);
+        if (writer->backend == WRITER_FILE && fflush(writer->file) != 0) {
+            writer->error = 1;
+        }
+    }
+}
+
+size_t writer_size(const Writer* writer) {
+    return writer->total + writer->len;
+}
+
+int close_writer(Writer* writer) {
+    switch (writer->backend) {
+        case WRITER_FD:
+        case WRITER_FILE:
+            flush_buffer(writer);
+            free(writer->buf);
+            if (writer->owns_fd && close(writer->fd) != 0) {
+                writer->error = 1;
+            }
+            break;
+        case WRITER_MMAP:
+            // trim the file from the preallocated size to what was written
+            munmap(writer->buf, writer->cap);
+            if (ftruncate(writer->fd, writer->len) != 0) {
+                writer->error = 1;
+            }
+            if (close(writer->fd) != 0) {
+                writer->error = 1;
+            }
+            break;
+        case WRITER_MEM:
+            free(writer->buf);
+            break;
+    }
+    writer->buf = NULL;
+    writer->len = writer->cap = 0;
+    return writer->error ? -1 : 0;
+}
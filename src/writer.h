@@ -0,0 +1,111 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    WRITER_FD,      // buffered, flushed with write()
+    WRITER_MMAP,    // written straight into a mapping of the output file
+    WRITER_FILE,    // buffered, flushed with fwrite() to a FILE
+    WRITER_MEM      // kept in memory; BUF holds everything written
+} WriterBackend;
+
+/* Appends output to a large buffer, so that formatting a line never goes
+   through stdio. Depending on the backend the buffer is either flushed when
+   it fills up, or is the output file itself.
+ */
+typedef struct {
+    WriterBackend backend;
+    char* buf;
+    size_t len;         // bytes in BUF not yet flushed
+    size_t cap;
+    size_t total;       // bytes already flushed
+    int fd;
+    int owns_fd;        // 1 if close_writer() should close FD
+    FILE* file;
+    int error;
+} Writer;
+
+/* The extended attribute that marks a file as shared with a cache entry. */
+#define CACHED_XATTR "user.assembler.cached"
+
+/* Marks FILENAME as shared with a cache entry, so that the files linked to it
+   are replaced rather than written through. Returns 0 on success and -1 if
+   the file system cannot keep the mark.
+ */
+int mark_cached(const char* filename);
+
+/* Removes FILENAME if it is a regular file that shares its inode with a
+   cache entry, so that writing a new file in its place leaves the entry
+   alone. Hard links made by anyone else are written through as usual.
+ */
+void unlink_if_cached(const char* filename);
+
+/* Creates FILENAME and opens it for writing. If SIZE_HINT is not 0 and the
+   output is a regular file, it is preallocated to SIZE_HINT bytes and mapped
+   into memory; otherwise, or if the space cannot be allocated, output is
+   buffered and written with write().
+   FILENAME "-" is standard output. Returns 0 on success and -1 on error.
+ */
+int open_writer(Writer* writer, const char* filename, size_t size_hint);
+
+/* Buffers output to the already open FD, which is not closed. */
+int open_writer_fd(Writer* writer, int fd);
+
+/* Maps FILENAME, preallocated to SIZE bytes, with its blocks allocated so
+   that a full disk fails here rather than in a store. Returns -1 if that is
+   not possible. The file grows if more is written and is truncated to the
+   bytes written when the writer is closed. If it cannot grow, the writer
+   goes on with write() and the output counts as failed.
+ */
+int open_writer_mmap(Writer* writer, const char* filename, size_t size);
+
+/* Buffers output to FILE, which is not closed. */
+int open_writer_file(Writer* writer, FILE* file);
+
+/* Keeps all output in memory. It can be read from BUF until the writer is
+   closed.
+ */
+void open_writer_mem(Writer* writer);
+
+/* Closes the memory writer WRITER and hands its output over to the caller,
+   who must free it. Stores the number of bytes in *LEN.
+ */
+char* detach_writer(Writer* writer, size_t* len);
+
+/* Returns space for N more bytes at the end of the output. They are not
+   part of the output until LEN is increased by the number of bytes used.
+ */
+char* reserve_output(Writer* writer, size_t n);
+
+void put_bytes(Writer* writer, const char* data, size_t n);
+
+void put_str(Writer* writer, const char* str);
+
+void put_char(Writer* writer, char c);
+
+/* Writes VALUE as exactly 8 lowercase hex digits, like "%08x". */
+void put_hex32(Writer* writer, uint32_t value);
+
+/* Same as put_hex32(), but to the 8 bytes at DST. No null is added. */
+void format_hex32(char* dst, uint32_t value);
+
+/* Writes VALUE in decimal, like "%u". */
+void put_dec32(Writer* writer, uint32_t value);
+
+/* Hands everything written so far to the operating system, for backends
+   that buffer it. Does nothing for the others.
+ */
+void flush_writer(Writer* writer);
+
+/* Returns the number of bytes written so far. */
+size_t writer_size(const Writer* writer);
+
+/* Flushes and closes the writer. Returns 0 on success, or -1 if any of the
+   output could not be written.
+ */
+int close_writer(Writer* writer);
+
+#endif
@@ -1,6 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
 
 #include <CUnit/Basic.h>
 
@@ -8,6 +13,23 @@
 #include "src/tables.h"
 #include "src/translate_utils.h"
 #include "src/translate.h"
+#include "src/lexer.h"
+#include "src/scanner.h"
+#include "src/reader.h"
+#include "src/writer.h"
+#include "src/object.h"
+#include "src/backpatch.h"
+#include "src/symindex.h"
+#include "src/ring.h"
+#include "src/pool.h"
+#include "src/bulkio.h"
+#include "src/globals.h"
+#include "src/cache.h"
+#include "src/strpool.h"
+#include "src/arena.h"
+#include "assembler.h"
+#include "libassembler.h"
+#include "daemon.h"
 
 const char* TMP_FILE = "test_output.txt";
 const int BUF_SIZE = 1024;
@@ -158,6 +180,73 @@ void test_table_2() {
     free_table(tbl);
 }
 
+void test_table_index() {
+    const int max = 100000;
+    char buf[16];
+
+    // the index has to follow the table as it grows from a small hint
+    SymbolTable* tbl = create_table_sized(SYMTBL_UNIQUE_NAME, 1);
+    for (int i = 0; i < max; i++) {
+        sprintf(buf, "label_%d", i);
+        CU_ASSERT_EQUAL(add_to_table(tbl, buf, 4 * i), 0);
+    }
+    CU_ASSERT_EQUAL(add_to_table(tbl, "label_77", 0), -1);
+    CU_ASSERT_EQUAL(add_to_table_span(tbl, "label_777x", 9, 0), -1);
+    CU_ASSERT_EQUAL(add_to_table_span(tbl, "label_x777x", 10, 4), 0);
+    CU_ASSERT_EQUAL(tbl->len, max + 1);
+    for (int i = 0; i < max; i++) {
+        sprintf(buf, "label_%d", i);
+        CU_ASSERT_EQUAL(get_addr_for_symbol(tbl, buf), 4 * i);
+    }
+    CU_ASSERT_EQUAL(get_addr_for_symbol(tbl, "label_"), -1);
+    CU_ASSERT_EQUAL(get_addr_for_symbol_span(tbl, "label_5x", 7), 20);
+
+    // insertion order is kept for write_table()
+    for (int i = 0; i < max; i++) {
+        sprintf(buf, "label_%d", i);
+        CU_ASSERT_STRING_EQUAL(symbol_name(tbl, i), buf);
+    }
+
+    clear_table(tbl);
+    CU_ASSERT_EQUAL(get_addr_for_symbol(tbl, "label_1"), -1);
+    CU_ASSERT_EQUAL(add_to_table(tbl, "label_1", 8), 0);
+    CU_ASSERT_EQUAL(get_addr_for_symbol(tbl, "label_1"), 8);
+    free_table(tbl);
+
+    // a name added more than once finds its first address
+    SymbolTable* rel = create_table(SYMTBL_NON_UNIQUE);
+    SymbolTable* more = create_table(SYMTBL_NON_UNIQUE);
+    CU_ASSERT_EQUAL(add_to_table(rel, "a", 4), 0);
+    CU_ASSERT_EQUAL(add_to_table(rel, "a", 8), 0);
+    for (int i = 0; i < 100; i++) {
+        sprintf(buf, "b%d", i % 10);
+        CU_ASSERT_EQUAL(add_to_table(more, buf, 4 * i), 0);
+    }
+    CU_ASSERT_EQUAL(get_addr_for_symbol(rel, "a"), 4);
+    append_table(rel, more, 1000);
+    CU_ASSERT_EQUAL(rel->len, 102);
+    CU_ASSERT_EQUAL(more->len, 0);
+    CU_ASSERT_EQUAL(get_addr_for_symbol(rel, "b3"), 1012);
+    CU_ASSERT_EQUAL(get_addr_for_symbol(more, "b3"), -1);
+
+    // appending more than a table can hold runs out of memory
+    jmp_buf on_oom;
+    jmp_buf* outer_handler = on_allocation_failure(&on_oom);
+    volatile int failed = 0;
+    more->len = UINT32_MAX / 2;
+    if (setjmp(on_oom) == 0) {
+        append_table(rel, more, 0);
+    } else {
+        failed = 1;
+    }
+    on_allocation_failure(outer_handler);
+    more->len = 0;
+    CU_ASSERT(failed);
+    CU_ASSERT_EQUAL(rel->len, 102);
+    free_table(more);
+    free_table(rel);
+}
+
 /****************************************
  *  Add your test cases here
  ****************************************/
@@ -279,8 +368,8 @@ void test_jr() {
     char *args4[1] = {"$a1"};
     char *args5[1] = {"$zero"};
     char *args6[1] = {"$v0"};
-    char *args7[1] = {"$v3"};
-    char *args8[1] = {"$t4"};
+    char *args7[3] = {"$v3"};
+    char *args8[3] = {"$t4"};
 
     int err1 = translate_inst(fstout, "jr", args1, 1, 0, NULL, NULL);
     CU_ASSERT_EQUAL(err1, 0);
@@ -406,7 +495,7 @@ void test_jump() {
     add_to_table(t1, "test1", 4194308);
     add_to_table(t1, "test2", 4194316);
     char *args1[1] = {"test1"};
-    char *args2[1] = {"test2"};
+    char *args2[2] = {"test2"};
 
     int err1 = translate_inst(fstout, "j", args1, 1, 4194304, NULL, t1);
     CU_ASSERT_EQUAL(err1, 0);
@@ -456,6 +545,15 @@ void test_branch() {
     char* ans[] = {"1084fffd", "1480fffb"};
     check_lines_equal(ans, 2);
 
+    // moving a branch only changes its offset
+    Inst inst;
+    memset(&inst, 0, sizeof(Inst));
+    inst.op = OP_BNE;
+    inst.rs = 4;
+    CU_ASSERT_EQUAL(rebase_word(encode_branch(&inst, 0, 40), 12), encode_branch(&inst, 12, 40));
+    CU_ASSERT_EQUAL(rebase_word(encode_branch(&inst, 8, 4), 400), encode_branch(&inst, 408, 4));
+    CU_ASSERT_EQUAL(rebase_word(0x0c000000, 12), 0x0c000000);
+    CU_ASSERT_EQUAL(rebase_word(0x00851021, 12), 0x00851021);
 }
 
 void test_write_pass_one() {
@@ -466,7 +564,7 @@ void test_write_pass_one() {
     }
     SymbolTable* t1 = create_table(1);
     add_to_table(t1, "test1", 4194304);
-    char *args1[2] = {"$t1", "0"};
+    char *args1[3] = {"$t1", "0"};
     char *args2[2] = {"$t2", "$t1"};
     char *args3[2] = {"$a0", "-100"};
     char *args4[3] = {"$a0", "$0", "test1"};
@@ -491,9 +589,1264 @@ void test_write_pass_one() {
 
 }
 
+/****************************************
+ *  Test cases for lexer.c 
+ ****************************************/
+
+void test_lexer() {
+    const char* line = "loop:\tlw $t0, -4($sp)  # load, (not) a token";
+    char copy[64];
+    strcpy(copy, line);
+
+    Lexer lexer;
+    Token tok;
+    init_lexer(&lexer, copy, strlen(copy));
+
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.type, TOK_LABEL);
+    CU_ASSERT(token_equals(&tok, "loop:"));
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.type, TOK_MNEMONIC);
+    CU_ASSERT(token_equals(&tok, "lw"));
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.type, TOK_REGISTER);
+    CU_ASSERT_EQUAL(translate_reg_token(&tok), 8);
+    long int imm;
+    CU_ASSERT_EQUAL(translate_num_token(&imm, &tok, -100, 100), -1);
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.type, TOK_IMMEDIATE);
+    CU_ASSERT(token_equals(&tok, "-4"));
+    CU_ASSERT_EQUAL(translate_num_token(&imm, &tok, -100, 100), 0);
+    CU_ASSERT_EQUAL(imm, -4);
+    CU_ASSERT_EQUAL(translate_reg_token(&tok), -1);
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.type, TOK_MEMORY);
+    CU_ASSERT_EQUAL(translate_reg_token(&tok), 29);
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 0);
+
+    // the line must not have been modified
+    CU_ASSERT_STRING_EQUAL(copy, line);
+
+    // a second label is treated as the instruction name
+    init_lexer(&lexer, "l1: l2: j l1", 12);
+    next_token(&lexer, &tok);
+    CU_ASSERT_EQUAL(tok.type, TOK_LABEL);
+    next_token(&lexer, &tok);
+    CU_ASSERT_EQUAL(tok.type, TOK_MNEMONIC);
+    CU_ASSERT(token_equals(&tok, "l2:"));
+    next_token(&lexer, &tok);
+    CU_ASSERT_EQUAL(tok.type, TOK_SYMBOL);
+    CU_ASSERT_EQUAL(translate_reg_token(&tok), -1);
+
+    // operands given as strings are typed the same way
+    CU_ASSERT_EQUAL(operand_from_str("$ra").type, TOK_REGISTER);
+    CU_ASSERT_EQUAL(operand_from_str("+7").type, TOK_IMMEDIATE);
+    CU_ASSERT_EQUAL(operand_from_str("l1").type, TOK_SYMBOL);
+}
+
+void test_translate_num_span() {
+    long int output;
+    const char* str = "0x10,-8";
+
+    CU_ASSERT_EQUAL(translate_num_span(&output, str, 4, 0, 100), 0);
+    CU_ASSERT_EQUAL(output, 16);
+    CU_ASSERT_EQUAL(translate_num_span(&output, str + 5, 2, -8, 0), 0);
+    CU_ASSERT_EQUAL(output, -8);
+    CU_ASSERT_EQUAL(translate_num_span(&output, str, 5, 0, 100), -1);
+    CU_ASSERT_EQUAL(translate_num_span(&output, str, 0, 0, 100), -1);
+    CU_ASSERT_EQUAL(translate_num_span(&output, "010", 3, 0, 100), 0);
+    CU_ASSERT_EQUAL(output, 8);
+}
+
+/****************************************
+ *  Test cases for scanner.c 
+ ****************************************/
+
+/* Splits LINE into TOKENS the way assembler.c did before the lexer existed. */
+static int strtok_tokens(char* line, char** tokens, int max) {
+    char* comment = strchr(line, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+    int n = 0;
+    char* token = strtok(line, " \f\n\r\t\v,()");
+    while (token && n < max) {
+        tokens[n++] = token;
+        token = strtok(NULL, " \f\n\r\t\v,()");
+    }
+    return n;
+}
+
+/* Checks every line of FILENAME against strtok() and every block against
+   scan_block_scalar(), using the scan_block() implementation currently set.
+ */
+static void check_scanner_on_file(const char* filename) {
+    Reader reader;
+    if (open_reader(&reader, filename) != 0) {
+        CU_FAIL("Could not open input file");
+        return;
+    }
+
+    for (size_t i = 0; i < reader.size; i += SCAN_BLOCK_SIZE) {
+        size_t n = reader.size - i < SCAN_BLOCK_SIZE ? reader.size - i : SCAN_BLOCK_SIZE;
+        ScanMasks expected, actual;
+        scan_block_scalar(reader.data + i, n, &expected);
+        scan_block(reader.data + i, n, &actual);
+        CU_ASSERT_EQUAL(actual.newline, expected.newline);
+        CU_ASSERT_EQUAL(actual.comment, expected.comment);
+        CU_ASSERT_EQUAL(actual.delim, expected.delim);
+    }
+
+    const char* line;
+    size_t len;
+    char buf[BUF_SIZE];
+    while (next_line(&reader, &line, &len)) {
+        CU_ASSERT(len < BUF_SIZE);
+        memcpy(buf, line, len);
+        buf[len] = '\0';
+
+        char* expected[16];
+        int num_expected = strtok_tokens(buf, expected, 16);
+
+        Lexer lexer;
+        Token tok;
+        int num_actual = 0;
+        init_lexer(&lexer, line, len);
+        while (next_token(&lexer, &tok)) {
+            if (num_actual < num_expected) {
+                CU_ASSERT(token_equals(&tok, expected[num_actual]));
+            }
+            num_actual++;
+        }
+        CU_ASSERT_EQUAL(num_actual, num_expected);
+    }
+    close_reader(&reader);
+}
+
+void test_scanner_inputs() {
+    ScanLevel original = get_scan_level();
+    ScanLevel levels[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+    char path[BUF_SIZE];
+
+    for (int i = 0; i < 3; i++) {
+        if (set_scan_level(levels[i]) != 0) {
+            continue;   // not supported on this machine
+        }
+        DIR* dir = opendir("input");
+        if (!dir) {
+            CU_FAIL("Could not open input directory");
+            break;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir))) {
+            size_t len = strlen(entry->d_name);
+            if (len > 2 && strcmp(entry->d_name + len - 2, ".s") == 0) {
+                snprintf(path, BUF_SIZE, "input/%s", entry->d_name);
+                check_scanner_on_file(path);
+            }
+        }
+        closedir(dir);
+    }
+    set_scan_level(original);
+}
+
+void test_scanner_block() {
+    // a long line spanning several blocks, with the comment in the last one
+    char line[200];
+    memset(line, 'a', sizeof(line));
+    line[63] = ' ';
+    line[64] = ',';
+    line[130] = '(';
+    line[150] = '#';
+    line[199] = '\n';
+
+    Lexer lexer;
+    Token tok;
+    init_lexer(&lexer, line, sizeof(line));
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.len, 63);
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.start, line + 65);
+    CU_ASSERT_EQUAL(tok.len, 65);
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 1);
+    CU_ASSERT_EQUAL(tok.start, line + 131);
+    CU_ASSERT_EQUAL(tok.len, 19);
+    CU_ASSERT_EQUAL(tok.type, TOK_MEMORY);
+    CU_ASSERT_EQUAL(next_token(&lexer, &tok), 0);
+}
+
+void test_inst_hex_batch() {
+    // enough words for full vector iterations plus every tail length
+    uint32_t words[45];
+    char expected[sizeof(words) / 4 * HEX_LINE_SIZE + 1];
+    char actual[sizeof(words) / 4 * HEX_LINE_SIZE];
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < 45; i++) {
+        x = x * 1103515245 + 12345;
+        words[i] = i == 0 ? 0 : i == 1 ? UINT32_MAX : x;
+        snprintf(expected + i * HEX_LINE_SIZE, HEX_LINE_SIZE + 1, "%08x\n", words[i]);
+    }
+
+    HexLevel saved = get_hex_level();
+    for (int level = HEX_SCALAR; level <= HEX_AVX2; level++) {
+        if (set_hex_level(level) != 0) {
+            continue;
+        }
+        for (size_t n = 0; n <= 45; n++) {
+            memset(actual, 0, sizeof(actual));
+            CU_ASSERT_EQUAL(write_inst_hex_batch(actual, words, n), n * HEX_LINE_SIZE);
+            CU_ASSERT_EQUAL(memcmp(actual, expected, n * HEX_LINE_SIZE), 0);
+        }
+    }
+    set_hex_level(saved);
+}
+
+void test_writer_format() {
+    uint32_t values[] = {0, 1, 9, 10, 99, 100, 12345, 0x0000abcd, 0x8000000f,
+        0xdeadbeef, 999999999, 1000000000, UINT32_MAX};
+    char expected[64];
+    Writer writer;
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        open_writer_mem(&writer);
+        put_hex32(&writer, values[i]);
+        put_char(&writer, '\t');
+        put_dec32(&writer, values[i]);
+        int len = snprintf(expected, sizeof(expected), "%08x\t%u", values[i], values[i]);
+        CU_ASSERT_EQUAL(writer_size(&writer), (size_t) len);
+        CU_ASSERT_EQUAL(memcmp(writer.buf, expected, len), 0);
+        close_writer(&writer);
+    }
+}
+
+void test_writer_mmap() {
+    // a size hint far too small, so the mapping has to grow
+    Writer writer;
+    CU_ASSERT_EQUAL(open_writer_mmap(&writer, TMP_FILE, 16), 0);
+    for (uint32_t i = 0; i < 100000; i++) {
+        put_hex32(&writer, i * 2654435761u);
+        put_char(&writer, '\n');
+    }
+    CU_ASSERT_EQUAL(close_writer(&writer), 0);
+
+    FILE* f = fopen(TMP_FILE, "r");
+    char line[16];
+    uint32_t i = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char expected[16];
+        snprintf(expected, sizeof(expected), "%08x\n", i * 2654435761u);
+        CU_ASSERT_STRING_EQUAL(line, expected);
+        i++;
+    }
+    CU_ASSERT_EQUAL(i, 100000);
+    fclose(f);
+
+    // a file that cannot grow is an error of the output, not a crash
+    struct rlimit outer_limit, limit;
+    getrlimit(RLIMIT_FSIZE, &outer_limit);
+    limit = outer_limit;
+    limit.rlim_cur = 1 << 16;
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    CU_ASSERT_EQUAL(open_writer_mmap(&writer, TMP_FILE, 16), 0);
+    for (uint32_t i = 0; i < 100000; i++) {
+        put_hex32(&writer, i);
+    }
+    CU_ASSERT_EQUAL(close_writer(&writer), -1);
+    // and space that cannot be allocated up front means no mapping at all
+    CU_ASSERT_EQUAL(open_writer_mmap(&writer, TMP_FILE, 1 << 20), -1);
+    CU_ASSERT_EQUAL(open_writer(&writer, TMP_FILE, 1 << 20), 0);
+    CU_ASSERT_EQUAL(writer.backend, WRITER_FD);
+    put_str(&writer, "small");
+    CU_ASSERT_EQUAL(close_writer(&writer), 0);
+    setrlimit(RLIMIT_FSIZE, &outer_limit);
+    signal(SIGXFSZ, SIG_DFL);
+}
+
+void test_reader_stream() {
+    int fds[2];
+    CU_ASSERT_EQUAL(pipe(fds), 0);
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+    Reader reader;
+    CU_ASSERT_EQUAL(open_reader_stream(&reader, path), 0);
+    CU_ASSERT_EQUAL(reader_would_block(&reader), 1);
+
+    // input ready to be read does not block, even before it is buffered
+    CU_ASSERT_EQUAL(write(fds[1], "one\ntw", 6), 6);
+    CU_ASSERT_EQUAL(reader_would_block(&reader), 0);
+    const char* line;
+    size_t len;
+    CU_ASSERT_EQUAL(next_line(&reader, &line, &len), 1);
+    CU_ASSERT(len == 3 && memcmp(line, "one", 3) == 0);
+    // only part of the next line has arrived
+    CU_ASSERT_EQUAL(reader_would_block(&reader), 1);
+
+    CU_ASSERT_EQUAL(write(fds[1], "o\nthree", 7), 7);
+    close(fds[1]);
+    CU_ASSERT_EQUAL(reader_would_block(&reader), 0);
+    CU_ASSERT_EQUAL(next_line(&reader, &line, &len), 1);
+    CU_ASSERT(len == 3 && memcmp(line, "two", 3) == 0);
+    CU_ASSERT_EQUAL(next_line(&reader, &line, &len), 1);
+    CU_ASSERT(len == 5 && memcmp(line, "three", 5) == 0);
+    CU_ASSERT_EQUAL(reader_would_block(&reader), 0);
+    CU_ASSERT_EQUAL(next_line(&reader, &line, &len), 0);
+    close_reader(&reader);
+    close(fds[0]);
+}
+
+/* Converts the reference object file FILENAME to the binary format and back,
+   and checks that nothing changed.
+ */
+static void check_object_round_trip(const char* filename) {
+    const char* bin_file = "test_output.bin";
+    Reader expected, actual;
+    if (convert_object(filename, bin_file, 1, 0) != 0 || convert_object(bin_file, TMP_FILE, 0, 0) != 0
+        || open_reader(&expected, filename) != 0) {
+        CU_FAIL("Could not convert object file");
+        return;
+    }
+    CU_ASSERT_EQUAL(open_reader(&actual, TMP_FILE), 0);
+    CU_ASSERT_EQUAL(actual.size, expected.size);
+    if (actual.size == expected.size) {
+        CU_ASSERT_EQUAL(memcmp(actual.data, expected.data, actual.size), 0);
+    }
+    close_reader(&expected);
+
+    // a truncated file is rejected instead of read past its end
+    CU_ASSERT_EQUAL(open_reader(&actual, bin_file), 0);
+    ObjectView view;
+    CU_ASSERT_EQUAL(open_object_view(&view, actual.data, actual.size), 0);
+    CU_ASSERT_EQUAL(open_object_view(&view, actual.data, actual.size - 8), -1);
+    close_reader(&actual);
+
+    // size headers are read back and checked
+    const char* sized_file = "test_output_sizes.out";
+    CU_ASSERT_EQUAL(convert_object(bin_file, sized_file, 0, 1), 0);
+    CU_ASSERT_EQUAL(convert_object(sized_file, bin_file, 1, 0), 0);
+    CU_ASSERT_EQUAL(convert_object(bin_file, TMP_FILE, 0, 0), 0);
+    CU_ASSERT_EQUAL(open_reader(&expected, filename), 0);
+    CU_ASSERT_EQUAL(open_reader(&actual, TMP_FILE), 0);
+    CU_ASSERT_EQUAL(actual.size, expected.size);
+    if (actual.size == expected.size) {
+        CU_ASSERT_EQUAL(memcmp(actual.data, expected.data, actual.size), 0);
+    }
+    close_reader(&expected);
+    close_reader(&actual);
+    remove(sized_file);
+    remove(bin_file);
+}
+
+void test_object_round_trip() {
+    char path[BUF_SIZE];
+    DIR* dir = opendir("out/ref");
+    if (!dir) {
+        CU_FAIL("Could not open out/ref directory");
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && strcmp(entry->d_name + len - 4, ".out") == 0) {
+            snprintf(path, BUF_SIZE, "out/ref/%s", entry->d_name);
+            check_object_round_trip(path);
+        }
+    }
+    closedir(dir);
+}
+
+/* Parses the instruction in LINE into PROG, the way pass one does. */
+static void emit_line(Program* prog, const char* line) {
+    Lexer lexer;
+    Token name, args[3];
+    int num_args = 0;
+    init_lexer(&lexer, line, strlen(line));
+    next_token(&lexer, &name);
+    while (num_args < 3 && next_token(&lexer, &args[num_args])) {
+        num_args++;
+    }
+    write_pass_one_tokens(prog, &name, args, num_args);
+}
+
+void test_append_program() {
+    Program a, b;
+    init_program(&a, 1);
+    init_program(&b, 1);
+    emit_line(&a, "j second");
+    emit_line(&a, "beq $t0 $t1 first");
+    emit_line(&b, "bne $t0 $t1 first");
+    emit_line(&b, "jal third");
+    emit_line(&b, "addu $t0 $t1 $t2");
+    append_program(&a, &b);
+
+    CU_ASSERT_EQUAL(a.len, 5);
+    CU_ASSERT_EQUAL(a.names.len, 3);
+    CU_ASSERT_STRING_EQUAL(get_name(&a, a.insts[2].sym), "first");
+    CU_ASSERT_STRING_EQUAL(get_name(&a, a.insts[3].sym), "third");
+    CU_ASSERT_STRING_EQUAL(get_text(&a, &a.insts[1]), "beq $t0 $t1 first");
+    CU_ASSERT_STRING_EQUAL(get_text(&a, &a.insts[2]), "bne $t0 $t1 first");
+    CU_ASSERT_STRING_EQUAL(get_text(&a, &a.insts[4]), "addu $t0 $t1 $t2");
+    free_program(&a);
+    free_program(&b);
+
+    // messages can be held back and written out later
+    Writer log;
+    open_writer_mem(&log);
+    capture_log(&log);
+    write_to_log("Error - invalid label at line %d: %s\n", 12, "1abc");
+    capture_log(NULL);
+    const char* expected = "Error - invalid label at line 12: 1abc\n";
+    CU_ASSERT_EQUAL(log.len, strlen(expected));
+    CU_ASSERT_EQUAL(memcmp(log.buf, expected, strlen(expected)), 0);
+    close_writer(&log);
+}
+
+/* Emits "addu; bne -> ahead; addu; beq -> ahead; bne -> never" then defines
+   ahead at 20. The branch to never keeps a zero offset.
+ */
+static void check_backpatcher(Writer* output) {
+    Inst bne, beq;
+    memset(&bne, 0, sizeof(Inst));
+    bne.op = OP_BNE;
+    bne.rs = 8;
+    bne.rt = 9;
+    beq = bne;
+    beq.op = OP_BEQ;
+
+    Backpatcher patcher;
+    init_backpatcher(&patcher, output);
+    emit_word(&patcher, 0x00851021);
+    emit_forward_branch(&patcher, &bne, 4, "ahead", 5, 2);
+    emit_word(&patcher, 0x01084021);
+    emit_forward_branch(&patcher, &beq, 12, "ahead", 5, 4);
+    emit_forward_branch(&patcher, &bne, 16, "never", 5, 5);
+    resolve_label(&patcher, "ahead", 5, 20);
+    resolve_label(&patcher, "unused", 6, 24);
+    CU_ASSERT_EQUAL(finish_backpatcher(&patcher), 1);
+}
+
+void test_backpatch() {
+    const char* expected = "00851021\n15090003\n01084021\n11090001\n15090000\n";
+
+    // in memory, words are patched in place
+    Writer writer;
+    open_writer_mem(&writer);
+    put_str(&writer, ".text\n");
+    check_backpatcher(&writer);
+    CU_ASSERT_EQUAL(writer.len, 6 + strlen(expected));
+    CU_ASSERT_EQUAL(memcmp(writer.buf + 6, expected, strlen(expected)), 0);
+    close_writer(&writer);
+
+    // to a file, words are held back until their branch is patched
+    FILE* f = fopen(TMP_FILE, "w");
+    open_writer_file(&writer, f);
+    check_backpatcher(&writer);
+    close_writer(&writer);
+    fclose(f);
+
+    char buf[64];
+    f = fopen(TMP_FILE, "r");
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    CU_ASSERT_EQUAL(n, strlen(expected));
+    CU_ASSERT_EQUAL(memcmp(buf, expected, strlen(expected)), 0);
+}
+
+void test_symbol_index() {
+    const char* index_file = "test_output.sym";
+    char name[32];
+    SymbolTable* table = create_table(SYMTBL_UNIQUE_NAME);
+    for (uint32_t i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "label_%u", (i * 37) % 100);
+        add_to_table(table, name, 4 * i);
+    }
+    CU_ASSERT_EQUAL(write_symbol_index(index_file, table, 5, hash_name("abcde", 5)), 0);
+
+    SymbolIndex index;
+    if (open_symbol_index(&index, index_file) != 0) {
+        CU_FAIL("Could not open symbol index");
+        free_table(table);
+        return;
+    }
+    CU_ASSERT_TRUE(symbol_index_matches(&index, "abcde", 5));
+    CU_ASSERT_FALSE(symbol_index_matches(&index, "abcdf", 5));
+    for (uint32_t i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "label_%u", (i * 37) % 100);
+        CU_ASSERT_EQUAL(find_symbol(&index, name, strlen(name)), 4 * i);
+        CU_ASSERT_EQUAL(find_symbol_sorted(&index, name, strlen(name)), 4 * i);
+    }
+    CU_ASSERT_EQUAL(find_symbol(&index, "label_1", 6), -1);
+    CU_ASSERT_EQUAL(find_symbol(&index, "label_100", 9), -1);
+    CU_ASSERT_EQUAL(find_symbol_sorted(&index, "label_", 6), -1);
+    CU_ASSERT_EQUAL(find_symbol_sorted(&index, "zzz", 3), -1);
+
+    // loading keeps the order of the original table
+    SymbolTable* loaded = create_table(SYMTBL_UNIQUE_NAME);
+    load_symbol_index(&index, loaded);
+    CU_ASSERT_EQUAL(loaded->len, table->len);
+    CU_ASSERT_EQUAL(loaded->mode, SYMTBL_UNIQUE_NAME);
+    for (uint32_t i = 0; i < loaded->len && i < table->len; i++) {
+        CU_ASSERT_STRING_EQUAL(symbol_name(loaded, i), symbol_name(table, i));
+        CU_ASSERT_EQUAL(loaded->tbl[i].addr, table->tbl[i].addr);
+    }
+    size_t size = index.file.size;
+    close_symbol_index(&index);
+    free_table(loaded);
+    free_table(table);
+
+    // a truncated index is rejected
+    CU_ASSERT_EQUAL(truncate(index_file, size - 8), 0);
+    CU_ASSERT_EQUAL(open_symbol_index(&index, index_file), -1);
+    remove(index_file);
+}
+
+#define RING_ITEMS 1000000
+
+static void* produce_items(void* arg) {
+    Ring* ring = arg;
+    for (uintptr_t i = 1; i <= RING_ITEMS; i++) {
+        ring_push_wait(ring, (void*) i);
+    }
+    return NULL;
+}
+
+void test_ring() {
+    Ring ring;
+    init_ring(&ring, 3);
+    CU_ASSERT_EQUAL(ring.cap, 4);
+    CU_ASSERT_PTR_NULL(ring_pop(&ring));
+    for (uintptr_t i = 1; i <= 4; i++) {
+        CU_ASSERT_EQUAL(ring_push(&ring, (void*) i), 0);
+    }
+    CU_ASSERT_EQUAL(ring_push(&ring, (void*) 5), -1);
+    for (uintptr_t i = 1; i <= 4; i++) {
+        CU_ASSERT_EQUAL((uintptr_t) ring_pop(&ring), i);
+    }
+    CU_ASSERT_PTR_NULL(ring_pop(&ring));
+
+    // items arrive in order across threads
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, produce_items, &ring) != 0) {
+        CU_FAIL("Could not start producer thread");
+        free_ring(&ring);
+        return;
+    }
+    uintptr_t errors = 0;
+    for (uintptr_t i = 1; i <= RING_ITEMS; i++) {
+        void* item;
+        ring_pop_wait(&ring, &item);
+        errors += (uintptr_t) item != i;
+    }
+    pthread_join(producer, NULL);
+    CU_ASSERT_EQUAL(errors, 0);
+    CU_ASSERT_PTR_NULL(ring_pop(&ring));
+    free_ring(&ring);
+}
+
+#define POOL_TASKS 1000
+
+static void count_task(void* ctx, uint32_t task) {
+    uint32_t* runs = ctx;
+    __atomic_fetch_add(&runs[task], 1, __ATOMIC_RELAXED);
+}
+
+void test_pool() {
+    uint32_t order[POOL_TASKS];
+    uint32_t runs[POOL_TASKS];
+    for (uint32_t i = 0; i < POOL_TASKS; i++) {
+        order[i] = POOL_TASKS - 1 - i;
+    }
+
+    uint32_t thread_counts[] = {1, 3, 8, POOL_TASKS + 5};
+    for (int t = 0; t < 4; t++) {
+        memset(runs, 0, sizeof(runs));
+        run_pool(thread_counts[t], order, POOL_TASKS, count_task, runs);
+        uint32_t wrong = 0;
+        for (uint32_t i = 0; i < POOL_TASKS; i++) {
+            wrong += runs[i] != 1;
+        }
+        CU_ASSERT_EQUAL(wrong, 0);
+    }
+
+    // nothing to do
+    run_pool(4, order, 0, count_task, runs);
+}
+
+#define BULK_FILES 5
+
+void test_bulk_io() {
+    char* names[BULK_FILES + 1];
+    char name_buf[BULK_FILES][32];
+    uint32_t order[BULK_FILES + 1];
+    // the last file is larger than a registered buffer
+    size_t sizes[BULK_FILES] = {0, 1, 4096, 100003, BULK_SLOT_SIZE + 17};
+    for (int i = 0; i < BULK_FILES; i++) {
+        sprintf(name_buf[i], "test_output_bulk%d.txt", i);
+        names[i] = name_buf[i];
+        order[i] = BULK_FILES - 1 - i;
+    }
+    names[BULK_FILES] = "test_output_missing.txt";
+    order[BULK_FILES] = BULK_FILES;
+
+    BulkBackend backends[] = {BULK_URING, BULK_PREAD};
+    for (int b = 0; b < 2; b++) {
+        BulkIO io;
+        open_bulk_io(&io, names, order, BULK_FILES, backends[b]);
+        for (int i = 0; i < BULK_FILES; i++) {
+            char* data = malloc(sizes[i] + 1);
+            for (size_t k = 0; k < sizes[i]; k++) {
+                data[k] = 'a' + (k * 7 + i + b) % 26;
+            }
+            bulk_write(&io, i, names[i], data, sizes[i]);
+        }
+        for (int i = 0; i < BULK_FILES; i++) {
+            CU_ASSERT_EQUAL(bulk_written(&io, i), 0);
+        }
+        close_bulk_io(&io);
+
+        open_bulk_io(&io, names, order, BULK_FILES + 1, backends[b]);
+        for (int j = 0; j <= BULK_FILES; j++) {
+            uint32_t i = order[j];
+            const char* data;
+            size_t size;
+            if (i == BULK_FILES) {
+                CU_ASSERT_EQUAL(bulk_read(&io, i, &data, &size), -1);
+                continue;
+            }
+            CU_ASSERT_EQUAL(bulk_read(&io, i, &data, &size), 0);
+            CU_ASSERT_EQUAL(size, sizes[i]);
+            size_t wrong = 0;
+            for (size_t k = 0; k < size && k < sizes[i]; k++) {
+                wrong += data[k] != 'a' + (k * 7 + i + b) % 26;
+            }
+            CU_ASSERT_EQUAL(wrong, 0);
+            bulk_release(&io, i);
+        }
+        close_bulk_io(&io);
+    }
+
+    for (int i = 0; i < BULK_FILES; i++) {
+        remove(names[i]);
+    }
+}
+
+static const char* const LIB_INPUTS[] = {
+    "combined", "comments", "imm", "jumps", "labels", "p1_errors", "p2_errors", "pseudo",
+    "pseudo_branch", "rtypes", "simple"
+};
+#define NUM_LIB_INPUTS (sizeof(LIB_INPUTS) / sizeof(LIB_INPUTS[0]))
+#define LIB_THREADS 4
+
+/* Returns 0 if assembling FILE_NAME in CTX gives the reference object file,
+   and, for the file with pass one errors, the reference messages.
+ */
+static int check_assemble_mem(AsmContext* ctx, const char* file_name) {
+    char path[BUF_SIZE];
+    Reader src, expected;
+    snprintf(path, BUF_SIZE, "input/%s.s", file_name);
+    if (open_reader(&src, path) != 0) {
+        return -1;
+    }
+    snprintf(path, BUF_SIZE, "out/ref/%s_ref.out", file_name);
+    if (open_reader(&expected, path) != 0) {
+        close_reader(&src);
+        return -1;
+    }
+
+    char* out;
+    size_t out_len;
+    int err = assemble_mem(ctx, src.data, src.size, &out, &out_len);
+    int wrong = err < 0 || (err != 0) != (strstr(file_name, "errors") != NULL)
+        || out_len != expected.size || memcmp(out, expected.data, out_len) != 0;
+    close_reader(&expected);
+    close_reader(&src);
+    free(out);
+
+    if (strcmp(file_name, "p1_errors") == 0) {
+        // the reference log is of pass one alone, and ends with the summary
+        // main() adds
+        const char* summary = "One or more errors encountered during assembly operation.\n";
+        if (open_reader(&expected, "log/ref/p1_errors_ref.txt") != 0) {
+            return -1;
+        }
+        size_t len;
+        const char* messages = context_messages(ctx, &len);
+        size_t pass_one_len = expected.size - strlen(summary);
+        wrong |= len < pass_one_len || memcmp(messages, expected.data, pass_one_len) != 0;
+        close_reader(&expected);
+    }
+    return wrong;
+}
+
+static void* run_lib_thread(void* arg) {
+    int* wrong = arg;
+    AsmContext* ctx = create_context(0);
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < NUM_LIB_INPUTS; i++) {
+            *wrong += check_assemble_mem(ctx, LIB_INPUTS[i]) != 0;
+        }
+    }
+    free_context(ctx);
+    return NULL;
+}
+
+void test_assemble_mem() {
+    AsmContext* ctx = create_context(0);
+    CU_ASSERT_PTR_NOT_NULL(ctx);
+    for (size_t i = 0; i < NUM_LIB_INPUTS; i++) {
+        CU_ASSERT_EQUAL(check_assemble_mem(ctx, LIB_INPUTS[i]), 0);
+    }
+
+    // messages stay in the context
+    char* out;
+    size_t out_len;
+    const char* bad = "addu $t0 $t1\nfoo $t0\n";
+    CU_ASSERT_EQUAL(assemble_mem(ctx, bad, strlen(bad), &out, &out_len), 1);
+    CU_ASSERT_STRING_EQUAL(context_messages(ctx, NULL),
+        "Error - invalid instruction at line 1: addu $t0 $t1\n"
+        "Error - invalid instruction at line 2: foo $t0\n");
+    free(out);
+    CU_ASSERT_EQUAL(assemble_mem(ctx, "", 0, &out, &out_len), 0);
+    CU_ASSERT_STRING_EQUAL(context_messages(ctx, NULL), "");
+    free(out);
+
+    // running out of memory on a job thread fails the assembly, not the
+    // process, and leaves the context usable
+    Writer big;
+    open_writer_mem(&big);
+    char line[64];
+    for (uint32_t i = 0; i < 40000; i++) {
+        sprintf(line, "label_%u: addiu $t0 $t1 %u\n", i, i % 1000);
+        put_str(&big, line);
+    }
+    ctx->jobs = 4;
+    ctx->arena.limit = 256 << 10;
+    CU_ASSERT_EQUAL(assemble_mem(ctx, big.buf, big.len, &out, &out_len), -1);
+    CU_ASSERT_PTR_NULL(out);
+    CU_ASSERT_STRING_EQUAL(context_messages(ctx, NULL), "Error: allocation failed\n");
+    CU_ASSERT_PTR_NULL(ctx->arena.children);
+    ctx->arena.limit = 0;
+    char* parallel_out;
+    size_t parallel_len;
+    CU_ASSERT_EQUAL(assemble_mem(ctx, big.buf, big.len, &parallel_out, &parallel_len), 0);
+    CU_ASSERT_PTR_NULL(ctx->arena.children);
+    ctx->jobs = 1;
+    CU_ASSERT_EQUAL(assemble_mem(ctx, big.buf, big.len, &out, &out_len), 0);
+    CU_ASSERT_EQUAL(out_len, parallel_len);
+    CU_ASSERT(out_len == parallel_len && memcmp(out, parallel_out, out_len) == 0);
+    free(out);
+    free(parallel_out);
+    close_writer(&big);
+    free_context(ctx);
+
+    // contexts on different threads do not interfere
+    pthread_t threads[LIB_THREADS];
+    int wrong[LIB_THREADS] = {0};
+    for (int t = 0; t < LIB_THREADS; t++) {
+        pthread_create(&threads[t], NULL, run_lib_thread, &wrong[t]);
+    }
+    for (int t = 0; t < LIB_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        CU_ASSERT_EQUAL(wrong[t], 0);
+    }
+}
+
+#define GLOBAL_THREADS 8
+#define GLOBAL_SYMBOLS (1 << 20)
+#define GLOBAL_SHARED 1000
+
+typedef struct {
+    GlobalTable* table;
+    int thread;
+    uint32_t added;
+    uint32_t duplicates;
+    uint32_t wrong;
+} GlobalJob;
+
+/* Adds every GLOBAL_THREADS-th symbol starting at JOB->thread, plus the
+   shared ones that every thread adds, while looking up what the others have
+   added so far.
+ */
+static void* run_global_job(void* arg) {
+    GlobalJob* job = arg;
+    Writer log;
+    open_writer_mem(&log);
+    Writer* outer = capture_log(&log);
+    char name[32];
+    for (uint32_t i = job->thread; i < GLOBAL_SYMBOLS; i += GLOBAL_THREADS) {
+        int len = sprintf(name, "sym%u", i);
+        job->added += add_global(job->table, name, len, i * 4) == 0;
+        if (i / GLOBAL_THREADS < GLOBAL_SHARED) {
+            len = sprintf(name, "shared%u", i / GLOBAL_THREADS);
+            job->added += add_global(job->table, name, len, 4) == 0;
+        }
+
+        // a symbol of another thread is either there with its address or not yet
+        uint32_t other = i ^ 1;
+        len = sprintf(name, "sym%u", other);
+        int64_t addr = get_global(job->table, name, len);
+        job->wrong += addr != -1 && addr != other * 4;
+    }
+    capture_log(outer);
+    for (size_t i = 0; i < log.len; i++) {
+        job->duplicates += log.buf[i] == '\n';
+    }
+    close_writer(&log);
+    return NULL;
+}
+
+void test_global_table() {
+    GlobalTable table;
+    init_global_table(&table, 3);
+    CU_ASSERT_EQUAL(add_global(&table, "abc", 3, 4), 0);
+    CU_ASSERT_EQUAL(add_global(&table, "abcd", 3, 8), -1);
+    CU_ASSERT_EQUAL(add_global(&table, "xyz", 3, 12), 0);
+    CU_ASSERT_EQUAL(get_global(&table, "abc", 3), 4);
+    CU_ASSERT_EQUAL(get_global(&table, "xyz", 3), 12);
+    CU_ASSERT_EQUAL(get_global(&table, "ab", 2), -1);
+    CU_ASSERT_STRING_EQUAL(find_global(&table, "xyz", 3)->name, "xyz");
+    // the names went into one pool for this thread, and the duplicate did not
+    CU_ASSERT(table.names != NULL && table.names->next == NULL);
+    CU_ASSERT_EQUAL(table.names->pool.len, 2);
+    // fill it up, it has room for more than asked for
+    char name[32];
+    uint32_t added = 2;
+    while (add_global(&table, name, sprintf(name, "n%u", added), 0) == 0) {
+        added++;
+    }
+    CU_ASSERT(added >= 3);
+    CU_ASSERT_EQUAL(table.len, added);
+    CU_ASSERT_EQUAL(get_global(&table, "n2", 2), 0);
+    free_global_table(&table);
+
+    init_global_table(&table, GLOBAL_SYMBOLS + GLOBAL_SHARED);
+    pthread_t threads[GLOBAL_THREADS];
+    GlobalJob jobs[GLOBAL_THREADS];
+    memset(jobs, 0, sizeof(jobs));
+    for (int t = 0; t < GLOBAL_THREADS; t++) {
+        jobs[t].table = &table;
+        jobs[t].thread = t;
+        pthread_create(&threads[t], NULL, run_global_job, &jobs[t]);
+    }
+    added = 0;
+    uint32_t duplicates = 0, wrong = 0;
+    for (int t = 0; t < GLOBAL_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        added += jobs[t].added;
+        duplicates += jobs[t].duplicates;
+        wrong += jobs[t].wrong;
+    }
+    // every name went in exactly once, and every other try was reported
+    CU_ASSERT_EQUAL(added, GLOBAL_SYMBOLS + GLOBAL_SHARED);
+    CU_ASSERT_EQUAL(table.len, GLOBAL_SYMBOLS + GLOBAL_SHARED);
+    CU_ASSERT_EQUAL(duplicates, (GLOBAL_THREADS - 1) * GLOBAL_SHARED);
+    CU_ASSERT_EQUAL(wrong, 0);
+    // a thread keeps only the names it tried, each once, even those it lost
+    uint32_t num_pools = 0, num_names = 0;
+    for (GlobalNames* names = table.names; names; names = names->next) {
+        num_pools++;
+        num_names += names->pool.len;
+    }
+    CU_ASSERT_EQUAL(num_pools, GLOBAL_THREADS);
+    CU_ASSERT(num_names <= GLOBAL_SYMBOLS + GLOBAL_THREADS * GLOBAL_SHARED);
+
+    uint32_t missing = 0;
+    for (uint32_t i = 0; i < GLOBAL_SYMBOLS; i++) {
+        int len = sprintf(name, "sym%u", i);
+        missing += get_global(&table, name, len) != i * 4;
+    }
+    CU_ASSERT_EQUAL(missing, 0);
+    free_global_table(&table);
+}
+
+#define TEST_SOCKET "test_output.sock"
+
+static void* run_test_daemon(void* arg) {
+    *(int*) arg = serve_daemon(TEST_SOCKET);
+    return NULL;
+}
+
+void test_daemon() {
+    pthread_t server;
+    int served = -1;
+    pthread_create(&server, NULL, run_test_daemon, &served);
+    int fd = -1;
+    for (int tries = 0; tries < 500 && fd < 0; tries++) {
+        usleep(10000);
+        fd = connect_daemon(TEST_SOCKET);
+    }
+    CU_ASSERT(fd >= 0);
+
+    // several requests over one connection, on a context that stays warm
+    Reader src, expected;
+    CU_ASSERT_EQUAL(open_reader(&src, "input/p2_errors.s"), 0);
+    CU_ASSERT_EQUAL(open_reader(&expected, "out/ref/p2_errors_ref.out"), 0);
+    for (int i = 0; i < 3 && fd >= 0; i++) {
+        char *out, *log;
+        size_t out_len, log_len;
+        CU_ASSERT_EQUAL(request_assembly(fd, src.data, src.size, 0, 1, &out, &out_len, &log,
+            &log_len), 1);
+        CU_ASSERT_EQUAL(out_len, expected.size);
+        CU_ASSERT(out_len == expected.size && memcmp(out, expected.data, out_len) == 0);
+        CU_ASSERT_PTR_NOT_NULL(strstr(log, "Error - invalid instruction at line 2: jal\n"));
+        free(out);
+        free(log);
+    }
+    close_reader(&src);
+    close_reader(&expected);
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // a second daemon on the same socket is refused
+    CU_ASSERT_EQUAL(serve_daemon(TEST_SOCKET), -1);
+
+    pthread_kill(server, SIGTERM);
+    pthread_join(server, NULL);
+    CU_ASSERT_EQUAL(served, 0);
+    CU_ASSERT_EQUAL(connect_daemon(TEST_SOCKET), -1);
+}
+
+#define TEST_CACHE "test_output.cache"
+
+/* Fetches KEY from CACHE into test_output.out and TMP_NAME, and checks that
+   it gives STATUS, OBJ and the messages LOG.
+ */
+static void check_cache_fetch(AsmCache* cache, const CacheKey* key, const char* tmp_name,
+    int status, const char* obj, const char* log) {
+    Writer messages;
+    open_writer_mem(&messages);
+    Writer* outer = capture_log(&messages);
+    CU_ASSERT_EQUAL(cache_fetch(cache, key, "test_output.out", tmp_name), status);
+    capture_log(outer);
+    CU_ASSERT_EQUAL(messages.len, strlen(log));
+    CU_ASSERT(strncmp(messages.buf, log, messages.len) == 0);
+    close_writer(&messages);
+
+    Reader fetched;
+    CU_ASSERT_EQUAL(open_reader(&fetched, "test_output.out"), 0);
+    CU_ASSERT(fetched.size == strlen(obj) && memcmp(fetched.data, obj, fetched.size) == 0);
+    close_reader(&fetched);
+}
+
+void test_cache() {
+    AsmCache cache;
+    CU_ASSERT_EQUAL(open_cache(&cache, TEST_CACHE, CACHE_DEFAULT_SIZE), 0);
+
+    const char* src = "addiu $t0 $t0 1\n";
+    CacheKey key = cache_key(src, strlen(src), 0);
+    CacheKey other_source = cache_key(src, strlen(src) - 1, 0);
+    CacheKey other_options = cache_key(src, strlen(src), ASM_BINARY_OBJECT);
+    CU_ASSERT(strcmp(key.name, other_source.name) != 0);
+    CU_ASSERT(strcmp(key.name, other_options.name) != 0);
+
+    CU_ASSERT_EQUAL(cache_fetch(&cache, &key, "test_output.out", NULL), -1);
+    const char* obj = ".text\n25080001\n";
+    const char* log = "Error - something at line 1\n";
+    cache_store(&cache, &key, obj, strlen(obj), NULL, log, strlen(log), 1);
+    check_cache_fetch(&cache, &key, NULL, 1, obj, log);
+    // writing the fetched file again replaces it rather than the entry
+    FILE* f;
+    Writer dst;
+    CU_ASSERT_EQUAL(open_writer(&dst, "test_output.out", 0), 0);
+    put_str(&dst, "overwritten");
+    CU_ASSERT_EQUAL(close_writer(&dst), 0);
+    check_cache_fetch(&cache, &key, NULL, 1, obj, log);
+    // but a hard link that the cache did not make is written through
+    unlink("test_output.out");
+    f = fopen("test_output.out", "w");
+    fclose(f);
+    CU_ASSERT_EQUAL(link("test_output.out", "test_output.link"), 0);
+    CU_ASSERT_EQUAL(open_writer(&dst, "test_output.out", 0), 0);
+    put_str(&dst, "overwritten");
+    CU_ASSERT_EQUAL(close_writer(&dst), 0);
+    Reader linked;
+    CU_ASSERT_EQUAL(open_reader(&linked, "test_output.link"), 0);
+    CU_ASSERT(linked.size == 11 && memcmp(linked.data, "overwritten", 11) == 0);
+    close_reader(&linked);
+    unlink("test_output.link");
+
+    // an entry stored without an intermediate file misses when one is wanted
+    CU_ASSERT_EQUAL(cache_fetch(&cache, &key, "test_output.out", "test_output.int"), -1);
+    char* sym_name = symbol_index_name("test_output.int");
+    f = fopen("test_output.int", "w");
+    fputs(src, f);
+    fclose(f);
+    f = fopen(sym_name, "w");
+    fputs("index", f);
+    fclose(f);
+    cache_store(&cache, &other_options, obj, strlen(obj), "test_output.int", "", 0, 0);
+    unlink("test_output.int");
+    unlink(sym_name);
+    check_cache_fetch(&cache, &other_options, "test_output.int", 0, obj, "");
+    Reader fetched;
+    CU_ASSERT_EQUAL(open_reader(&fetched, "test_output.int"), 0);
+    CU_ASSERT(fetched.size == strlen(src) && memcmp(fetched.data, src, fetched.size) == 0);
+    close_reader(&fetched);
+    CU_ASSERT_EQUAL(access(sym_name, R_OK), 0);
+    unlink("test_output.int");
+    unlink(sym_name);
+    free(sym_name);
+
+    CU_ASSERT_EQUAL(cache.hits, 3);
+    CU_ASSERT_EQUAL(cache.misses, 2);
+    CU_ASSERT_EQUAL(cache.stores, 2);
+
+    // with room for one entry, the ones used least recently go; file times
+    // only move on every clock tick, so give each use a tick of its own
+    usleep(50000);
+    cache_store(&cache, &other_source, obj, strlen(obj), NULL, log, strlen(log), 1);
+    usleep(50000);
+    check_cache_fetch(&cache, &key, NULL, 1, obj, log);
+    cache.max_size = strlen(obj) + 2 + strlen(log);
+    close_cache(&cache);
+    CU_ASSERT_EQUAL(cache.evictions, 2);
+    CU_ASSERT_EQUAL(open_cache(&cache, TEST_CACHE, CACHE_DEFAULT_SIZE), 0);
+    check_cache_fetch(&cache, &key, NULL, 1, obj, log);
+    CU_ASSERT_EQUAL(cache_fetch(&cache, &other_source, "test_output.out", NULL), -1);
+    CU_ASSERT_EQUAL(cache_fetch(&cache, &other_options, "test_output.out", NULL), -1);
+    cache.max_size = 0;
+    close_cache(&cache);
+    CU_ASSERT_EQUAL(rmdir(TEST_CACHE), 0);
+    unlink("test_output.out");
+}
+
+void test_string_pool() {
+    StringPool pool;
+    init_pool(&pool, 0);
+    char buf[32];
+    const uint32_t count = 50000;
+    for (uint32_t i = 0; i < count; i++) {
+        sprintf(buf, "name_%u", i);
+        CU_ASSERT_EQUAL(pool_intern(&pool, buf, strlen(buf)), i);
+    }
+    // adding a string again gives the same id and stores nothing
+    CU_ASSERT_EQUAL(pool_intern(&pool, "name_123x", 8), 123);
+    CU_ASSERT_EQUAL(pool.len, count);
+    for (uint32_t i = 0; i < count; i++) {
+        sprintf(buf, "name_%u", i);
+        CU_ASSERT_EQUAL(pool_find(&pool, buf, strlen(buf)), i);
+        CU_ASSERT_STRING_EQUAL(pool_str(&pool, i), buf);
+        CU_ASSERT_EQUAL(pool_len(&pool, i), strlen(buf));
+        CU_ASSERT_EQUAL(pool_hash(&pool, i), hash_name(buf, strlen(buf)));
+    }
+    CU_ASSERT_EQUAL(pool_find(&pool, "name_", 5), NO_STRING);
+    CU_ASSERT_EQUAL(pool_find(&pool, "", 0), NO_STRING);
+
+    // strings never move, however long they are
+    const char* first = pool_str(&pool, 0);
+    char* longer = malloc(100000);
+    memset(longer, 'x', 99999);
+    longer[99999] = '\0';
+    uint32_t id = pool_intern(&pool, longer, 99999);
+    CU_ASSERT_EQUAL(pool_intern(&pool, "", 0), id + 1);
+    CU_ASSERT(pool_str(&pool, 0) == first);
+    CU_ASSERT_STRING_EQUAL(pool_str(&pool, id), longer);
+    CU_ASSERT_STRING_EQUAL(pool_str(&pool, id + 1), "");
+    free(longer);
+
+    char* first_chunk = pool.chunks[0];
+    clear_pool(&pool);
+    CU_ASSERT_EQUAL(pool.len, 0);
+    CU_ASSERT_EQUAL(pool.num_chunks, 1);
+    CU_ASSERT_EQUAL(pool_find(&pool, "name_1", 6), NO_STRING);
+    CU_ASSERT_EQUAL(pool_intern(&pool, "name_1", 6), 0);
+    CU_ASSERT_STRING_EQUAL(pool_str(&pool, 0), "name_1");
+    CU_ASSERT(pool_str(&pool, 0) == first_chunk);
+    free_pool(&pool);
+
+    // a table keeps each name once, however many symbols share it
+    SymbolTable* rel = create_table(SYMTBL_NON_UNIQUE);
+    for (int i = 0; i < 1000; i++) {
+        CU_ASSERT_EQUAL(add_to_table(rel, i % 2 ? "printf" : "malloc", 4 * i), 0);
+    }
+    CU_ASSERT_EQUAL(rel->len, 1000);
+    CU_ASSERT_EQUAL(rel->names.len, 2);
+    CU_ASSERT_EQUAL(rel->tbl[3].name, rel->tbl[999].name);
+    CU_ASSERT_STRING_EQUAL(symbol_name(rel, 999), "printf");
+    free_table(rel);
+}
+
+void test_addr_index() {
+    SymbolTable* tbl = create_table(SYMTBL_UNIQUE_NAME);
+    AddrIndex index;
+    build_addr_index(&index, tbl);
+    CU_ASSERT_EQUAL(find_symbol_at(&index, 0), -1);
+    CU_ASSERT_EQUAL(find_symbol_at_binary(&index, 0), -1);
+    free_addr_index(&index);
+
+    // uneven gaps, an alias and a symbol added out of order
+    char buf[16];
+    uint32_t addr = 8;
+    for (int i = 0; i < 1000; i++) {
+        sprintf(buf, "f%d", i);
+        CU_ASSERT_EQUAL(add_to_table(tbl, buf, addr), 0);
+        addr += i % 10 == 0 ? 4000 : 4 * (i % 7 + 1);
+    }
+    CU_ASSERT_EQUAL(add_to_table(tbl, "alias", tbl->tbl[500].addr), 0);
+    CU_ASSERT_EQUAL(add_to_table(tbl, "early", 4), 0);
+    build_addr_index(&index, tbl);
+    CU_ASSERT_EQUAL(index.len, 1002);
+    CU_ASSERT_EQUAL(index.symbols[0], 1001);
+
+    CU_ASSERT_EQUAL(find_symbol_at(&index, 0), -1);
+    CU_ASSERT_EQUAL(find_symbol_at(&index, 4), 1001);
+    CU_ASSERT_EQUAL(find_symbol_at(&index, 7), 1001);
+    CU_ASSERT_EQUAL(find_symbol_at(&index, UINT32_MAX), 999);
+    for (int i = 0; i < 1000; i++) {
+        uint32_t start = tbl->tbl[i].addr;
+        uint32_t end = i + 1 < 1000 ? tbl->tbl[i + 1].addr : start + 4;
+        for (uint32_t a = start; a < end; a += (end - start) / 3 + 1) {
+            CU_ASSERT_EQUAL(find_symbol_at(&index, a), i);
+            CU_ASSERT_EQUAL(find_symbol_at_binary(&index, a), i);
+        }
+        CU_ASSERT_EQUAL(find_symbol_at(&index, end - 1), i);
+    }
+
+    Writer map;
+    open_writer_mem(&map);
+    write_symbol_map(&index, tbl, tbl->tbl[999].addr + 12, &map);
+    put_char(&map, '\0');
+    const char* head = "4\t4\tearly\n8\t4000\tf0\n4008\t8\tf1\n";
+    CU_ASSERT(strncmp(map.buf, head, strlen(head)) == 0);
+    sprintf(buf, "\t%u\tf999\n", 12);
+    CU_ASSERT(strcmp(map.buf + map.len - 1 - strlen(buf), buf) == 0);
+    // an alias has the size of the symbol it shares an address with
+    char line[64];
+    uint32_t size = tbl->tbl[501].addr - tbl->tbl[500].addr;
+    sprintf(line, "\n%u\t%u\tf500\n%u\t%u\talias\n", tbl->tbl[500].addr, size,
+        tbl->tbl[500].addr, size);
+    CU_ASSERT_PTR_NOT_NULL(strstr(map.buf, line));
+    close_writer(&map);
+
+    free_addr_index(&index);
+    free_table(tbl);
+}
+
+void test_table_sites() {
+    SymbolTable* rel = create_table(SYMTBL_NON_UNIQUE);
+    SymbolTable* more = create_table(SYMTBL_NON_UNIQUE);
+    const char* names[] = { "printf", "malloc", "free" };
+    for (uint32_t i = 0; i < 300; i++) {
+        CU_ASSERT_EQUAL(add_to_table(i < 200 ? rel : more, names[i % 3 == 2 ? 0 : i % 3],
+            4 * i), 0);
+    }
+
+    uint32_t count;
+    const uint32_t* sites = find_sites(rel, "malloc", 6, &count);
+    CU_ASSERT_EQUAL(count, 67);
+    for (uint32_t k = 0; k < count; k++) {
+        CU_ASSERT_EQUAL(sites[k], 3 * k + 1);
+        CU_ASSERT_EQUAL(rel->tbl[sites[k]].addr, 4 * (3 * k + 1));
+    }
+    CU_ASSERT_PTR_NULL(find_sites(rel, "free", 4, &count));
+    CU_ASSERT_EQUAL(count, 0);
+
+    // the groups follow the table as it changes
+    append_table(rel, more, 0);
+    sites = find_sites(rel, "printf", 6, &count);
+    CU_ASSERT_EQUAL(count, 200);
+    for (uint32_t k = 1; k < count; k++) {
+        CU_ASSERT(sites[k - 1] < sites[k]);
+        CU_ASSERT_STRING_EQUAL(symbol_name(rel, sites[k]), "printf");
+    }
+    CU_ASSERT_EQUAL(add_to_table(rel, "free", 0), 0);
+    sites = find_sites(rel, "free", 4, &count);
+    CU_ASSERT_EQUAL(count, 1);
+    CU_ASSERT_EQUAL(sites[0], 300);
+
+    // emission order is the order of addition
+    for (uint32_t i = 0; i < 300; i++) {
+        CU_ASSERT_EQUAL(rel->tbl[i].addr, 4 * i);
+    }
+    CU_ASSERT_EQUAL(sizeof(Symbol), 8);
+
+    clear_table(rel);
+    CU_ASSERT_PTR_NULL(find_sites(rel, "printf", 6, &count));
+    free_table(more);
+    free_table(rel);
+}
+
+void test_arena() {
+    Arena arena;
+    init_arena(&arena, 0);
+    Arena* outer = use_arena(&arena);
+
+    // a freed block is handed out again for the next block of its class
+    char* a = mem_alloc(20);
+    char* b = mem_alloc(100);
+    CU_ASSERT(((uintptr_t) a & 15) == 0 && ((uintptr_t) b & 15) == 0);
+    mem_free(a);
+    CU_ASSERT(mem_alloc(32) == a);
+    CU_ASSERT(mem_alloc(20) != a);
+
+    // growing past its class moves a block, and keeps what it held
+    strcpy(b, "kept across classes");
+    b = mem_realloc(b, 5000);
+    CU_ASSERT_STRING_EQUAL(b, "kept across classes");
+    CU_ASSERT(mem_realloc(b, 6000) == b);
+    uint32_t* words = mem_calloc(100000, sizeof(uint32_t));
+    for (uint32_t i = 0; i < 100000; i++) {
+        CU_ASSERT_EQUAL(words[i], 0);
+        words[i] = i;
+    }
+    words = mem_realloc(words, 300000 * sizeof(uint32_t));
+    CU_ASSERT_EQUAL(words[99999], 99999);
+    mem_free(words);
+    CU_ASSERT(arena.num_allocs >= 6);
+    CU_ASSERT(arena.peak >= 300000 * sizeof(uint32_t));
+
+    // tables allocated in the arena do not need to be freed one by one
+    SymbolTable* tbl = create_table(SYMTBL_UNIQUE_NAME);
+    char buf[32];
+    for (uint32_t i = 0; i < 10000; i++) {
+        sprintf(buf, "label_%u", i);
+        CU_ASSERT_EQUAL(add_to_table(tbl, buf, 4 * i), 0);
+    }
+    CU_ASSERT_EQUAL(get_addr_for_symbol(tbl, "label_9999"), 4 * 9999);
+    uint64_t num_mallocs = arena.num_mallocs;
+    CU_ASSERT(num_mallocs < arena.num_allocs);
+
+    // blocks of an arena that is not in use are left alone, and blocks from
+    // outside any arena are plain malloc() blocks
+    use_arena(NULL);
+    mem_free(a);
+    char* c = mem_realloc(b, 10000);
+    CU_ASSERT_STRING_EQUAL(c, "kept across classes");
+    mem_free(c);
+    CU_ASSERT_EQUAL(arena.num_mallocs, num_mallocs);
+    use_arena(&arena);
+    CU_ASSERT(mem_alloc(32) != a);
+    free_arena(&arena);
+    CU_ASSERT_EQUAL(arena.used, 0);
+    CU_ASSERT_PTR_NULL(arena.large);
+
+    // going over the limit is running out of memory
+    init_arena(&arena, 1 << 20);
+    jmp_buf on_oom;
+    jmp_buf* outer_handler = on_allocation_failure(&on_oom);
+    volatile int failed = 0;
+    if (setjmp(on_oom) == 0) {
+        for (int i = 0; i < 100; i++) {
+            mem_alloc(1000);
+        }
+        mem_alloc(2 << 20);
+    } else {
+        failed = 1;
+    }
+    on_allocation_failure(outer_handler);
+    CU_ASSERT(failed);
+    CU_ASSERT(arena.used <= arena.limit);
+    free_arena(&arena);
+    use_arena(outer);
+}
 
 int main(int argc, char** argv) {
     CU_pSuite pSuite1 = NULL, pSuite2 = NULL, pSuite3 = NULL, pSuite4 = NULL;
+    CU_pSuite pSuite5 = NULL, pSuite6 = NULL, pSuite7 = NULL, pSuite8 = NULL;
+    CU_pSuite pSuite9 = NULL, pSuite10 = NULL, pSuite11 = NULL, pSuite12 = NULL;
+    CU_pSuite pSuite13 = NULL, pSuite14 = NULL, pSuite15 = NULL;
+    CU_pSuite pSuite16 = NULL, pSuite17 = NULL, pSuite18 = NULL;
 
     if (CUE_SUCCESS != CU_initialize_registry()) {
         return CU_get_error();
@@ -510,6 +1863,9 @@ int main(int argc, char** argv) {
     if (!CU_add_test(pSuite1, "test_translate_num", test_translate_num)) {
         goto exit;
     }
+    if (!CU_add_test(pSuite1, "test_inst_hex_batch", test_inst_hex_batch)) {
+        goto exit;
+    }
 
     /* Suite 2 */
     pSuite2 = CU_add_suite("Testing tables.c", init_log_file, NULL);
@@ -522,6 +1878,15 @@ int main(int argc, char** argv) {
     if (!CU_add_test(pSuite2, "test_table_2", test_table_2)) {
         goto exit;
     }
+    if (!CU_add_test(pSuite2, "test_table_index", test_table_index)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite2, "test_table_sites", test_table_sites)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite2, "test_addr_index", test_addr_index)) {
+        goto exit;
+    }
 
     /* Suite 3 */
     pSuite3 = CU_add_suite("Testing translate.c", init_log_file, NULL);
@@ -564,6 +1929,150 @@ int main(int argc, char** argv) {
     if (!CU_add_test(pSuite4, "test_write_pass_one", test_write_pass_one)) {
         goto exit;
     }
+    if (!CU_add_test(pSuite4, "test_backpatch", test_backpatch)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite4, "test_append_program", test_append_program)) {
+        goto exit;
+    }
+
+    /* Suite 5 */
+    pSuite5 = CU_add_suite("Testing lexer.c", NULL, NULL);
+    if (!pSuite5) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite5, "test_lexer", test_lexer)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite5, "test_translate_num_span", test_translate_num_span)) {
+        goto exit;
+    }
+
+    /* Suite 6 */
+    pSuite6 = CU_add_suite("Testing scanner.c", NULL, NULL);
+    if (!pSuite6) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite6, "test_scanner_block", test_scanner_block)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite6, "test_scanner_inputs", test_scanner_inputs)) {
+        goto exit;
+    }
+
+    /* Suite 7 */
+    pSuite7 = CU_add_suite("Testing reader.c and writer.c", NULL, NULL);
+    if (!pSuite7) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite7, "test_writer_format", test_writer_format)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite7, "test_writer_mmap", test_writer_mmap)) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite7, "test_reader_stream", test_reader_stream)) {
+        goto exit;
+    }
+
+    /* Suite 8 */
+    pSuite8 = CU_add_suite("Testing object.c", init_log_file, NULL);
+    if (!pSuite8) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite8, "test_object_round_trip", test_object_round_trip)) {
+        goto exit;
+    }
+
+    /* Suite 9 */
+    pSuite9 = CU_add_suite("Testing symindex.c", NULL, NULL);
+    if (!pSuite9) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite9, "test_symbol_index", test_symbol_index)) {
+        goto exit;
+    }
+
+    /* Suite 10 */
+    pSuite10 = CU_add_suite("Testing ring.c", NULL, NULL);
+    if (!pSuite10) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite10, "test_ring", test_ring)) {
+        goto exit;
+    }
+
+    /* Suite 11 */
+    pSuite11 = CU_add_suite("Testing pool.c", NULL, NULL);
+    if (!pSuite11) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite11, "test_pool", test_pool)) {
+        goto exit;
+    }
+
+    /* Suite 12 */
+    pSuite12 = CU_add_suite("Testing bulkio.c", NULL, NULL);
+    if (!pSuite12) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite12, "test_bulk_io", test_bulk_io)) {
+        goto exit;
+    }
+
+    /* Suite 13 */
+    pSuite13 = CU_add_suite("Testing libassembler.c", NULL, NULL);
+    if (!pSuite13) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite13, "test_assemble_mem", test_assemble_mem)) {
+        goto exit;
+    }
+
+    /* Suite 14 */
+    pSuite14 = CU_add_suite("Testing globals.c", NULL, NULL);
+    if (!pSuite14) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite14, "test_global_table", test_global_table)) {
+        goto exit;
+    }
+
+    /* Suite 15 */
+    pSuite15 = CU_add_suite("Testing daemon.c", NULL, NULL);
+    if (!pSuite15) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite15, "test_daemon", test_daemon)) {
+        goto exit;
+    }
+
+    /* Suite 16 */
+    pSuite16 = CU_add_suite("Testing cache.c", NULL, NULL);
+    if (!pSuite16) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite16, "test_cache", test_cache)) {
+        goto exit;
+    }
+
+    /* Suite 17 */
+    pSuite17 = CU_add_suite("Testing strpool.c", NULL, NULL);
+    if (!pSuite17) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite17, "test_string_pool", test_string_pool)) {
+        goto exit;
+    }
+
+    /* Suite 18 */
+    pSuite18 = CU_add_suite("Testing arena.c", NULL, NULL);
+    if (!pSuite18) {
+        goto exit;
+    }
+    if (!CU_add_test(pSuite18, "test_arena", test_arena)) {
+        goto exit;
+    }
 
 
     CU_basic_set_mode(CU_BRM_VERBOSE);